@@ -33,6 +33,24 @@ if( ${CMAKE_PROJECT_NAME}_ENABLE_BOOST )
 		set( Boost_INCLUDE_DIR ${Boost_INCLUDE_DIR} CACHE INTERNAL "Boost include directory" )
 		set( Boost_LIBRARY_DIRS ${Boost_LIBRARY_DIRS} CACHE INTERNAL "Boost library directory" )
 		set( Boost_LIBRARIES ${Boost_LIBRARIES} CACHE INTERNAL "List of linkable Boost libraries" )
+
+		# The zlib filters of Boost.Iostreams (gzip and zlib compressed output) need zlib at link time, as Boost is linked statically
+		find_package( ZLIB REQUIRED )
+		setup_message( "found zlib v${ZLIB_VERSION_STRING}" )
+		set( ZLIB_LIBRARIES ${ZLIB_LIBRARIES} CACHE INTERNAL "zlib libraries" )
+
+		# The zstd filters of Boost.Iostreams (1.70 and later) need libzstd; zstd compressed output is disabled without it
+		set( ZSTD_LIBRARIES "" CACHE INTERNAL "zstd libraries" )
+		if( NOT "${Boost_MAJOR_VERSION}.${Boost_MINOR_VERSION}" VERSION_LESS "1.70" )
+			find_library( ZSTD_LIBRARY NAMES zstd )
+			if( ZSTD_LIBRARY )
+				setup_message( "found zstd: ${ZSTD_LIBRARY}" )
+				set( ZSTD_LIBRARIES ${ZSTD_LIBRARY} CACHE INTERNAL "zstd libraries" )
+			else()
+				setup_message( "WARNING: could not find zstd; zstd compressed output is DISABLED" )
+				add_definitions( -D${CMAKE_PROJECT_NAME}_NO_ZSTD )
+			endif()
+		endif()
 		
 		# stop compiler from nagging about deprecated auto_ptr in boost v1.59.0 and earlier
 		set( CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -Wno-deprecated-declarations" CACHE INTERNAL "" )
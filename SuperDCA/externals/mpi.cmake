@@ -0,0 +1,34 @@
+# Version $Id:$
+
+cmake_minimum_required(VERSION 3.1)
+
+#option( ${CMAKE_PROJECT_NAME}_ENABLE_MPI "Find MPI and, if successful, enable use in ${CMAKE_PROJECT_NAME}" false )
+
+##############
+## MPI setup
+###
+
+set( ${CMAKE_PROJECT_NAME}_NO_MPI true CACHE INTERNAL "Don't use MPI, if true" ) # Initialize with default value 
+if( ${CMAKE_PROJECT_NAME}_ENABLE_MPI )
+	setup_message( "check for MPI" )
+	# If your MPI installation is not found automatically, then please set
+	# MPI_CXX_COMPILER to point to the MPI compiler wrapper (e.g. mpicxx).
+	find_package( MPI QUIET )
+	if( MPI_CXX_FOUND )
+		set( ${CMAKE_PROJECT_NAME}_NO_MPI false CACHE INTERNAL "Don't use MPI, if true" )
+		setup_message( "found MPI" )
+		setup_message( "include dirs: ${MPI_CXX_INCLUDE_PATH}" INDENT )
+		setup_message( "libraries: ${MPI_CXX_LIBRARIES}" INDENT )
+
+		set( MPI_CXX_INCLUDE_PATH ${MPI_CXX_INCLUDE_PATH} CACHE INTERNAL "MPI include directories" )
+		set( MPI_CXX_LIBRARIES ${MPI_CXX_LIBRARIES} CACHE INTERNAL "MPI libraries" )
+	else()
+		setup_message( "WARNING: could not find MPI headers and libraries" )
+	endif()
+endif()
+if( ${CMAKE_PROJECT_NAME}_NO_MPI )
+	add_definitions( -D${CMAKE_PROJECT_NAME}_NO_MPI )
+	setup_message( "MPI is DISABLED" )
+else()
+	setup_message( "MPI is enabled" )
+endif()
@@ -0,0 +1,194 @@
+/** @file Compressed_output.hpp
+	Block-parallel gzip and zstd compression of output streams.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COMPRESSED_OUTPUT_HPP
+#define SUPERDCA_COMPRESSED_OUTPUT_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <thread> // for std::thread::hardware_concurrency
+#include <streambuf>
+#include <stdexcept>
+#include <algorithm> // for std::max, std::min
+
+#include "boost/version.hpp"
+#include "boost/iostreams/filtering_stream.hpp"
+#include "boost/iostreams/device/back_inserter.hpp"
+#include "boost/iostreams/filter/gzip.hpp"
+#if BOOST_VERSION >= 107000 && !defined(SUPERDCA_NO_ZSTD) // Boost.Iostreams has zstd filters since 1.70; they need libzstd
+#define SUPERDCA_HAVE_ZSTD
+#include "boost/iostreams/filter/zstd.hpp"
+#endif
+
+namespace superdca {
+
+//> How an output file is compressed
+struct Output_compression
+{
+	enum Method { NONE, GZIP, ZSTD };
+
+	Method method;
+	int level; // compression level; -1 = the default of the method
+	std::size_t threads; // compressing threads; 0 = all hardware threads
+
+	Output_compression( Method method_=NONE, int level_=-1, std::size_t threads_=0 ) : method(method_), level(level_), threads(threads_) { }
+
+	bool enabled() const { return method != NONE; }
+	const char* extension() const { return method == GZIP ? ".gz" : method == ZSTD ? ".zst" : ""; }
+
+	//> "none", "gzip" or "zstd"; throws std::invalid_argument for anything else, or for zstd if it is not supported by this build
+	static Method parse_method( const std::string& method )
+	{
+		if( method == "none" ) { return NONE; }
+		if( method == "gzip" ) { return GZIP; }
+#ifdef SUPERDCA_HAVE_ZSTD
+		if( method == "zstd" ) { return ZSTD; }
+		throw std::invalid_argument( "invalid compression \"" + method + "\" (expected none, gzip or zstd)" );
+#else
+		throw std::invalid_argument( "invalid compression \"" + method + "\" (expected none or gzip; zstd requires Boost 1.70 or later)" );
+#endif
+	}
+};
+
+/** A stream buffer that compresses everything written to it, block by block and on several threads, into another
+	stream buffer (the sink).
+
+	Each block of 'block_size' bytes is compressed into an independent gzip member or zstd frame by a task of its own,
+	and the compressed blocks are written to the sink in order. A sequence of gzip members or zstd frames is itself a
+	valid gzip or zstd file, so standard tools (gunzip, zcat, zstd -d, ...) read the output as usual. At most 2*threads
+	blocks are in flight; a writer that gets ahead of the compression waits for the oldest block.
+
+	sync() (i.e. flushing the stream) compresses and writes the current, possibly partial block; finish() must be
+	called before the sink is closed.
+*/
+class Parallel_compressing_streambuf : public std::streambuf
+{
+public:
+	Parallel_compressing_streambuf( std::streambuf* sink, const Output_compression& compression, std::size_t block_size=std::size_t(4)<<20 )
+	: m_sink(sink), m_compression(compression),
+	  m_max_in_flight( 2*std::max( compression.threads > 0 ? compression.threads : std::size_t( std::thread::hardware_concurrency() ), std::size_t(1) ) ),
+	  m_buffer( std::max( block_size, std::size_t(1) ) ), m_n_blocks(0), m_failed(false), m_finished(false)
+	{
+		this->setp( m_buffer.data(), m_buffer.data()+m_buffer.size() );
+	}
+	~Parallel_compressing_streambuf() { this->finish(); }
+
+	//> Write to 'sink' from now on (e.g. after the stream that owns the sink has been moved)
+	void set_sink( std::streambuf* sink ) { m_sink = sink; }
+
+	//> Compress and write everything; returns false if anything could not be written
+	bool finish()
+	{
+		if( !m_finished )
+		{
+			if( m_n_blocks == 0 && this->pptr() == this->pbase() ) { this->submit( true ); } // an empty file is a single empty member/frame
+			this->drain();
+			m_finished = true;
+			this->setp( nullptr, nullptr ); // anything written after this fails
+		}
+		return !m_failed;
+	}
+
+protected:
+	int_type overflow( int_type c ) override
+	{
+		if( m_finished || m_failed ) { return traits_type::eof(); }
+		this->submit();
+		if( !traits_type::eq_int_type( c, traits_type::eof() ) ) { *this->pptr() = traits_type::to_char_type( c ); this->pbump(1); }
+		return m_failed ? traits_type::eof() : traits_type::not_eof( c );
+	}
+
+	int sync() override
+	{
+		if( m_finished ) { return m_failed ? -1 : 0; }
+		this->drain();
+		return m_failed ? -1 : 0;
+	}
+
+private:
+	std::streambuf* m_sink;
+	const Output_compression m_compression;
+	const std::size_t m_max_in_flight;
+	std::vector<char> m_buffer;
+	std::deque< std::future<std::string> > m_in_flight;
+	std::size_t m_n_blocks;
+	bool m_failed;
+	bool m_finished;
+
+	//> Hand the contents of the buffer to a compression task
+	void submit( bool empty_block=false )
+	{
+		if( this->pptr() == this->pbase() && !empty_block ) { return; }
+		if( m_in_flight.size() == m_max_in_flight ) { this->write_oldest(); }
+
+		std::string block( this->pbase(), this->pptr() );
+		const auto compression = m_compression;
+		m_in_flight.push_back( std::async( std::launch::async, [compression]( const std::string& data ) { return compress( data, compression ); }, std::move(block) ) );
+		++m_n_blocks;
+		this->setp( m_buffer.data(), m_buffer.data()+m_buffer.size() );
+	}
+
+	void drain()
+	{
+		this->submit();
+		while( !m_in_flight.empty() ) { this->write_oldest(); }
+		if( m_sink->pubsync() != 0 ) { m_failed = true; }
+	}
+
+	void write_oldest()
+	{
+		try
+		{
+			const auto compressed = m_in_flight.front().get();
+			if( m_sink->sputn( compressed.data(), compressed.size() ) != std::streamsize( compressed.size() ) ) { m_failed = true; }
+		}
+		catch( ... ) { m_failed = true; }
+		m_in_flight.pop_front();
+	}
+
+	static std::string compress( const std::string& data, const Output_compression& compression )
+	{
+		namespace io = boost::iostreams;
+		std::string compressed;
+		{
+			io::filtering_ostream compressor;
+#ifdef SUPERDCA_HAVE_ZSTD
+			if( compression.method == Output_compression::ZSTD )
+			{
+				compressor.push( io::zstd_compressor( io::zstd_params( compression.level > 0 ? uint32_t(compression.level) : uint32_t(io::zstd::default_compression) ) ) );
+			}
+			else
+#endif
+			{
+				compressor.push( io::gzip_compressor( io::gzip_params( compression.level > 0 ? std::min( compression.level, 9 ) : int(io::gzip::default_compression) ) ) );
+			}
+			compressor.push( io::back_inserter( compressed ) );
+			compressor.write( data.data(), data.size() );
+		} // flushes the compressor
+		return compressed;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COMPRESSED_OUTPUT_HPP
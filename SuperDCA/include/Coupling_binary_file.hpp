@@ -0,0 +1,291 @@
+/** @file Coupling_binary_file.hpp
+	Compact binary coupling output (.scb): coupling scores and locus pairs in (optionally compressed) blocks.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_BINARY_FILE_HPP
+#define SUPERDCA_COUPLING_BINARY_FILE_HPP
+
+#include <cstdint>
+#include <cstring> // for std::memcpy, std::memcmp, std::memset
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+
+#include "boost/iostreams/device/mapped_file.hpp"
+#include "boost/iostreams/device/array.hpp"
+#include "boost/iostreams/device/back_inserter.hpp"
+#include "boost/iostreams/filtering_stream.hpp"
+#include "boost/iostreams/filter/zlib.hpp"
+#include "boost/iostreams/copy.hpp"
+
+namespace superdca {
+
+/** Layout of a binary coupling file (all values in host byte order):
+
+	header:    Coupling_binary_header
+	id string: header.id_length bytes (alignment id), zero-padded to a multiple of 8 bytes
+	loci:      header.n_loci1 x uint64 (zero-based original index of every locus of the first alignment)
+	loci2:     header.n_loci2 x uint64 (the same for the second alignment of an inter-alignment scan)
+	blocks:    any number of { Coupling_binary_block; payload: block.stored_bytes bytes, zero-padded to a multiple of 8 bytes },
+	           terminated by a block of zero records
+
+	The payload of a block is block.n_records records of header.record_size() bytes, zlib-compressed if block.flags & ZLIB.
+	A record is { float score; uint32 i; uint32 j }, where i and j are zero-based loci of the first and second alignment
+	(of the only alignment in single-alignment runs); their original indices are loci[i] and loci2[j] (loci[j] if
+	header.n_loci2 == 0), to which header.base_index is added for output. In norm-of-mean runs (header.flags & NORM_OF_MEAN)
+	each record is followed by { float Jij; float Jji }, the norms of both matrices of the pair.
+
+	Records appear in the order the text output would list them. A file without the terminating block is incomplete.
+*/
+struct Coupling_binary_header
+{
+	enum : uint32_t { VERSION=1 };
+	enum : uint32_t { SYMMETRIC=1, NORM_OF_MEAN=2, BEST_FIRST=4 };
+
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t base_index; // output indexing base
+	uint32_t id_length;
+	uint64_t n_loci1;
+	uint64_t n_loci2;
+
+	static const char* s_magic() { return "SDCASCB1"; }
+
+	Coupling_binary_header() { std::memset( this, 0, sizeof(*this) ); std::memcpy( magic, s_magic(), sizeof(magic) ); version = VERSION; }
+
+	bool valid() const { return 0 == std::memcmp( magic, s_magic(), sizeof(magic) ) && version == VERSION; }
+	bool symmetric() const { return flags & SYMMETRIC; }
+	bool norm_of_mean() const { return flags & NORM_OF_MEAN; }
+	bool best_first() const { return flags & BEST_FIRST; }
+
+	std::size_t padded_id_length() const { return (id_length+7) & ~std::size_t(7); }
+	std::size_t record_size() const { return this->norm_of_mean() ? 5*sizeof(uint32_t) : 3*sizeof(uint32_t); }
+	std::size_t blocks_offset() const { return sizeof(Coupling_binary_header) + padded_id_length() + (n_loci1+n_loci2)*sizeof(uint64_t); }
+};
+
+struct Coupling_binary_block
+{
+	enum : uint32_t { ZLIB=1 };
+
+	uint32_t n_records;
+	uint32_t flags;
+	uint64_t stored_bytes; // payload bytes in the file, without padding
+};
+
+//> A coupling of a binary coupling file; 'ij' and 'ji' are set in norm-of-mean files only
+struct Coupling_record
+{
+	float score;
+	uint32_t i, j;
+	float ij, ji;
+};
+static_assert( sizeof(Coupling_record) == 5*sizeof(uint32_t), "Coupling_record must match the on-disk record layout" );
+
+/** Writes couplings to a binary coupling file, one block of up to 'block_size' records at a time. */
+class Coupling_binary_writer
+{
+public:
+	/**
+		@param loci1 Original indices of the loci of the first alignment.
+		@param loci2 Original indices of the loci of the second alignment of a scan; empty in single-alignment runs.
+	*/
+	Coupling_binary_writer( std::ostream* out, uint32_t flags, uint32_t base_index, const std::string& id,
+		const std::vector<uint64_t>& loci1, const std::vector<uint64_t>& loci2, bool compress, std::size_t block_size=1<<16 )
+	: m_out(out), m_compress(compress), m_block_size( block_size > 0 ? block_size : 1 ), m_n_written(0), m_finished(false)
+	{
+		m_header.flags = flags;
+		m_header.base_index = base_index;
+		m_header.id_length = id.size();
+		m_header.n_loci1 = loci1.size();
+		m_header.n_loci2 = loci2.size();
+		m_out->write( reinterpret_cast<const char*>(&m_header), sizeof(m_header) );
+		m_out->write( id.data(), id.size() );
+		const char padding[8] = { 0 };
+		m_out->write( padding, m_header.padded_id_length()-id.size() );
+		m_out->write( reinterpret_cast<const char*>(loci1.data()), loci1.size()*sizeof(uint64_t) );
+		m_out->write( reinterpret_cast<const char*>(loci2.data()), loci2.size()*sizeof(uint64_t) );
+		m_block.reserve( m_block_size*m_header.record_size() );
+	}
+	~Coupling_binary_writer() { this->finish(); }
+
+	inline void add( float score, std::size_t i, std::size_t j )
+	{
+		const uint32_t record[3] = { this->bits( score ), uint32_t(i), uint32_t(j) };
+		this->append( record, sizeof(record) );
+	}
+
+	inline void add( float score, std::size_t i, std::size_t j, float ij, float ji )
+	{
+		const uint32_t record[5] = { this->bits( score ), uint32_t(i), uint32_t(j), this->bits( ij ), this->bits( ji ) };
+		this->append( record, sizeof(record) );
+	}
+
+	//> Write the last block and the terminating block
+	void finish()
+	{
+		if( m_finished ) { return; }
+		m_finished = true;
+		this->write_block();
+		const Coupling_binary_block end{ 0, 0, 0 };
+		m_out->write( reinterpret_cast<const char*>(&end), sizeof(end) );
+		m_out->flush();
+	}
+
+	std::size_t records_written() const { return m_n_written; }
+	bool good() const { return m_out->good(); }
+
+private:
+	std::ostream* m_out;
+	Coupling_binary_header m_header;
+	const bool m_compress;
+	const std::size_t m_block_size;
+	std::vector<char> m_block;
+	std::string m_compressed;
+	std::size_t m_n_written;
+	bool m_finished;
+
+	static inline uint32_t bits( float value ) { uint32_t x; std::memcpy( &x, &value, sizeof(x) ); return x; }
+
+	inline void append( const uint32_t* record, std::size_t bytes )
+	{
+		const char* data = reinterpret_cast<const char*>( record );
+		m_block.insert( m_block.end(), data, data+bytes );
+		++m_n_written;
+		if( m_block.size() >= m_block_size*m_header.record_size() ) { this->write_block(); }
+	}
+
+	void write_block()
+	{
+		if( m_block.empty() ) { return; }
+
+		Coupling_binary_block block{ uint32_t( m_block.size()/m_header.record_size() ), 0, m_block.size() };
+		const char* payload = m_block.data();
+		if( m_compress )
+		{
+			namespace io = boost::iostreams;
+			m_compressed.clear();
+			{
+				io::filtering_ostream compressor;
+				compressor.push( io::zlib_compressor() );
+				compressor.push( io::back_inserter( m_compressed ) );
+				compressor.write( m_block.data(), m_block.size() );
+			} // flushes the compressor
+			block.flags = Coupling_binary_block::ZLIB;
+			block.stored_bytes = m_compressed.size();
+			payload = m_compressed.data();
+		}
+
+		const char padding[8] = { 0 };
+		m_out->write( reinterpret_cast<const char*>(&block), sizeof(block) );
+		m_out->write( payload, block.stored_bytes );
+		m_out->write( padding, ( 8 - block.stored_bytes % 8 ) % 8 );
+		m_block.clear();
+	}
+};
+
+/** Read-only, memory-mapped access to a binary coupling file. */
+class Coupling_binary_reader
+{
+public:
+	Coupling_binary_reader( const std::string& filename )
+	: m_filename( filename ), m_file( filename )
+	{
+		if( m_file.size() < sizeof(Coupling_binary_header) ) { throw std::runtime_error( "\""+filename+"\" is not a SuperDCA binary coupling file" ); }
+		std::memcpy( &m_header, m_file.data(), sizeof(m_header) );
+		if( !m_header.valid() ) { throw std::runtime_error( "\""+filename+"\" is not a SuperDCA binary coupling file (or has an unsupported version)" ); }
+		if( m_file.size() < m_header.blocks_offset() ) { throw std::runtime_error( "binary coupling file \""+filename+"\" is truncated" ); }
+
+		const std::size_t lists_begin = sizeof(m_header) + m_header.padded_id_length();
+		m_id.assign( m_file.data()+sizeof(m_header), m_header.id_length );
+		m_loci1 = read_list( lists_begin, m_header.n_loci1 );
+		m_loci2 = m_header.n_loci2 > 0 ? read_list( lists_begin+m_header.n_loci1*sizeof(uint64_t), m_header.n_loci2 ) : m_loci1;
+	}
+
+	const Coupling_binary_header& header() const { return m_header; }
+	const std::string& id() const { return m_id; }
+	//> Original indices of the loci of records' i and j
+	const std::vector<uint64_t>& loci1() const { return m_loci1; }
+	const std::vector<uint64_t>& loci2() const { return m_loci2; }
+
+	/** Call visit( const Coupling_record& ) for each record, in file order.
+
+		@throw std::runtime_error if the file is truncated or corrupt.
+	*/
+	template< typename VisitorT >
+	void for_each( VisitorT&& visit ) const
+	{
+		namespace io = boost::iostreams;
+		const std::size_t record_size = m_header.record_size();
+		std::size_t offset = m_header.blocks_offset();
+		std::string decompressed;
+
+		while( true )
+		{
+			Coupling_binary_block block;
+			if( offset+sizeof(block) > m_file.size() ) { throw std::runtime_error( "binary coupling file \""+m_filename+"\" is incomplete" ); }
+			std::memcpy( &block, m_file.data()+offset, sizeof(block) );
+			offset += sizeof(block);
+			if( block.n_records == 0 ) { return; }
+			if( offset+block.stored_bytes > m_file.size() ) { throw std::runtime_error( "binary coupling file \""+m_filename+"\" is incomplete" ); }
+
+			const char* payload = m_file.data()+offset;
+			if( block.flags & Coupling_binary_block::ZLIB )
+			{
+				decompressed.clear();
+				io::filtering_istream decompressor;
+				decompressor.push( io::zlib_decompressor() );
+				decompressor.push( io::array_source( payload, block.stored_bytes ) );
+				io::copy( decompressor, io::back_inserter( decompressed ) );
+				payload = decompressed.data();
+				if( decompressed.size() != block.n_records*record_size ) { throw std::runtime_error( "binary coupling file \""+m_filename+"\" is corrupt" ); }
+			}
+			else if( block.stored_bytes != block.n_records*record_size ) { throw std::runtime_error( "binary coupling file \""+m_filename+"\" is corrupt" ); }
+
+			for( std::size_t k=0; k < block.n_records; ++k )
+			{
+				Coupling_record record{ 0.0f, 0, 0, 0.0f, 0.0f };
+				std::memcpy( &record, payload+k*record_size, record_size ); // the stored fields are a prefix of Coupling_record
+				visit( static_cast<const Coupling_record&>( record ) );
+			}
+			offset += ( block.stored_bytes+7 ) & ~uint64_t(7);
+		}
+	}
+
+private:
+	std::string m_filename;
+	boost::iostreams::mapped_file_source m_file;
+	Coupling_binary_header m_header;
+	std::string m_id;
+	std::vector<uint64_t> m_loci1;
+	std::vector<uint64_t> m_loci2;
+
+	std::vector<uint64_t> read_list( std::size_t offset, std::size_t n ) const
+	{
+		std::vector<uint64_t> list( n );
+		std::memcpy( list.data(), m_file.data()+offset, n*sizeof(uint64_t) );
+		return list;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_BINARY_FILE_HPP
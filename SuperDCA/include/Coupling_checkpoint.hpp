@@ -0,0 +1,297 @@
+/** @file Coupling_checkpoint.hpp
+	Memory-mapped checkpoint of completed coupling score rows, for resuming interrupted SuperDCA runs.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_CHECKPOINT_HPP
+#define SUPERDCA_COUPLING_CHECKPOINT_HPP
+
+#include <cstdint>
+#include <cstring> // for std::memcpy, std::memcmp, std::memset
+#include <csignal>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm> // for std::copy, std::max
+#include <stdexcept>
+
+#if defined(__unix__)
+#include <sys/mman.h> // for msync
+#endif
+
+#include "boost/iostreams/device/mapped_file.hpp"
+#include "boost/filesystem/operations.hpp" // includes boost/filesystem/path.hpp
+
+namespace superdca {
+
+/** Layout of a checkpoint file (all values in host byte order):
+
+	header:    Coupling_checkpoint_header
+	id string: header.id_length bytes (alignment id), zero-padded to a multiple of 8 bytes
+	rows:      header.n_rows x uint64 (zero-based original index of every row locus of the run)
+	columns:   header.n_cols x uint64 (zero-based original index of every column locus of the run)
+	weights:   header.n_weights x double (sequence weights; valid if header.flags & WEIGHTS)
+	done:      header.n_rows x uint8 (1 if the row is complete), zero-padded to a multiple of 8 bytes
+	stats:     header.n_rows x { double fval; uint64 nfeval } (optimizer statistics of each row)
+	scores:    header.n_rows x header.n_cols x float
+
+	Rows are written in place, directly into the mapping, by the thread that solved the locus.
+	The done flag of a row is set only after its scores and statistics, so a row that was being
+	written when the process died is simply solved again when the run is resumed.
+*/
+struct Coupling_checkpoint_header
+{
+	enum : uint32_t { VERSION=1 };
+	enum : uint32_t { WEIGHTS=1 };
+
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t id_length;
+	uint32_t reserved;
+	uint64_t n_rows;
+	uint64_t n_cols;
+	uint64_t n_weights;
+
+	static const char* s_magic() { return "SDCACKP1"; }
+
+	Coupling_checkpoint_header() { std::memset( this, 0, sizeof(*this) ); std::memcpy( magic, s_magic(), sizeof(magic) ); version = VERSION; }
+
+	bool valid() const { return 0 == std::memcmp( magic, s_magic(), sizeof(magic) ) && version == VERSION; }
+
+	std::size_t padded_id_length() const { return (id_length+7) & ~std::size_t(7); }
+	std::size_t padded_done_length() const { return (n_rows+7) & ~std::size_t(7); }
+
+	std::size_t rows_offset() const { return sizeof(Coupling_checkpoint_header) + padded_id_length(); }
+	std::size_t cols_offset() const { return rows_offset() + n_rows*sizeof(uint64_t); }
+	std::size_t weights_offset() const { return cols_offset() + n_cols*sizeof(uint64_t); }
+	std::size_t done_offset() const { return weights_offset() + n_weights*sizeof(double); }
+	std::size_t stats_offset() const { return done_offset() + padded_done_length(); }
+	std::size_t scores_offset() const { return stats_offset() + n_rows*2*sizeof(uint64_t); }
+	std::size_t file_size() const { return scores_offset() + n_rows*n_cols*sizeof(float); }
+};
+
+/** A checkpoint of the coupling score rows of a run.
+
+	The checkpoint is identified by the alignment id and the original indices of the row and column loci
+	of the run; resuming from a checkpoint of a different run is refused.
+*/
+class Coupling_checkpoint
+{
+public:
+	/** Create a new checkpoint file, or open an existing one if 'resume' is true. An existing checkpoint file is
+		never overwritten: without 'resume', it may hold the only copy of the rows of an interrupted run.
+
+		@param rows The (zero-based) column indices of the row loci in the input alignment.
+		@param cols The (zero-based) column indices of the column loci in the input alignment.
+		@param row_ids The original indices of 'rows'; used for identifying the run.
+		@param col_ids The original indices of 'cols'; used for identifying the run.
+	*/
+	Coupling_checkpoint( const std::string& filename, const std::string& id,
+		const std::vector<std::size_t>& rows, const std::vector<std::size_t>& cols,
+		const std::vector<uint64_t>& row_ids, const std::vector<uint64_t>& col_ids,
+		std::size_t n_weights, bool resume )
+	: m_filename( filename ), m_cols( cols ), m_n_done(0), m_resumed(false)
+	{
+		Coupling_checkpoint_header header;
+		header.id_length = id.size();
+		header.n_rows = rows.size();
+		header.n_cols = cols.size();
+		header.n_weights = n_weights;
+
+		boost::iostreams::mapped_file_params params( filename );
+		params.flags = boost::iostreams::mapped_file::readwrite;
+
+		if( resume && boost::filesystem::exists( filename ) )
+		{
+			m_file.open( params );
+			if( m_file.size() < sizeof(Coupling_checkpoint_header) ) { throw std::runtime_error( "\""+filename+"\" is not a SuperDCA checkpoint file" ); }
+			std::memcpy( &m_header, m_file.const_data(), sizeof(m_header) );
+			if( !m_header.valid() ) { throw std::runtime_error( "\""+filename+"\" is not a SuperDCA checkpoint file (or has an unsupported version)" ); }
+			if( m_file.size() != m_header.file_size() ) { throw std::runtime_error( "checkpoint file \""+filename+"\" is truncated" ); }
+			if( m_header.id_length != header.id_length || m_header.n_rows != header.n_rows || m_header.n_cols != header.n_cols || m_header.n_weights != header.n_weights
+				|| 0 != std::memcmp( m_file.const_data()+sizeof(m_header), id.data(), id.size() )
+				|| 0 != std::memcmp( m_file.const_data()+m_header.rows_offset(), row_ids.data(), row_ids.size()*sizeof(uint64_t) )
+				|| 0 != std::memcmp( m_file.const_data()+m_header.cols_offset(), col_ids.data(), col_ids.size()*sizeof(uint64_t) ) )
+			{
+				throw std::runtime_error( "checkpoint file \""+filename+"\" belongs to a different run" );
+			}
+			m_resumed = true;
+		}
+		else
+		{
+			if( boost::filesystem::exists( filename ) )
+			{
+				throw std::runtime_error( "checkpoint file \""+filename+"\" exists; use --resume to continue the run, or remove the file to start over" );
+			}
+			params.new_file_size = header.file_size(); // creates or truncates the file; new space reads as zeros
+			m_file.open( params );
+			m_header = header;
+			std::memcpy( m_file.data(), &m_header, sizeof(m_header) );
+			std::memcpy( m_file.data()+sizeof(m_header), id.data(), id.size() );
+			std::memcpy( m_file.data()+m_header.rows_offset(), row_ids.data(), row_ids.size()*sizeof(uint64_t) );
+			std::memcpy( m_file.data()+m_header.cols_offset(), col_ids.data(), col_ids.size()*sizeof(uint64_t) );
+			std::memset( m_file.data()+m_header.done_offset(), 0, m_header.padded_done_length() );
+		}
+
+		std::size_t max_locus = 0;
+		for( const auto r: rows ) { max_locus = std::max( max_locus, r+1 ); }
+		m_row_position.assign( max_locus, NOT_A_ROW );
+		for( std::size_t pos=0; pos < rows.size(); ++pos ) { m_row_position[ rows[pos] ] = pos; }
+
+		for( std::size_t pos=0; pos < rows.size(); ++pos ) { if( this->done( pos ) ) { ++m_n_done; } }
+	}
+	~Coupling_checkpoint() { this->flush(); }
+
+	const std::string& filename() const { return m_filename; }
+	bool resumed() const { return m_resumed; }
+
+	std::size_t size() const { return m_header.n_rows; }
+	std::size_t n_done() const { return m_n_done.load(); }
+
+	bool is_done( std::size_t locus ) const { const auto pos = this->position( locus ); return pos != NOT_A_ROW && this->done( pos ); }
+
+	bool has_weights() const { return m_header.flags & Coupling_checkpoint_header::WEIGHTS; }
+
+	template< typename RealT >
+	std::vector<RealT> get_weights() const
+	{
+		const double* stored = reinterpret_cast<const double*>( m_file.const_data()+m_header.weights_offset() );
+		return std::vector<RealT>( stored, stored+m_header.n_weights );
+	}
+
+	template< typename RealT >
+	void set_weights( const std::vector<RealT>& weights )
+	{
+		if( weights.size() != m_header.n_weights ) { return; }
+		double* stored = reinterpret_cast<double*>( m_file.data()+m_header.weights_offset() );
+		std::copy( weights.begin(), weights.end(), stored );
+		m_header.flags |= Coupling_checkpoint_header::WEIGHTS;
+		std::memcpy( m_file.data(), &m_header, sizeof(m_header) );
+	}
+
+	//> Store the scores of row 'locus'; 'scores' must contain one value for each column locus. Different rows may be stored concurrently.
+	void store_row( std::size_t locus, double fval, std::size_t nfeval, const float* scores )
+	{
+		const auto pos = this->position( locus );
+		if( pos == NOT_A_ROW ) { return; }
+		std::memcpy( this->scores( pos ), scores, m_cols.size()*sizeof(float) );
+		this->mark_done( pos, fval, nfeval );
+	}
+
+	/** Copy all completed rows into 'storage' and their optimizer statistics into 'log'.
+
+		@return The number of restored rows.
+	*/
+	template< typename StorageT, typename HistoryT >
+	std::size_t restore( StorageT& storage, HistoryT& log ) const
+	{
+		std::size_t n_restored = 0;
+		for( std::size_t locus=0; locus < m_row_position.size(); ++locus )
+		{
+			const auto pos = m_row_position[locus];
+			if( pos == NOT_A_ROW || !this->done( pos ) ) { continue; }
+
+			const float* scores = reinterpret_cast<const float*>( m_file.const_data()+m_header.scores_offset() ) + pos*m_header.n_cols;
+			storage.store_row( locus, scores );
+
+			double fval; uint64_t nfeval;
+			std::memcpy( &fval, this->stats( pos ), sizeof(double) );
+			std::memcpy( &nfeval, this->stats( pos )+sizeof(double), sizeof(uint64_t) );
+			log.fval_history[locus] = fval;
+			log.nfeval_history[locus] = nfeval;
+			++n_restored;
+		}
+		return n_restored;
+	}
+
+	//> Write all completed rows to disk. Rows are visible in the file as soon as they are stored, so this only matters if the whole machine goes down.
+	void flush()
+	{
+	#if defined(__unix__)
+		if( m_file.is_open() ) { msync( m_file.data(), m_file.size(), MS_SYNC ); }
+	#endif
+	}
+
+	//> Remove the checkpoint file, e.g. once the final output has been written.
+	void remove()
+	{
+		m_file.close();
+		boost::system::error_code ec;
+		boost::filesystem::remove( m_filename, ec );
+	}
+
+private:
+	enum : std::size_t { NOT_A_ROW = std::size_t(-1) };
+
+	std::string m_filename;
+	boost::iostreams::mapped_file m_file;
+	Coupling_checkpoint_header m_header;
+	std::vector<std::size_t> m_cols;
+	std::vector<std::size_t> m_row_position;
+	std::atomic<std::size_t> m_n_done;
+	bool m_resumed;
+
+	std::size_t position( std::size_t locus ) const { return locus < m_row_position.size() ? m_row_position[locus] : NOT_A_ROW; }
+
+	bool done( std::size_t pos ) const { return 0 != *reinterpret_cast<const volatile char*>( m_file.const_data()+m_header.done_offset()+pos ); }
+
+	float* scores( std::size_t pos ) { return reinterpret_cast<float*>( m_file.data()+m_header.scores_offset() ) + pos*m_header.n_cols; }
+	char* stats( std::size_t pos ) { return m_file.data()+m_header.stats_offset() + pos*2*sizeof(uint64_t); }
+	const char* stats( std::size_t pos ) const { return m_file.const_data()+m_header.stats_offset() + pos*2*sizeof(uint64_t); }
+
+	void mark_done( std::size_t pos, double fval, uint64_t nfeval )
+	{
+		std::memcpy( this->stats( pos ), &fval, sizeof(double) );
+		std::memcpy( this->stats( pos )+sizeof(double), &nfeval, sizeof(uint64_t) );
+		std::atomic_thread_fence( std::memory_order_release ); // the row must be complete before it is flagged as done
+		if( !this->done( pos ) ) { ++m_n_done; }
+		*reinterpret_cast<volatile char*>( m_file.data()+m_header.done_offset()+pos ) = 1;
+	}
+};
+
+/** Graceful interruption of a run on SIGTERM and SIGINT.
+
+	The signal handler only records the signal; workers stop taking new loci once a signal has been
+	received, and the run flushes its checkpoint and exits. A second signal terminates the process immediately.
+*/
+namespace interrupt {
+
+inline std::atomic<int>& signal_number() { static std::atomic<int> signum(0); return signum; }
+
+inline void handle_signal( int signum )
+{
+	signal_number().store( signum );
+	std::signal( signum, SIG_DFL );
+}
+
+inline void install_handlers()
+{
+	signal_number(); // initialize before any signal can arrive
+	std::signal( SIGTERM, handle_signal );
+	std::signal( SIGINT, handle_signal );
+}
+
+inline bool requested() { return signal_number().load() != 0; }
+
+} // namespace interrupt
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_CHECKPOINT_HPP
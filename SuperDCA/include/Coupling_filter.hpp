@@ -0,0 +1,81 @@
+/** @file Coupling_filter.hpp
+	Write-time filtering of couplings by score and by the distance of the coupled loci.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_FILTER_HPP
+#define SUPERDCA_COUPLING_FILTER_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace superdca {
+
+/** Decides which couplings are written: those that score at least 'min_coupling' and whose loci lie at least
+	'min_distance' and at most 'max_distance' columns apart in the input alignment, as given by the original indices
+	of the loci (i.e. the loci translation of the alignment). Couplings are tested as they are handed to the writer,
+	such that dropped couplings are never formatted nor sorted.
+*/
+class Coupling_filter
+{
+public:
+	/**
+		@param max_distance The largest distance of coupled loci (0 = no limit).
+		@param loci1 Original indices of the loci of the first alignment.
+		@param loci2 Original indices of the loci of the second alignment of a scan; empty in single-alignment runs.
+	*/
+	Coupling_filter( double min_coupling, uint64_t min_distance, uint64_t max_distance, const std::vector<uint64_t>& loci1, const std::vector<uint64_t>& loci2 )
+	: m_min_coupling(min_coupling), m_min_distance(min_distance), m_max_distance( max_distance > 0 ? max_distance : UINT64_MAX ),
+	  m_filter_distance( min_distance > 0 || max_distance > 0 ),
+	  m_loci1( m_filter_distance ? loci1 : std::vector<uint64_t>() ), m_loci2( m_filter_distance ? ( loci2.empty() ? loci1 : loci2 ) : std::vector<uint64_t>() ),
+	  m_n_tested(0), m_n_kept(0)
+	{ }
+
+	//> Whether the coupling of loci i and j (of the first and second alignment) with 'score' is written
+	inline bool keep( double score, std::size_t i, std::size_t j )
+	{
+		++m_n_tested;
+		if( score < m_min_coupling ) { return false; }
+		if( m_filter_distance )
+		{
+			const uint64_t a = m_loci1[i], b = m_loci2[j];
+			const uint64_t distance = a > b ? a-b : b-a;
+			if( distance < m_min_distance || distance > m_max_distance ) { return false; }
+		}
+		++m_n_kept;
+		return true;
+	}
+
+	std::size_t n_tested() const { return m_n_tested; }
+	std::size_t n_kept() const { return m_n_kept; }
+
+private:
+	const double m_min_coupling;
+	const uint64_t m_min_distance;
+	const uint64_t m_max_distance;
+	const bool m_filter_distance;
+	const std::vector<uint64_t> m_loci1;
+	const std::vector<uint64_t> m_loci2;
+	std::size_t m_n_tested;
+	std::size_t m_n_kept;
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_FILTER_HPP
@@ -0,0 +1,167 @@
+/** @file Coupling_partial_file.hpp
+	Binary storage of coupling score rows computed by one shard of a sharded SuperDCA run.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_PARTIAL_FILE_HPP
+#define SUPERDCA_COUPLING_PARTIAL_FILE_HPP
+
+#include <cstdint>
+#include <cstring> // for std::memcpy, std::memcmp
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+
+#include "boost/iostreams/device/mapped_file.hpp"
+
+namespace superdca {
+
+/** Layout of a partial coupling file (all values in host byte order):
+
+	header:    Coupling_partial_header
+	id string: header.id_length bytes (alignment id, used to name the merged output), zero-padded to a multiple of 8 bytes
+	rows:      header.n_rows x uint64 (zero-based original index of every row in the run, in output order)
+	columns:   header.n_cols x uint64 (zero-based original index of every column, in output order)
+	records:   header.n_shard_rows x { uint64 row position in the row list; float scores[header.n_cols] }
+
+	A record holds the scores J(r,n) of a single target locus r against all column loci n.
+	In a symmetric run the row and column lists are identical and each pair is
+	symmetrized as (J(r,n)+J(n,r))/2 when the shards are merged.
+*/
+struct Coupling_partial_header
+{
+	enum : uint32_t { VERSION=1 };
+	enum : uint32_t { SYMMETRIC=1 };
+
+	char magic[8];
+	uint32_t version;
+	uint32_t shard; // zero-based
+	uint32_t n_shards;
+	uint32_t flags;
+	uint32_t base_index; // output indexing base
+	uint32_t id_length;
+	uint64_t n_rows;
+	uint64_t n_cols;
+	uint64_t n_shard_rows;
+
+	static const char* s_magic() { return "SDCAPRT1"; }
+
+	Coupling_partial_header() { std::memset( this, 0, sizeof(*this) ); std::memcpy( magic, s_magic(), sizeof(magic) ); version = VERSION; }
+
+	bool valid() const { return 0 == std::memcmp( magic, s_magic(), sizeof(magic) ) && version == VERSION; }
+	bool symmetric() const { return flags & SYMMETRIC; }
+
+	std::size_t padded_id_length() const { return (id_length+7) & ~std::size_t(7); }
+	std::size_t record_size() const { return sizeof(uint64_t) + n_cols*sizeof(float); }
+};
+
+/** Writes the rows of one shard to a partial coupling file. */
+class Coupling_partial_writer
+{
+public:
+	Coupling_partial_writer( std::ostream* out, const Coupling_partial_header& header, const std::string& id,
+		const std::vector<uint64_t>& rows, const std::vector<uint64_t>& cols )
+	: m_out(out), m_header(header), m_written(0)
+	{
+		m_header.id_length = id.size();
+		m_header.n_rows = rows.size();
+		m_header.n_cols = cols.size();
+		m_out->write( reinterpret_cast<const char*>(&m_header), sizeof(m_header) );
+		m_out->write( id.data(), id.size() );
+		const char padding[8] = { 0 };
+		m_out->write( padding, m_header.padded_id_length()-id.size() );
+		m_out->write( reinterpret_cast<const char*>(rows.data()), rows.size()*sizeof(uint64_t) );
+		m_out->write( reinterpret_cast<const char*>(cols.data()), cols.size()*sizeof(uint64_t) );
+	}
+	~Coupling_partial_writer() { }
+
+	//> Write a record; 'scores' must contain header.n_cols values.
+	void write_row( uint64_t row_position, const float* scores )
+	{
+		m_out->write( reinterpret_cast<const char*>(&row_position), sizeof(uint64_t) );
+		m_out->write( reinterpret_cast<const char*>(scores), m_header.n_cols*sizeof(float) );
+		++m_written;
+	}
+
+	bool good() const { return m_out->good() && m_written == m_header.n_shard_rows; }
+
+private:
+	std::ostream* m_out;
+	Coupling_partial_header m_header;
+	std::size_t m_written;
+};
+
+/** Read-only, memory-mapped access to a partial coupling file. */
+class Coupling_partial_reader
+{
+public:
+	Coupling_partial_reader( const std::string& filename )
+	: m_file( filename )
+	{
+		if( m_file.size() < sizeof(Coupling_partial_header) ) { throw std::runtime_error( "\""+filename+"\" is not a SuperDCA partial coupling file" ); }
+		std::memcpy( &m_header, m_file.data(), sizeof(m_header) );
+		if( !m_header.valid() ) { throw std::runtime_error( "\""+filename+"\" is not a SuperDCA partial coupling file (or has an unsupported version)" ); }
+		if( m_header.shard >= m_header.n_shards ) { throw std::runtime_error( "partial coupling file \""+filename+"\" has an invalid shard number" ); }
+
+		const std::size_t lists_begin = sizeof(m_header) + m_header.padded_id_length();
+		m_records_begin = lists_begin + ( m_header.n_rows + m_header.n_cols )*sizeof(uint64_t);
+		if( m_file.size() != m_records_begin + m_header.n_shard_rows*m_header.record_size() ) { throw std::runtime_error( "partial coupling file \""+filename+"\" is truncated" ); }
+
+		m_id.assign( m_file.data()+sizeof(m_header), m_header.id_length );
+		m_rows = read_list( lists_begin, m_header.n_rows );
+		m_cols = read_list( lists_begin+m_header.n_rows*sizeof(uint64_t), m_header.n_cols );
+	}
+	~Coupling_partial_reader() { }
+
+	const Coupling_partial_header& header() const { return m_header; }
+	const std::string& id() const { return m_id; }
+	const std::vector<uint64_t>& rows() const { return m_rows; }
+	const std::vector<uint64_t>& cols() const { return m_cols; }
+
+	std::size_t size() const { return m_header.n_shard_rows; }
+
+	uint64_t row_position( std::size_t record ) const
+	{
+		uint64_t position; std::memcpy( &position, this->record(record), sizeof(uint64_t) );
+		return position;
+	}
+	const float* scores( std::size_t record ) const { return reinterpret_cast<const float*>( this->record(record)+sizeof(uint64_t) ); }
+
+private:
+	boost::iostreams::mapped_file_source m_file;
+	Coupling_partial_header m_header;
+	std::size_t m_records_begin;
+	std::string m_id;
+	std::vector<uint64_t> m_rows;
+	std::vector<uint64_t> m_cols;
+
+	const char* record( std::size_t record ) const { return m_file.data() + m_records_begin + record*m_header.record_size(); }
+
+	std::vector<uint64_t> read_list( std::size_t offset, std::size_t n ) const
+	{
+		std::vector<uint64_t> list( n );
+		std::memcpy( list.data(), m_file.data()+offset, n*sizeof(uint64_t) );
+		return list;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_PARTIAL_FILE_HPP
@@ -0,0 +1,143 @@
+/** @file Coupling_pool.hpp
+	Memory of the coupling storage pool: in memory, or in a memory-mapped scratch file.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_POOL_HPP
+#define SUPERDCA_COUPLING_POOL_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm> // for std::min, std::max
+
+#if defined(__unix__)
+#include <unistd.h> // for sysconf
+#include <sys/mman.h> // for madvise
+#endif
+
+#include "boost/iostreams/device/mapped_file.hpp"
+#include "boost/filesystem/operations.hpp" // includes boost/filesystem/path.hpp
+
+#include "apegrunt/aligned_allocator.hpp"
+
+namespace superdca {
+
+/** A zero-initialized block of memory that holds the coupling storage pool.
+
+	In-memory pools are allocated on the heap. Out-of-core pools live in a scratch file that is mapped into memory;
+	the file is unlinked as soon as it is mapped, so it disappears with the process no matter how the run ends.
+	Finished ranges are handed back to the kernel with release(), which pushes them out to the file and drops them
+	from the resident set, such that only the ranges that are being written (or read) occupy memory.
+*/
+class Coupling_pool
+{
+public:
+	Coupling_pool() : m_size(0) { }
+	~Coupling_pool() { if( m_file.is_open() ) { m_file.close(); } }
+
+	Coupling_pool( const Coupling_pool& ) = delete;
+	Coupling_pool& operator=( const Coupling_pool& ) = delete;
+
+	//> Allocate 'bytes' of zero-initialized memory
+	void allocate( std::size_t bytes )
+	{
+		m_memory.assign( bytes, 0 );
+		m_size = bytes;
+	}
+
+	//> Create a sparse (zero-filled) scratch file of 'bytes' and map it into memory
+	void map_file( const std::string& filename, std::size_t bytes )
+	{
+		boost::iostreams::mapped_file_params params( filename );
+		params.flags = boost::iostreams::mapped_file::readwrite;
+		params.new_file_size = std::max( bytes, std::size_t(1) ); // an empty mapping is an error
+		m_file.open( params );
+		boost::system::error_code ec;
+		boost::filesystem::remove( filename, ec ); // the mapping stays valid until it is closed
+		m_filename = filename;
+		m_size = bytes;
+	}
+
+	inline char* data() { return m_file.is_open() ? m_file.data() : m_memory.data(); }
+	inline const char* data() const { return m_file.is_open() ? m_file.const_data() : m_memory.data(); }
+	inline std::size_t size() const { return m_size; }
+
+	inline bool is_mapped() const { return m_file.is_open(); }
+	inline const std::string& filename() const { return m_filename; }
+
+	//> The granularity of release() and prefetch(); out-of-core pools lay out their rows in multiples of it
+	static std::size_t page_size()
+	{
+	#if defined(__unix__)
+		static const std::size_t size = sysconf( _SC_PAGE_SIZE ) > 0 ? std::size_t( sysconf( _SC_PAGE_SIZE ) ) : 4096;
+		return size;
+	#else
+		return 4096;
+	#endif
+	}
+
+	//> Write the pages of a finished range back to the file and drop them from memory; a no-op for in-memory pools
+	void release( std::size_t offset, std::size_t length )
+	{
+	#if defined(__unix__)
+		if( !m_file.is_open() ) { return; }
+		char* begin; std::size_t bytes;
+		if( !this->pages( offset, length, false, begin, bytes ) ) { return; }
+	#if defined(MADV_PAGEOUT) // Linux 5.4+: reclaim right away, writing back dirty pages
+		if( madvise( begin, bytes, MADV_PAGEOUT ) == 0 ) { return; }
+	#endif
+		msync( begin, bytes, MS_ASYNC );
+		madvise( begin, bytes, MADV_DONTNEED ); // the data stays in the page cache (or the file) and is faulted back in when read
+	#endif
+	}
+
+	//> Ask the kernel to read a range ahead of use; a no-op for in-memory pools
+	void prefetch( std::size_t offset, std::size_t length ) const
+	{
+	#if defined(__unix__)
+		if( !m_file.is_open() ) { return; }
+		char* begin; std::size_t bytes;
+		if( this->pages( offset, length, true, begin, bytes ) ) { madvise( begin, bytes, MADV_WILLNEED ); }
+	#endif
+	}
+
+private:
+	std::vector< char, apegrunt::memory::AlignedAllocator<char> > m_memory;
+	boost::iostreams::mapped_file m_file;
+	std::string m_filename;
+	std::size_t m_size;
+
+	//> The pages that lie entirely within [offset,offset+length), or if 'touching' is set, all pages that overlap it
+	bool pages( std::size_t offset, std::size_t length, bool touching, char*& begin, std::size_t& bytes ) const
+	{
+		const std::size_t page = page_size();
+		const std::size_t end = std::min( offset+length, m_size );
+		const std::size_t first = ( touching ? offset : offset+page-1 )/page*page;
+		const std::size_t last = ( touching ? end+page-1 : end )/page*page;
+		if( first >= last ) { return false; }
+		begin = const_cast<char*>( m_file.const_data() )+first;
+		bytes = last-first;
+		return true;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_POOL_HPP
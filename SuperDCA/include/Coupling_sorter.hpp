@@ -0,0 +1,263 @@
+/** @file Coupling_sorter.hpp
+	Sorting of coupling output by score, in memory or with sorted runs spilled to a scratch file.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_SORTER_HPP
+#define SUPERDCA_COUPLING_SORTER_HPP
+
+#include <cstdint>
+#include <cmath> // for std::ceil
+#include <string>
+#include <vector>
+#include <queue>
+#include <fstream>
+#include <algorithm> // for std::sort, std::min, std::max
+
+#ifndef SUPERDCA_NO_TBB
+#include "tbb/parallel_sort.h"
+#endif // #ifndef SUPERDCA_NO_TBB
+
+#include "boost/filesystem/operations.hpp"
+
+#include "Coupling_binary_file.hpp" // for Coupling_record
+
+namespace superdca {
+
+/** Collects couplings, as add( score, i, j ) or add( score, i, j, Jij, Jji ) like the coupling writers take them, and
+	hands them on in order of decreasing score with finish( emit ).
+
+	Couplings are collected in runs of up to half the memory budget; each full run is sorted and kept in memory until
+	the sorted runs take up the other half of the budget, after which they are spilled to a scratch file. finish()
+	sorts the last run and merges all runs, in memory and on disk, with a k-way merge. Runs are sorted in parallel
+	with TBB, or with std::sort in builds without TBB (SUPERDCA_NO_TBB).
+
+	If only the 'top_n' best couplings are asked for, every sorted run is cut to its 'top_n' best, and the runs are
+	merged into a single run of the 'top_n' best as they are sorted, such that memory use stays within the budget
+	and nothing needs to be spilled as long as 'top_n' couplings fit into it. Couplings that cannot make it into the
+	'top_n' best (those that score below the 'top_n'th best of any sorted run) are dropped as they are added.
+
+	Couplings of equal score are ordered by i and then by j, such that the output does not depend on the order in
+	which the couplings were added.
+*/
+class Coupling_sorter
+{
+public:
+	/**
+		@param top_n Hand on only the 'top_n' best couplings (0 = all).
+		@param top_fraction Hand on only this fraction of all couplings, rounded up (1 = all).
+		@param memory_budget Bytes of couplings kept in memory.
+		@param scratch_file Name of the file that sorted runs are spilled to, if need be; it is removed as soon as it is opened.
+	*/
+	Coupling_sorter( std::size_t top_n, double top_fraction, std::size_t memory_budget, const std::string& scratch_file )
+	: m_top_n(top_n), m_top_fraction(top_fraction),
+	  m_run_capacity( std::max( memory_budget/2/sizeof(Coupling_record), std::size_t(1) ) ),
+	  m_memory_budget( memory_budget ), m_scratch_file( scratch_file ),
+	  m_threshold(0.0f), m_have_threshold(false), m_pair_norms(false), m_runs_bytes(0), m_n_added(0), m_n_emitted(0), m_n_spilled_runs(0), m_failed(false)
+	{
+		m_current.reserve( std::min( m_run_capacity, std::size_t(1)<<20 ) );
+	}
+
+	inline void add( float score, std::size_t i, std::size_t j ) { this->push( score, i, j, 0.0f, 0.0f ); }
+
+	inline void add( float score, std::size_t i, std::size_t j, float ij, float ji )
+	{
+		m_pair_norms = true;
+		this->push( score, i, j, ij, ji );
+	}
+
+	/** Call emit( const Coupling_record& ) for the best couplings, best first.
+
+		@return false if the scratch file could not be written or read.
+	*/
+	template< typename EmitT >
+	bool finish( EmitT&& emit )
+	{
+		this->sort_run();
+		run_t().swap( m_current );
+
+		std::size_t limit = m_n_added;
+		if( m_top_n > 0 ) { limit = std::min( limit, m_top_n ); }
+		if( m_top_fraction < 1.0 ) { limit = std::min( limit, std::size_t( std::ceil( m_top_fraction*double(m_n_added) ) ) ); }
+
+		// one cursor per run; spilled runs are read back through a buffer of their own
+		std::vector<Run_cursor> cursors;
+		const std::size_t buffer_records = std::max( m_memory_budget/2/sizeof(Coupling_record)/std::max( m_spilled.size(), std::size_t(1) ), std::size_t(1024) );
+		for( const auto& run: m_spilled ) { cursors.emplace_back( run.first, run.second, buffer_records ); }
+		for( const auto& run: m_runs ) { cursors.emplace_back( run.data(), run.size() ); }
+
+		const auto worse_cursor = [&cursors]( std::size_t a, std::size_t b ) { return better( *cursors[b].current, *cursors[a].current ); };
+		std::priority_queue< std::size_t, std::vector<std::size_t>, decltype(worse_cursor) > heads( worse_cursor );
+		for( std::size_t c=0; c < cursors.size(); ++c ) { if( this->advance( cursors[c], true ) ) { heads.push( c ); } }
+
+		std::size_t n_emitted = 0;
+		while( !heads.empty() && n_emitted < limit )
+		{
+			const auto c = heads.top(); heads.pop();
+			emit( *cursors[c].current );
+			++n_emitted;
+			if( this->advance( cursors[c], false ) ) { heads.push( c ); }
+		}
+		m_n_emitted = n_emitted;
+
+		m_runs.clear(); m_spilled.clear();
+		if( m_file.is_open() ) { m_file.close(); }
+		return !m_failed;
+	}
+
+	std::size_t n_added() const { return m_n_added; }
+	std::size_t n_emitted() const { return m_n_emitted; }
+	std::size_t n_spilled_runs() const { return m_n_spilled_runs; }
+	bool pair_norms() const { return m_pair_norms; } // whether couplings were added with the pair norms of norm-of-mean scoring
+
+	//> Better couplings score higher; ties are broken by i and then by j
+	static inline bool better( const Coupling_record& a, const Coupling_record& b )
+	{
+		return a.score > b.score || ( a.score == b.score && ( a.i < b.i || ( a.i == b.i && a.j < b.j ) ) );
+	}
+
+private:
+	using run_t = std::vector<Coupling_record>;
+
+	const std::size_t m_top_n;
+	const double m_top_fraction;
+	const std::size_t m_run_capacity; // couplings per run
+	const std::size_t m_memory_budget;
+	const std::string m_scratch_file;
+
+	run_t m_current; // the run being collected
+	std::vector<run_t> m_runs; // sorted runs in memory
+	std::vector< std::pair<uint64_t,std::size_t> > m_spilled; // file offset and size of each spilled run
+	std::fstream m_file;
+
+	float m_threshold; // with top_n, couplings below this score are dropped
+	bool m_have_threshold;
+	bool m_pair_norms;
+	std::size_t m_runs_bytes;
+	std::size_t m_n_added;
+	std::size_t m_n_emitted;
+	std::size_t m_n_spilled_runs;
+	bool m_failed;
+
+	struct Run_cursor
+	{
+		const Coupling_record* current;
+		const Coupling_record* end;
+		uint64_t file_offset; // of the couplings that have not been read into the buffer yet
+		std::size_t in_file; // number of such couplings
+		std::vector<Coupling_record> buffer;
+
+		Run_cursor( const Coupling_record* data, std::size_t n ) : current(data), end(data+n), file_offset(0), in_file(0) { }
+		Run_cursor( uint64_t offset, std::size_t n, std::size_t buffer_size ) : current(nullptr), end(nullptr), file_offset(offset), in_file(n), buffer( std::min( n, buffer_size ) ) { }
+	};
+
+	inline void push( float score, std::size_t i, std::size_t j, float ij, float ji )
+	{
+		++m_n_added;
+		if( m_have_threshold && score < m_threshold ) { return; } // not among the top_n best
+		m_current.push_back( Coupling_record{ score, uint32_t(i), uint32_t(j), ij, ji } );
+		if( m_current.size() == m_run_capacity ) { this->sort_run(); }
+	}
+
+	//> Move the cursor to its first (if 'first') or next coupling; returns false when the run is exhausted
+	bool advance( Run_cursor& cursor, bool first )
+	{
+		if( !first && cursor.current != cursor.end ) { ++cursor.current; }
+		if( cursor.current == cursor.end && cursor.in_file > 0 )
+		{
+			const std::size_t n = std::min( cursor.in_file, cursor.buffer.size() );
+			m_file.seekg( cursor.file_offset );
+			m_file.read( reinterpret_cast<char*>( cursor.buffer.data() ), n*sizeof(Coupling_record) );
+			if( !m_file.good() ) { m_failed = true; cursor.in_file = 0; return false; }
+			cursor.file_offset += n*sizeof(Coupling_record);
+			cursor.in_file -= n;
+			cursor.current = cursor.buffer.data();
+			cursor.end = cursor.buffer.data()+n;
+		}
+		return cursor.current != cursor.end;
+	}
+
+	void sort_run()
+	{
+		if( m_current.empty() ) { return; }
+
+		run_t run; run.reserve( m_current.capacity() );
+		run.swap( m_current );
+#ifndef SUPERDCA_NO_TBB
+		tbb::parallel_sort( run.begin(), run.end(), better );
+#else
+		std::sort( run.begin(), run.end(), better );
+#endif // #ifndef SUPERDCA_NO_TBB
+
+		if( m_top_n > 0 && run.size() >= m_top_n )
+		{
+			run.resize( m_top_n );
+			if( !m_have_threshold || run.back().score > m_threshold ) { m_threshold = run.back().score; m_have_threshold = true; }
+		}
+
+		if( m_top_n > 0 && m_runs.size() == 1 && 2*m_top_n*sizeof(Coupling_record) <= m_memory_budget )
+		{
+			// keep a single run of the top_n best
+			run_t merged; merged.reserve( std::min( m_runs.front().size()+run.size(), m_top_n ) );
+			auto a = m_runs.front().cbegin(); auto b = run.cbegin();
+			while( merged.size() < m_top_n && ( a != m_runs.front().cend() || b != run.cend() ) )
+			{
+				if( b == run.cend() || ( a != m_runs.front().cend() && !better( *b, *a ) ) ) { merged.push_back( *a++ ); }
+				else { merged.push_back( *b++ ); }
+			}
+			m_runs_bytes = merged.size()*sizeof(Coupling_record);
+			m_runs.front().swap( merged );
+			if( m_runs.front().size() == m_top_n && ( !m_have_threshold || m_runs.front().back().score > m_threshold ) ) { m_threshold = m_runs.front().back().score; m_have_threshold = true; }
+		}
+		else
+		{
+			m_runs_bytes += run.size()*sizeof(Coupling_record);
+			m_runs.push_back( std::move(run) );
+		}
+
+		if( m_runs_bytes > m_memory_budget/2 ) { this->spill(); }
+	}
+
+	//> Write the sorted runs in memory to the scratch file
+	void spill()
+	{
+		if( !m_file.is_open() )
+		{
+			m_file.open( m_scratch_file, std::ios_base::in | std::ios_base::out | std::ios_base::trunc | std::ios_base::binary );
+			boost::system::error_code ec;
+			boost::filesystem::remove( m_scratch_file, ec ); // the file stays usable until it is closed
+		}
+		m_file.seekp( 0, std::ios_base::end );
+		for( const auto& run: m_runs )
+		{
+			const uint64_t offset = uint64_t( m_file.tellp() );
+			m_file.write( reinterpret_cast<const char*>( run.data() ), run.size()*sizeof(Coupling_record) );
+			m_spilled.emplace_back( offset, run.size() );
+			++m_n_spilled_runs;
+		}
+		m_file.flush();
+		if( !m_file.good() ) { m_failed = true; }
+		m_runs.clear();
+		m_runs_bytes = 0;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_SORTER_HPP
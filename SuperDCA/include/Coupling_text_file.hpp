@@ -0,0 +1,213 @@
+/** @file Coupling_text_file.hpp
+	Fast, multi-threaded formatting of coupling text files.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_TEXT_FILE_HPP
+#define SUPERDCA_COUPLING_TEXT_FILE_HPP
+
+#include <cstdint>
+#include <cstdio> // for std::snprintf
+#include <cstring> // for std::memcpy
+#include <cmath> // for std::fabs, std::signbit
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <ostream>
+#include <algorithm> // for std::max
+
+namespace superdca {
+
+enum : std::size_t { FIXED8_MAX_LENGTH=330 }; // "-", 309 digits of DBL_MAX, "." and 8 decimals
+
+/** Write 'value' with eight decimals, exactly as 'out << std::fixed << std::setprecision(8) << value' does (which
+	is printf's "%.8f"), to 'out' and return the end of the written characters; needs at most 32 characters for
+	values below 10^10 and at most FIXED8_MAX_LENGTH characters in general.
+
+	value*10^8 is m*5^8*2^(e+8) for a binary value m*2^e, which is formed exactly in 128-bit integer arithmetic and
+	rounded to the nearest integer, ties to even, as printf rounds exact decimal expansions. Values of 10^10 or more,
+	infinities and NaNs are left to snprintf.
+*/
+inline char* format_fixed8( double value, char* out )
+{
+	if( !( std::fabs( value ) < 1e10 ) ) { return out + std::snprintf( out, FIXED8_MAX_LENGTH, "%.8f", value ); }
+
+	uint64_t bits; std::memcpy( &bits, &value, sizeof(bits) );
+	const int biased_exponent = int( ( bits >> 52 ) & 0x7ff );
+	const uint64_t mantissa = biased_exponent == 0 ? bits & 0xfffffffffffffull : ( bits & 0xfffffffffffffull ) | ( uint64_t(1) << 52 );
+	const int shift = ( biased_exponent == 0 ? 1-1075 : biased_exponent-1075 ) + 8; // value*10^8 = mantissa*5^8*2^shift
+
+	unsigned __int128 scaled = (unsigned __int128)( mantissa ) * 390625u; // < 2^72
+	uint64_t units; // value*10^8, rounded
+	if( shift >= 0 ) { units = uint64_t( scaled << shift ); } // exact; < 10^18 since |value| < 10^10
+	else if( -shift >= 128 ) { units = 0; } // below 2^-56
+	else
+	{
+		const unsigned k = unsigned( -shift );
+		const unsigned __int128 remainder = scaled & ( ( (unsigned __int128)(1) << k ) - 1 );
+		const unsigned __int128 half = (unsigned __int128)(1) << (k-1);
+		units = uint64_t( scaled >> k );
+		if( remainder > half || ( remainder == half && ( units & 1 ) ) ) { ++units; }
+	}
+
+	if( std::signbit( value ) ) { *out++ = '-'; }
+
+	char digits[20];
+	char* d = digits+sizeof(digits);
+	for( int n=0; n < 8; ++n ) { *--d = char( '0' + units % 10 ); units /= 10; }
+	*--d = '.';
+	do { *--d = char( '0' + units % 10 ); units /= 10; } while( units > 0 );
+	const std::size_t length = digits+sizeof(digits)-d;
+	std::memcpy( out, d, length );
+	return out+length;
+}
+
+//> Write 'value' in decimal to 'out' and return the end of the written characters; needs at most 20 characters
+inline char* format_index( uint64_t value, char* out )
+{
+	char digits[20];
+	char* d = digits+sizeof(digits);
+	do { *--d = char( '0' + value % 10 ); value /= 10; } while( value > 0 );
+	const std::size_t length = digits+sizeof(digits)-d;
+	std::memcpy( out, d, length );
+	return out+length;
+}
+
+/** Writes coupling text files, byte-identical to formatting each line through an std::ostream in std::fixed mode
+	with precision 8, but without iostreams and on several threads.
+
+	Lines are collected in batches of 'batch_size' lines; each full batch is formatted into a text buffer by a task of
+	its own, while the caller goes on adding lines, and the buffers are written to the stream in order, with one write
+	call each. At most 2*n_threads batches are in flight; a caller that gets ahead of the formatting waits for the
+	oldest batch.
+
+	Lines are "score i j", where i and j are loci1[i]+base_index and loci2[j]+base_index, or "score i j ij ji mean" for
+	the pair norms of norm-of-mean scoring, where mean is (ij+ji)/2.
+*/
+class Coupling_text_writer
+{
+public:
+	/**
+		@param loci1 Original indices of the loci of the first alignment.
+		@param loci2 Original indices of the loci of the second alignment of a scan; empty in single-alignment runs.
+	*/
+	Coupling_text_writer( std::ostream* out, uint64_t base_index, const std::vector<uint64_t>& loci1, const std::vector<uint64_t>& loci2,
+		std::size_t n_threads, std::size_t batch_size=1<<16 )
+	: m_out(out), m_base_index(base_index), m_loci1(loci1), m_loci2( loci2.empty() ? loci1 : loci2 ),
+	  m_max_in_flight( 2*std::max( n_threads, std::size_t(1) ) ), m_batch_size( std::max( batch_size, std::size_t(1) ) ),
+	  m_n_written(0), m_finished(false)
+	{
+		m_batch.reserve( m_batch_size );
+	}
+	~Coupling_text_writer() { this->finish(); }
+
+	inline void add( double score, std::size_t i, std::size_t j )
+	{
+		m_batch.push_back( Line{ score, i, j, 0.0f, 0.0f, false } );
+		if( m_batch.size() == m_batch_size ) { this->submit(); }
+	}
+
+	inline void add( double score, std::size_t i, std::size_t j, float ij, float ji )
+	{
+		m_batch.push_back( Line{ score, i, j, ij, ji, true } );
+		if( m_batch.size() == m_batch_size ) { this->submit(); }
+	}
+
+	//> Format and write all remaining lines
+	void finish()
+	{
+		if( m_finished ) { return; }
+		m_finished = true;
+		this->submit();
+		while( !m_in_flight.empty() ) { this->write_oldest(); }
+		m_out->flush();
+	}
+
+	std::size_t lines_written() const { return m_n_written; }
+	bool good() const { return m_out->good(); }
+
+private:
+	struct Line
+	{
+		double score;
+		std::size_t i, j;
+		float ij, ji;
+		bool pair_norms;
+	};
+	using batch_t = std::vector<Line>;
+
+	std::ostream* m_out;
+	const uint64_t m_base_index;
+	const std::vector<uint64_t> m_loci1;
+	const std::vector<uint64_t> m_loci2;
+	const std::size_t m_max_in_flight;
+	const std::size_t m_batch_size;
+	batch_t m_batch;
+	std::deque< std::future<std::string> > m_in_flight;
+	std::size_t m_n_written;
+	bool m_finished;
+
+	void submit()
+	{
+		if( m_batch.empty() ) { return; }
+		if( m_in_flight.size() == m_max_in_flight ) { this->write_oldest(); }
+		m_n_written += m_batch.size();
+
+		batch_t batch; batch.reserve( m_batch_size );
+		batch.swap( m_batch );
+		m_in_flight.push_back( std::async( std::launch::async, [this]( const batch_t& lines ) { return this->format( lines ); }, std::move(batch) ) );
+	}
+
+	void write_oldest()
+	{
+		const auto text = m_in_flight.front().get();
+		m_in_flight.pop_front();
+		m_out->write( text.data(), text.size() );
+	}
+
+	std::string format( const batch_t& lines ) const
+	{
+		enum : std::size_t { MAX_LINE=4*FIXED8_MAX_LENGTH+2*20+6 };
+		std::string text( lines.size()*32+MAX_LINE, '\0' ); // enough for the usual "0.12345678 1234567 1234567" lines
+		std::size_t length = 0;
+		for( const auto& line: lines )
+		{
+			if( text.size()-length < MAX_LINE ) { text.resize( 2*text.size() ); }
+			char* out = &text[length];
+			out = format_fixed8( line.score, out ); *out++ = ' ';
+			out = format_index( m_loci1[line.i]+m_base_index, out ); *out++ = ' ';
+			out = format_index( m_loci2[line.j]+m_base_index, out );
+			if( line.pair_norms )
+			{
+				*out++ = ' '; out = format_fixed8( line.ij, out );
+				*out++ = ' '; out = format_fixed8( line.ji, out );
+				*out++ = ' '; out = format_fixed8( (line.ij+line.ji)*0.5, out );
+			}
+			*out++ = '\n';
+			length = out-&text[0];
+		}
+		text.resize( length );
+		return text;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_TEXT_FILE_HPP
@@ -0,0 +1,159 @@
+/** @file Coupling_writer.hpp
+	Pipelined output of coupling scores, overlapped with the parameter learning stage.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_COUPLING_WRITER_HPP
+#define SUPERDCA_COUPLING_WRITER_HPP
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm> // for std::max
+
+namespace superdca {
+
+/** Writes coupling scores on a dedicated thread as soon as the rows they depend on have been solved.
+
+	Solver threads report each finished row with row_finished(), which only queues the row. In symmetric
+	mode the score of pair (i,j) needs both rows i and j, so the pair is written once the second of the two
+	rows is finished; pairs are written as emit_pair( i, j ), where i comes after j in the row list, as in
+	an L-by-L lower triangle. In scan mode every row can be written as soon as it is finished.
+
+	Lines are therefore written in order of completion rather than in locus order, but each run writes
+	exactly the same set of lines. Rows that are never finished (e.g. in an interrupted run) are never written.
+*/
+class Coupling_writer
+{
+public:
+	using emit_pair_t = std::function< void( std::size_t i, std::size_t j ) >;
+
+	/**
+		@param rows Row loci, in output order.
+		@param cols Column loci, in output order; ignored in symmetric mode, where the columns are 'rows'.
+	*/
+	Coupling_writer( const std::vector<std::size_t>& rows, const std::vector<std::size_t>& cols, bool symmetric, emit_pair_t emit_pair )
+	: m_rows(rows), m_cols( symmetric ? rows : cols ), m_symmetric(symmetric), m_emit_pair( std::move(emit_pair) ),
+	  m_done( false ), m_n_rows_written(0), m_n_pairs_written(0)
+	{
+		std::size_t max_locus = 0;
+		for( const auto r: m_rows ) { max_locus = std::max( max_locus, r+1 ); }
+		m_row_finished.assign( max_locus, false );
+		m_row_position.assign( max_locus, 0 );
+		for( std::size_t pos=0; pos < m_rows.size(); ++pos ) { m_row_position[ m_rows[pos] ] = pos; }
+
+		m_thread = std::thread( [this]() { this->run(); } );
+	}
+	~Coupling_writer() { this->finish(); }
+
+	//> Queue a finished row for output. May be called concurrently from any thread; each row must be reported only once.
+	void row_finished( std::size_t r )
+	{
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			m_queue.push_back( r );
+		}
+		m_ready.notify_one();
+	}
+
+	//> Write all queued rows and stop the writer thread.
+	void finish()
+	{
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			if( m_done ) { return; }
+			m_done = true;
+		}
+		m_ready.notify_one();
+		if( m_thread.joinable() ) { m_thread.join(); }
+	}
+
+	std::size_t rows_written() const { return m_n_rows_written.load(); }
+	std::size_t pairs_written() const { return m_n_pairs_written.load(); }
+
+private:
+	const std::vector<std::size_t> m_rows;
+	const std::vector<std::size_t> m_cols;
+	const bool m_symmetric;
+	const emit_pair_t m_emit_pair;
+
+	std::vector<bool> m_row_finished; // accessed by the writer thread only
+	std::vector<std::size_t> m_row_position;
+
+	std::deque<std::size_t> m_queue;
+	bool m_done;
+	std::mutex m_mutex;
+	std::condition_variable m_ready;
+	std::thread m_thread;
+
+	std::atomic<std::size_t> m_n_rows_written;
+	std::atomic<std::size_t> m_n_pairs_written;
+
+	void run()
+	{
+		std::deque<std::size_t> rows;
+		while( true )
+		{
+			{
+				std::unique_lock<std::mutex> lock( m_mutex );
+				m_ready.wait( lock, [this]() { return m_done || !m_queue.empty(); } );
+				if( m_queue.empty() ) { return; } // m_done and nothing left to write
+				rows.swap( m_queue );
+			}
+			for( const auto r: rows ) { this->write_row( r ); }
+			rows.clear();
+		}
+	}
+
+	void write_row( std::size_t r )
+	{
+		if( r >= m_row_finished.size() || m_row_finished[r] ) { return; }
+		m_row_finished[r] = true;
+
+		std::size_t n_pairs = 0;
+		if( m_symmetric )
+		{
+			// pair the new row with every row that was finished before it
+			const std::size_t r_pos = m_row_position[r];
+			for( std::size_t pos=0; pos < m_rows.size(); ++pos )
+			{
+				const auto n = m_rows[pos];
+				if( pos == r_pos || !m_row_finished[n] ) { continue; }
+				if( pos < r_pos ) { m_emit_pair( r, n); }
+				else { m_emit_pair( n, r); }
+				++n_pairs;
+			}
+		}
+		else
+		{
+			for( const auto n: m_cols ) { m_emit_pair( r, n); }
+			n_pairs = m_cols.size();
+		}
+		++m_n_rows_written;
+		m_n_pairs_written += n_pairs;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_COUPLING_WRITER_HPP
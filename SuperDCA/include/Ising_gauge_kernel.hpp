@@ -0,0 +1,188 @@
+/** @file Ising_gauge_kernel.hpp
+	Batched Ising gauge fixing and Frobenius norms of q-by-q coupling matrices.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_ISING_GAUGE_KERNEL_HPP
+#define SUPERDCA_ISING_GAUGE_KERNEL_HPP
+
+#include <array>
+#include <cmath> // for std::sqrt
+#include <algorithm> // for std::min
+
+namespace superdca {
+
+/** Gauge fixing and norms of many small coupling matrices at a time.
+
+	The per-matrix functions in Matrix_math.hpp and plmDCA_utility.hpp work on one q-by-q matrix at a time, which is
+	too little work for SIMD units: every mean and norm is a short sequential sum. Here a batch of Lanes matrices is
+	first transposed into structure-of-arrays form, i.e. element e of all matrices of the batch lies contiguously,
+	such that every step is a loop over the lanes of the batch, which the compiler turns into vector instructions.
+
+	The results are bit-identical to frobenius_norm( ising_gauge( J ), exclude ): each lane performs the same
+	floating-point operations in the same order, only side by side with the other lanes.
+*/
+template< typename RealT, std::size_t Q, std::size_t Lanes=16 >
+struct Ising_gauge_kernel
+{
+	using matrix_t = std::array< RealT, Q*Q >; // row by row
+	using reduced_t = std::array< RealT, (Q-1)*(Q-1) >; // without the row and column of the excluded state, row by row
+
+	/** Fix the Ising gauge of 'n' matrices and drop the excluded state from each; same as ising_gauge() of each matrix
+		followed by removing the row and column of 'exclude'.
+	*/
+	static void gauge( const matrix_t* matrices, std::size_t n, std::size_t exclude, reduced_t* gauged )
+	{
+		for( std::size_t first=0; first < n; first += Lanes )
+		{
+			const std::size_t lanes = std::min( Lanes, n-first );
+
+			alignas(64) RealT J[Q*Q][Lanes];
+			alignas(64) RealT G[(Q-1)*(Q-1)][Lanes];
+			load( matrices+first, lanes, J );
+			gauge_batch( J, exclude, G );
+			store( G, lanes, gauged+first );
+		}
+	}
+
+	//> The Frobenius norms of 'n' reduced matrices; same as the norms that frobenius_norm() gives
+	static void norms( const reduced_t* matrices, std::size_t n, RealT* norms_out )
+	{
+		for( std::size_t first=0; first < n; first += Lanes )
+		{
+			const std::size_t lanes = std::min( Lanes, n-first );
+
+			alignas(64) RealT G[(Q-1)*(Q-1)][Lanes];
+			alignas(64) RealT norm[Lanes];
+			load( matrices+first, lanes, G );
+			norm_batch( G, norm );
+			for( std::size_t b=0; b < lanes; ++b ) { norms_out[first+b] = norm[b]; }
+		}
+	}
+
+	/** The norms of pairs of reduced matrices: the norm of the mean of both, and the norm of each.
+	*/
+	static void pair_norms( const reduced_t* Jij, const reduced_t* Jji, std::size_t n, RealT* mean_out, RealT* ij_out, RealT* ji_out )
+	{
+		for( std::size_t first=0; first < n; first += Lanes )
+		{
+			const std::size_t lanes = std::min( Lanes, n-first );
+
+			alignas(64) RealT A[(Q-1)*(Q-1)][Lanes];
+			alignas(64) RealT B[(Q-1)*(Q-1)][Lanes];
+			alignas(64) RealT M[(Q-1)*(Q-1)][Lanes];
+			alignas(64) RealT norm[3][Lanes];
+			load( Jij+first, lanes, A );
+			load( Jji+first, lanes, B );
+			for( std::size_t e=0; e < (Q-1)*(Q-1); ++e )
+			{
+				for( std::size_t b=0; b < Lanes; ++b ) { M[e][b] = ( A[e][b]+B[e][b] )*RealT(0.5); }
+			}
+			norm_batch( M, norm[0] );
+			norm_batch( A, norm[1] );
+			norm_batch( B, norm[2] );
+			for( std::size_t b=0; b < lanes; ++b )
+			{
+				mean_out[first+b] = norm[0][b]; ij_out[first+b] = norm[1][b]; ji_out[first+b] = norm[2][b];
+			}
+		}
+	}
+
+private:
+	//> Transpose 'lanes' matrices into structure-of-arrays form; unused lanes are zeroed
+	template< std::size_t Elements >
+	static inline void load( const std::array<RealT,Elements>* matrices, std::size_t lanes, RealT (&soa)[Elements][Lanes] )
+	{
+		for( std::size_t b=0; b < lanes; ++b )
+		{
+			for( std::size_t e=0; e < Elements; ++e ) { soa[e][b] = matrices[b][e]; }
+		}
+		for( std::size_t b=lanes; b < Lanes; ++b )
+		{
+			for( std::size_t e=0; e < Elements; ++e ) { soa[e][b] = RealT(0); }
+		}
+	}
+
+	template< std::size_t Elements >
+	static inline void store( const RealT (&soa)[Elements][Lanes], std::size_t lanes, std::array<RealT,Elements>* matrices )
+	{
+		for( std::size_t b=0; b < lanes; ++b )
+		{
+			for( std::size_t e=0; e < Elements; ++e ) { matrices[b][e] = soa[e][b]; }
+		}
+	}
+
+	/** The steps of ising_gauge(): J - repmat(rowmean) - repmat(colmean,true) + mean(rowmean), where repmat() of
+		the row means repeats them along rows, i.e. element (i,j) subtracts the mean of row j.
+	*/
+	static inline void gauge_batch( const RealT (&J)[Q*Q][Lanes], std::size_t exclude, RealT (&G)[(Q-1)*(Q-1)][Lanes] )
+	{
+		alignas(64) RealT row_mean[Q][Lanes];
+		alignas(64) RealT col_mean[Q][Lanes];
+		alignas(64) RealT mean_mean[Lanes];
+
+		for( std::size_t i=0; i < Q; ++i )
+		{
+			for( std::size_t b=0; b < Lanes; ++b ) { row_mean[i][b] = RealT(0); col_mean[i][b] = RealT(0); }
+			for( std::size_t j=0; j < Q; ++j )
+			{
+				for( std::size_t b=0; b < Lanes; ++b )
+				{
+					row_mean[i][b] = row_mean[i][b] + J[i*Q+j][b];
+					col_mean[i][b] = col_mean[i][b] + J[j*Q+i][b];
+				}
+			}
+			for( std::size_t b=0; b < Lanes; ++b ) { row_mean[i][b] = row_mean[i][b] / RealT(Q); col_mean[i][b] = col_mean[i][b] / RealT(Q); }
+		}
+
+		for( std::size_t b=0; b < Lanes; ++b ) { mean_mean[b] = RealT(0); }
+		for( std::size_t i=0; i < Q; ++i )
+		{
+			for( std::size_t b=0; b < Lanes; ++b ) { mean_mean[b] += row_mean[i][b]; }
+		}
+		for( std::size_t b=0; b < Lanes; ++b ) { mean_mean[b] = mean_mean[b] / RealT(Q); }
+
+		std::size_t k = 0;
+		for( std::size_t i=0; i < Q; ++i )
+		{
+			if( i == exclude ) { continue; }
+			for( std::size_t j=0; j < Q; ++j )
+			{
+				if( j == exclude ) { continue; }
+				for( std::size_t b=0; b < Lanes; ++b ) { G[k][b] = ( ( J[i*Q+j][b] - row_mean[j][b] ) - col_mean[i][b] ) + mean_mean[b]; }
+				++k;
+			}
+		}
+	}
+
+	//> Sums the squares in element order and in double precision, as 'sum += std::pow( x, 2 )' with a single precision 'sum' does
+	static inline void norm_batch( const RealT (&G)[(Q-1)*(Q-1)][Lanes], RealT (&norm)[Lanes] )
+	{
+		for( std::size_t b=0; b < Lanes; ++b ) { norm[b] = RealT(0); }
+		for( std::size_t e=0; e < (Q-1)*(Q-1); ++e )
+		{
+			for( std::size_t b=0; b < Lanes; ++b ) { norm[b] = RealT( double(norm[b]) + double(G[e][b])*double(G[e][b]) ); }
+		}
+		for( std::size_t b=0; b < Lanes; ++b ) { norm[b] = std::sqrt( norm[b] ); }
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_ISING_GAUGE_KERNEL_HPP
@@ -0,0 +1,261 @@
+/** @file Parameter_store.hpp
+	Binary file of the fitted per-locus parameters (h_r, J_r), written on a dedicated I/O thread.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_PARAMETER_STORE_HPP
+#define SUPERDCA_PARAMETER_STORE_HPP
+
+#include <cstdint>
+#include <cstring> // for std::memcpy, std::memcmp, std::memset
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm> // for std::max
+#include <stdexcept>
+
+#include "Score_precision.hpp"
+
+namespace superdca {
+
+/** Layout of a parameter file (all values in host byte order):
+
+	header:    Parameter_file_header
+	id string: header.id_length bytes (alignment id), zero-padded to a multiple of 8 bytes
+	rows:      header.n_rows x uint64 (zero-based original index of every row locus of the run)
+	columns:   header.n_cols x uint64 (zero-based original index of every locus of the alignment that J_r refers to)
+	index:     header.n_rows x uint64 (file offset of the record of each row; 0 if the row was not stored)
+	records:   one per stored row, in order of completion, each record_size() bytes:
+	           h_r: q values, followed by
+	           J_r: header.n_cols matrices of q x q values, row by row; element [a][b] of matrix n couples
+	                state a of locus n with state b of locus r. The matrix of n == r is not used by the model.
+
+	Values are IEEE single precision, or 16-bit as given by header.precision (see Score_precision.hpp).
+	If header.flags & GAUGED, every matrix is in the gauge that coupling scores are computed in (see ising_gauge()),
+	such that scores can be recomputed from the file; h_r is always stored as solved. Energies and warm starts need
+	the parameters as solved, i.e. a file written without gauge fixing.
+
+	A record is written before its index entry, so a run that dies leaves a file whose indexed records are complete.
+*/
+struct Parameter_file_header
+{
+	enum : uint32_t { VERSION=1 };
+	enum : uint32_t { GAUGED=1 };
+
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t precision; // Score_precision
+	uint32_t n_states; // q
+	uint32_t id_length;
+	uint32_t reserved;
+	uint64_t n_rows;
+	uint64_t n_cols;
+
+	static const char* s_magic() { return "SDCAPAR1"; }
+
+	Parameter_file_header() { std::memset( this, 0, sizeof(*this) ); std::memcpy( magic, s_magic(), sizeof(magic) ); version = VERSION; }
+
+	bool valid() const { return 0 == std::memcmp( magic, s_magic(), sizeof(magic) ) && version == VERSION; }
+
+	Score_precision value_precision() const { return Score_precision( precision ); }
+	std::size_t value_bytes() const { return score_bytes( this->value_precision() ); }
+	std::size_t record_values() const { return n_states + n_cols*n_states*n_states; }
+	std::size_t record_size() const { return ( this->record_values()*this->value_bytes()+7 ) & ~std::size_t(7); }
+
+	std::size_t padded_id_length() const { return (id_length+7) & ~std::size_t(7); }
+
+	std::size_t rows_offset() const { return sizeof(Parameter_file_header) + padded_id_length(); }
+	std::size_t cols_offset() const { return rows_offset() + n_rows*sizeof(uint64_t); }
+	std::size_t index_offset() const { return cols_offset() + n_cols*sizeof(uint64_t); }
+	std::size_t records_offset() const { return index_offset() + n_rows*sizeof(uint64_t); }
+};
+
+/** Streams the parameters of solved loci to a parameter file.
+
+	Solver threads hand over each solved locus with store(), which only encodes the values and queues the record;
+	a dedicated I/O thread appends the records to the file and fills in the index. At most 'max_queued' records
+	wait for the I/O thread at any time; store() blocks while the queue is full, such that a slow disk slows down
+	the solvers instead of piling up records in memory.
+*/
+class Parameter_store
+{
+public:
+	/**
+		@param rows The (zero-based) column indices of the row loci in the input alignment.
+		@param row_ids The original indices of 'rows'.
+		@param col_ids The original indices of the loci of the alignment, i.e. of the matrices of J_r.
+	*/
+	Parameter_store( const std::string& filename, const std::string& id,
+		const std::vector<std::size_t>& rows, const std::vector<uint64_t>& row_ids, const std::vector<uint64_t>& col_ids,
+		std::size_t n_states, Score_precision precision, bool gauged, std::size_t max_queued )
+	: m_filename( filename ), m_max_queued( std::max( max_queued, std::size_t(1) ) ), m_done( false ), m_failed( false ), m_n_stored(0)
+	{
+		m_header.flags = gauged ? uint32_t(Parameter_file_header::GAUGED) : uint32_t(0);
+		m_header.precision = uint32_t( precision );
+		m_header.n_states = n_states;
+		m_header.id_length = id.size();
+		m_header.n_rows = rows.size();
+		m_header.n_cols = col_ids.size();
+
+		m_file.open( filename, std::ios::binary | std::ios::trunc );
+		if( !m_file ) { throw std::runtime_error( "could not create parameter file \""+filename+"\"" ); }
+		const std::vector<char> id_padding( m_header.padded_id_length()-id.size(), 0 );
+		const std::vector<uint64_t> index( rows.size(), 0 );
+		m_file.write( reinterpret_cast<const char*>( &m_header ), sizeof(m_header) );
+		m_file.write( id.data(), id.size() );
+		m_file.write( id_padding.data(), id_padding.size() );
+		m_file.write( reinterpret_cast<const char*>( row_ids.data() ), row_ids.size()*sizeof(uint64_t) );
+		m_file.write( reinterpret_cast<const char*>( col_ids.data() ), col_ids.size()*sizeof(uint64_t) );
+		m_file.write( reinterpret_cast<const char*>( index.data() ), index.size()*sizeof(uint64_t) );
+		if( !m_file ) { throw std::runtime_error( "could not write parameter file \""+filename+"\"" ); }
+		m_end = m_header.records_offset();
+
+		std::size_t max_locus = 0;
+		for( const auto r: rows ) { max_locus = std::max( max_locus, r+1 ); }
+		m_row_position.assign( max_locus, NOT_A_ROW );
+		for( std::size_t pos=0; pos < rows.size(); ++pos ) { m_row_position[ rows[pos] ] = pos; }
+
+		m_thread = std::thread( [this]() { this->run(); } );
+	}
+	~Parameter_store() { this->finish(); }
+
+	const std::string& filename() const { return m_filename; }
+
+	//> The number of values of a record: q values of h_r, followed by the q x q values of each matrix of J_r
+	std::size_t record_values() const { return m_header.record_values(); }
+	//> The size of the file once every row has been stored
+	uint64_t file_size() const { return m_header.records_offset() + m_header.n_rows*m_header.record_size(); }
+	bool gauged() const { return m_header.flags & Parameter_file_header::GAUGED; }
+
+	/** Queue the parameters of row 'locus' for writing; 'values' holds record_values() values in record order.
+		May be called concurrently from any thread; each row must be stored only once.
+	*/
+	void store( std::size_t locus, const float* values )
+	{
+		const auto pos = locus < m_row_position.size() ? m_row_position[locus] : NOT_A_ROW;
+		if( pos == NOT_A_ROW ) { return; }
+
+		Record record{ pos, std::vector<char>( m_header.record_size(), 0 ) };
+		const std::size_t n_values = this->record_values();
+		if( m_header.value_precision() == Score_precision::FP32 )
+		{
+			std::memcpy( record.data.data(), values, n_values*sizeof(float) );
+		}
+		else
+		{
+			uint16_t* encoded = reinterpret_cast<uint16_t*>( record.data.data() );
+			for( std::size_t k=0; k < n_values; ++k ) { encoded[k] = encode_score( m_header.value_precision(), values[k] ); }
+		}
+
+		std::unique_lock<std::mutex> lock( m_mutex );
+		m_space.wait( lock, [this]() { return m_queue.size() < m_max_queued || m_done; } );
+		m_queue.push_back( std::move( record ) );
+		lock.unlock();
+		m_ready.notify_one();
+	}
+
+	//> Write all queued records and close the file.
+	void finish()
+	{
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			if( m_done ) { return; }
+			m_done = true;
+		}
+		m_ready.notify_one();
+		m_space.notify_all();
+		if( m_thread.joinable() ) { m_thread.join(); }
+		m_file.close();
+	}
+
+	//> False if writing has failed (e.g. the disk is full); records are dropped from then on
+	bool good() const { return !m_failed.load(); }
+	std::size_t n_stored() const { return m_n_stored.load(); }
+
+private:
+	enum : std::size_t { NOT_A_ROW = std::size_t(-1) };
+
+	struct Record
+	{
+		std::size_t pos;
+		std::vector<char> data;
+	};
+
+	std::string m_filename;
+	Parameter_file_header m_header;
+	std::ofstream m_file; // accessed by the I/O thread only, once it has been started
+	uint64_t m_end;
+	std::vector<std::size_t> m_row_position;
+
+	const std::size_t m_max_queued;
+	std::deque<Record> m_queue;
+	bool m_done;
+	std::mutex m_mutex;
+	std::condition_variable m_ready;
+	std::condition_variable m_space;
+	std::thread m_thread;
+
+	std::atomic<bool> m_failed;
+	std::atomic<std::size_t> m_n_stored;
+
+	void run()
+	{
+		while( true )
+		{
+			Record record;
+			{
+				std::unique_lock<std::mutex> lock( m_mutex );
+				m_ready.wait( lock, [this]() { return m_done || !m_queue.empty(); } );
+				if( m_queue.empty() ) { break; } // m_done and nothing left to write
+				record = std::move( m_queue.front() );
+				m_queue.pop_front();
+			}
+			m_space.notify_one();
+			this->write( record );
+		}
+		m_file.flush();
+	}
+
+	void write( const Record& record )
+	{
+		if( m_failed.load() ) { return; }
+
+		// the record first, then its index entry
+		m_file.seekp( m_end );
+		m_file.write( record.data.data(), record.data.size() );
+		m_file.flush();
+		if( !m_file ) { m_failed.store( true ); return; }
+		m_file.seekp( m_header.index_offset() + record.pos*sizeof(uint64_t) );
+		m_file.write( reinterpret_cast<const char*>( &m_end ), sizeof(m_end) );
+		if( !m_file ) { m_failed.store( true ); return; }
+
+		m_end += record.data.size();
+		++m_n_stored;
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_PARAMETER_STORE_HPP
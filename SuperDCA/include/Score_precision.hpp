@@ -0,0 +1,111 @@
+/** @file Score_precision.hpp
+	Reduced-precision encodings of coupling scores.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_SCORE_PRECISION_HPP
+#define SUPERDCA_SCORE_PRECISION_HPP
+
+#include <cstdint>
+#include <cstring> // for std::memcpy
+#include <string>
+#include <stdexcept>
+
+namespace superdca {
+
+//> Storage format of coupling scores: IEEE single precision, IEEE half precision or bfloat16
+enum class Score_precision { FP32, FP16, BF16 };
+
+inline Score_precision parse_score_precision( const std::string& name )
+{
+	if( name == "fp32" ) { return Score_precision::FP32; }
+	if( name == "fp16" ) { return Score_precision::FP16; }
+	if( name == "bf16" ) { return Score_precision::BF16; }
+	throw std::invalid_argument( "invalid score precision \"" + name + "\" (expected 'fp32', 'fp16' or 'bf16')" );
+}
+
+inline std::size_t score_bytes( Score_precision precision ) { return precision == Score_precision::FP32 ? sizeof(float) : sizeof(uint16_t); }
+
+//> Round a float to the nearest (ties to even) IEEE half precision value
+inline uint16_t float_to_fp16( float value )
+{
+	uint32_t x; std::memcpy( &x, &value, sizeof(x) );
+	const uint16_t sign = (x >> 16) & 0x8000;
+	x &= 0x7FFFFFFF;
+
+	if( x >= 0x7F800000 ) { return sign | 0x7C00 | ( x > 0x7F800000 ? 0x0200 : 0 ); } // inf, nan
+	if( x >= 0x477FF000 ) { return sign | 0x7C00; } // rounds to beyond 65504
+	if( x < 0x38800000 ) // subnormal in half precision
+	{
+		if( x < 0x33000000 ) { return sign; } // rounds to zero
+		const uint32_t shift = 126 - (x >> 23);
+		const uint32_t mantissa = (x & 0x007FFFFF) | 0x00800000;
+		const uint32_t q = mantissa >> shift;
+		const uint32_t rem = mantissa & ((1u << shift)-1);
+		const uint32_t halfway = 1u << (shift-1);
+		return sign | uint16_t( q + ( rem > halfway || ( rem == halfway && (q & 1) ) ) );
+	}
+	uint32_t h = (x - 0x38000000) >> 13; // rebias the exponent from 127 to 15
+	const uint32_t rem = x & 0x1FFF;
+	h += ( rem > 0x1000 || ( rem == 0x1000 && (h & 1) ) ); // a carry correctly bumps the exponent
+	return sign | uint16_t(h);
+}
+
+inline float fp16_to_float( uint16_t h )
+{
+	const uint32_t sign = uint32_t(h & 0x8000) << 16;
+	const uint32_t exponent = (h >> 10) & 0x1F;
+	uint32_t mantissa = h & 0x03FF;
+	uint32_t x;
+	if( exponent == 0x1F ) { x = sign | 0x7F800000 | (mantissa << 13); }
+	else if( exponent != 0 ) { x = sign | ((exponent+112) << 23) | (mantissa << 13); }
+	else if( mantissa == 0 ) { x = sign; }
+	else
+	{
+		// subnormal in half precision, normal in single precision
+		uint32_t shift = 0;
+		while( !(mantissa & 0x0400) ) { mantissa <<= 1; ++shift; }
+		x = sign | ((113-shift) << 23) | ((mantissa & 0x03FF) << 13);
+	}
+	float value; std::memcpy( &value, &x, sizeof(value) );
+	return value;
+}
+
+//> Round a float to the nearest (ties to even) bfloat16 value
+inline uint16_t float_to_bf16( float value )
+{
+	uint32_t x; std::memcpy( &x, &value, sizeof(x) );
+	if( (x & 0x7FFFFFFF) > 0x7F800000 ) { return uint16_t( (x >> 16) | 0x0040 ); } // keep nan a nan
+	x += 0x7FFF + ((x >> 16) & 1);
+	return uint16_t( x >> 16 );
+}
+
+inline float bf16_to_float( uint16_t h )
+{
+	const uint32_t x = uint32_t(h) << 16;
+	float value; std::memcpy( &value, &x, sizeof(value) );
+	return value;
+}
+
+inline uint16_t encode_score( Score_precision precision, float value ) { return precision == Score_precision::BF16 ? float_to_bf16( value ) : float_to_fp16( value ); }
+inline float decode_score( Score_precision precision, uint16_t h ) { return precision == Score_precision::BF16 ? bf16_to_float( h ) : fp16_to_float( h ); }
+
+} // namespace superdca
+
+#endif // SUPERDCA_SCORE_PRECISION_HPP
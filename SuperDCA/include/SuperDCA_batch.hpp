@@ -0,0 +1,162 @@
+/** @file SuperDCA_batch.hpp
+	Batch mode: run many independent analyses in one process.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_BATCH_HPP
+#define SUPERDCA_BATCH_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#ifndef SUPERDCA_NO_TBB
+#include "tbb/pipeline.h"
+#endif // #ifndef SUPERDCA_NO_TBB
+
+#include "apegrunt/Apegrunt.h"
+
+#include "SuperDCA_options.h"
+#include "plmDCA.hpp"
+
+namespace superdca {
+
+//> One analysis of a batch run; equivalent to running SuperDCA on the given alignment file(s)
+struct Batch_job
+{
+	std::size_t line; // line number in the manifest
+	std::vector<std::string> alignment_filenames; // one alignment, or two for an inter-alignment scan
+};
+
+/** Read a batch manifest.
+
+	Each non-empty line of the manifest defines one job: one alignment filename, or two whitespace-separated
+	filenames for an inter-alignment scan. Text following a '#' is ignored.
+*/
+inline std::vector<Batch_job> read_batch_manifest( const std::string& filename )
+{
+	std::ifstream infile( filename );
+	if( !infile.is_open() ) { throw std::runtime_error( "could not open batch manifest \""+filename+"\"" ); }
+
+	std::vector<Batch_job> jobs;
+	std::string line;
+	std::size_t line_number = 0;
+	while( std::getline( infile, line ) )
+	{
+		++line_number;
+		line = line.substr( 0, line.find('#') );
+		std::istringstream fields( line );
+		Batch_job job{ line_number, {} };
+		std::string field;
+		while( fields >> field ) { job.alignment_filenames.push_back( field ); }
+		if( job.alignment_filenames.empty() ) { continue; }
+		if( job.alignment_filenames.size() > 2 )
+		{
+			std::ostringstream msg; msg << "batch manifest \"" << filename << "\", line " << line_number << ": a job can have at most 2 alignments";
+			throw std::runtime_error( msg.str() );
+		}
+		jobs.push_back( std::move(job) );
+	}
+	return jobs;
+}
+
+/** Run the jobs of a batch.
+
+	Jobs are read, preprocessed and solved concurrently, 'n_concurrent' jobs at a time. Every job runs its parameter
+	learning stage in the same TBB task scheduler, so the worker threads are shared by the loci of all running jobs:
+	threads that run out of loci of their own job help with the loci of others. Each job writes the same output files as
+	a single-alignment run would, named after the alignment id.
+
+	@param begin_locus, end_locus The range of loci to analyze in each job, as given on the command line (end_locus < 0 means "all").
+	@return The number of jobs that failed.
+*/
+template< typename RealT, typename AlignmentStorageT, typename StateT=apegrunt::triallelic_state_t >
+std::size_t run_batch( const std::vector<Batch_job>& jobs, std::size_t n_concurrent, std::size_t begin_locus, int end_locus )
+{
+	std::mutex out_mutex; // job status lines are written in one piece
+	auto report = [&out_mutex]( std::ostream* out, const std::string& msg ) { if( out ) { std::lock_guard<std::mutex> lock( out_mutex ); *out << msg << std::flush; } };
+
+	std::atomic<std::size_t> n_failed(0);
+	std::atomic<std::size_t> n_done(0);
+
+	auto run_job = [&]( const Batch_job& job )
+	{
+		const auto start = std::chrono::steady_clock::now();
+		std::ostringstream job_name; job_name << "job " << job.line << " (\"" << job.alignment_filenames.front() << ( job.alignment_filenames.size() > 1 ? "\", \""+job.alignment_filenames.back() : std::string() ) << "\")";
+		try
+		{
+			// preprocess as a plain command line run would
+			std::vector< apegrunt::Alignment_ptr<StateT> > alignments;
+			auto alignment_filter = apegrunt::Alignment_filter( apegrunt::Alignment_filter::ParameterPolicy::AQUIRE_GLOBAL );
+			for( const auto& filename: job.alignment_filenames )
+			{
+				auto alignment = apegrunt::parse_Alignment< AlignmentStorageT >( filename );
+				if( !alignment ) { throw std::runtime_error( "could not get alignment from input file \""+filename+"\"" ); }
+				alignment = alignment_filter.template operator()<AlignmentStorageT>( alignment );
+				alignments.push_back( apegrunt::transform_alignment<StateT>( alignment ) );
+			}
+
+			const std::size_t end = end_locus < 0 ? alignments.front()->n_loci() : std::min( std::size_t(end_locus+1), alignments.front()->n_loci() );
+			std::vector<std::size_t> loci; loci.reserve( end > begin_locus ? end-begin_locus : 0 );
+			for( std::size_t i = begin_locus; i < end; ++i ) { loci.push_back(i); }
+
+			const bool success = run_plmDCA<RealT>( alignments, apegrunt::make_Loci_list( loci ) );
+			if( !success ) { throw std::runtime_error( interrupt::requested() ? "interrupted" : "plmDCA failed" ); }
+
+			const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now()-start ).count();
+			if( SuperDCA_options::verbose() )
+			{
+				std::ostringstream msg; msg << "SuperDCA: " << ++n_done << " / " << jobs.size() << " " << job_name.str() << ": " << alignments.front()->n_loci() << " loci in " << seconds << " seconds\n";
+				report( SuperDCA_options::get_out_stream(), msg.str() );
+			}
+		}
+		catch( std::exception& e )
+		{
+			++n_failed;
+			std::ostringstream msg; msg << "SuperDCA error: " << job_name.str() << ": " << e.what() << "\n";
+			report( SuperDCA_options::get_err_stream(), msg.str() );
+		}
+	};
+
+#ifndef SUPERDCA_NO_TBB
+	std::size_t next_job = 0;
+	tbb::parallel_pipeline( std::max( n_concurrent, std::size_t(1) ),
+		tbb::make_filter<void,const Batch_job*>( tbb::filter::serial_in_order,
+			[&]( tbb::flow_control& fc ) -> const Batch_job*
+			{
+				if( next_job == jobs.size() || interrupt::requested() ) { fc.stop(); return nullptr; }
+				return &jobs[next_job++];
+			} )
+		& tbb::make_filter<const Batch_job*,void>( tbb::filter::parallel, [&]( const Batch_job* job ) { run_job( *job ); } )
+	);
+#else
+	for( const auto& job: jobs ) { if( interrupt::requested() ) { break; } run_job( job ); }
+#endif // #ifndef SUPERDCA_NO_TBB
+
+	return n_failed.load();
+}
+
+} // namespace superdca
+
+#endif // SUPERDCA_BATCH_HPP
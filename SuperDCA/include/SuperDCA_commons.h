@@ -25,9 +25,13 @@
 #include <iostream> // for std::cin, std::istream, std::cout
 #include <fstream>
 #include <sstream>
+#include <mutex>
+#include <memory>
 
 #include "boost/filesystem/operations.hpp" // includes boost/filesystem/path.hpp
 
+#include "Compressed_output.hpp"
+
 namespace superdca {
 
 // Forward declaration; print msg to cout and exit with flag set to EXIT_SUCCESS if success.
@@ -43,41 +47,87 @@ void Exit(bool exit_flag, std::string msg = "");
 */
 bool readYesNoAnswer( std::istream *in = &std::cin, std::ostream *out = &std::cout );
 
+/** A file stream and its name. With compression, everything written to the stream is compressed on its way to
+	the file (see Parallel_compressing_streambuf); close() (or destruction) writes the last compressed blocks.
+*/
 template< typename StreamT >
 class stream_name_association
 {
 public:
 	template< typename StringT >
-	stream_name_association( StreamT&& s, const StringT& name )
-	: m_stream(std::move(s)), m_name(name) { }
+	stream_name_association( StreamT&& s, const StringT& name, const Output_compression& compression=Output_compression() )
+	: m_stream(std::move(s)), m_name(name)
+	{
+		if( compression.enabled() )
+		{
+			m_compressor.reset( new Parallel_compressing_streambuf( m_stream.rdbuf(), compression ) );
+			this->redirect_to( m_compressor.get() );
+		}
+	}
+
+	stream_name_association( stream_name_association&& other )
+	: m_stream( std::move(other.m_stream) ), m_name( std::move(other.m_name) ), m_compressor( std::move(other.m_compressor) )
+	{
+		// the moved stream writes to its own file buffer again
+		if( m_compressor ) { m_compressor->set_sink( m_stream.rdbuf() ); this->redirect_to( m_compressor.get() ); }
+	}
+
+	~stream_name_association() { if( m_compressor ) { this->close(); } }
 
 	StreamT* stream() { return &m_stream; }
 
 	const std::string& name() const { return m_name; }
 
-	void close() { m_stream.close(); }
+	void close()
+	{
+		if( m_compressor )
+		{
+			const bool compressed = m_compressor->finish();
+			this->redirect_to( m_stream.rdbuf() );
+			m_compressor.reset();
+			if( !compressed ) { m_stream.setstate( std::ios_base::badbit ); }
+		}
+		m_stream.close();
+	}
 
 private:
 	StreamT m_stream;
 	std::string m_name;
+	std::unique_ptr<Parallel_compressing_streambuf> m_compressor;
+
+	//> Make the stream write to 'buffer'; keeps the state of the stream
+	void redirect_to( std::streambuf* buffer )
+	{
+		const auto state = m_stream.rdstate();
+		static_cast< std::basic_ios<typename StreamT::char_type, typename StreamT::traits_type>& >( m_stream ).rdbuf( buffer );
+		m_stream.clear( state );
+	}
 };
 
+inline std::mutex& unique_ofstream_mutex() { static std::mutex mutex; return mutex; }
+
+/** Open a file named 'filename', or 'filename.1', 'filename.2', ... if that exists already. With compression, the
+	name ends with the extension of the compression method (e.g. 'filename.1.gz').
+*/
 template< typename StringT >
-stream_name_association<std::ofstream> get_unique_ofstream( StringT filename )
+stream_name_association<std::ofstream> get_unique_ofstream( StringT filename, const Output_compression& compression=Output_compression() )
 {
+	// concurrent jobs of a batch run may ask for the same name
+	std::lock_guard<std::mutex> lock( unique_ofstream_mutex() );
+
 	boost::filesystem::path filepath;
 
 	int index = 0;
 	do
 	{
 		std::ostringstream index_os; index_os << index;
-		filepath = std::string(filename) + ( index == 0 ? "" : "."+index_os.str() );
+		filepath = std::string(filename) + ( index == 0 ? "" : "."+index_os.str() ) + compression.extension();
 	}
 	while( boost::filesystem::exists( filepath ) && ++index );
 
 	std::ofstream outfile( filepath.c_str(), std::ios_base::binary );
 
-	return stream_name_association<std::ofstream>( std::move(outfile), filepath.c_str() );
+	return stream_name_association<std::ofstream>( std::move(outfile), filepath.c_str(), compression );
 }
 
 } // namespace superdca
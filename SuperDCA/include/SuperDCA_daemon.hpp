@@ -0,0 +1,308 @@
+/** @file SuperDCA_daemon.hpp
+	Daemon mode: serve plmDCA jobs on preprocessed alignments that are kept in memory.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_DAEMON_HPP
+#define SUPERDCA_DAEMON_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+#include <cstring> // for std::strncpy, std::strerror
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h> // for read, close, unlink
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h> // for chmod
+#include <sys/un.h>
+
+#include "boost/iostreams/stream.hpp"
+#include "boost/iostreams/device/file_descriptor.hpp"
+
+#include "apegrunt/Apegrunt.h"
+
+#include "SuperDCA_options.h"
+#include "plmDCA.hpp"
+
+namespace superdca {
+
+/** A job request.
+
+	A request consists of 'key=value' lines, terminated by an empty line (or by closing the connection for writing):
+
+	loci=<file>               target loci (a loci list file, as for --locilistfile); default: the loci of the daemon
+	samples=<file>            sample list (as for --samplelistfile); sequence weights are then recomputed
+	lambda-J=<value>          J matrix regularization factor; default: as given to the daemon
+	lambda-h=<value>          h vector regularization factor; default: as given to the daemon
+	gradient-threshold=<value>
+	output=<file>             write the coupling values to this file on the daemon host, instead of sending them back
+	shutdown                  stop the daemon
+
+	The reply consists of the coupling values (unless written to a file), followed by a single status line
+	that starts with '#': "# OK <seconds>" or "# ERROR <message>".
+*/
+struct Daemon_request
+{
+	std::string loci_file;
+	std::string samples_file;
+	std::string output_file;
+	double lambda_J;
+	double lambda_h;
+	double gradient_threshold;
+	bool shutdown;
+
+	Daemon_request() : lambda_J( plmDCA_options::lambda_J() ), lambda_h( plmDCA_options::lambda_h() ), gradient_threshold( plmDCA_options::gradient_threshold() ), shutdown(false) { }
+
+	static Daemon_request parse( const std::string& text )
+	{
+		Daemon_request request;
+		std::istringstream lines( text );
+		std::string line;
+		while( std::getline( lines, line ) )
+		{
+			if( !line.empty() && line.back() == '\r' ) { line.pop_back(); }
+			if( line.empty() ) { break; }
+			const auto pos = line.find('=');
+			const std::string key = line.substr( 0, pos );
+			const std::string value = pos == std::string::npos ? std::string() : line.substr( pos+1 );
+
+			if( key == "shutdown" ) { request.shutdown = true; }
+			else if( key == "loci" ) { request.loci_file = value; }
+			else if( key == "samples" ) { request.samples_file = value; }
+			else if( key == "output" ) { request.output_file = value; }
+			else if( key == "lambda-J" ) { request.lambda_J = to_double( key, value ); }
+			else if( key == "lambda-h" ) { request.lambda_h = to_double( key, value ); }
+			else if( key == "gradient-threshold" ) { request.gradient_threshold = to_double( key, value ); }
+			else { throw std::invalid_argument( "unknown request key \""+key+"\"" ); }
+		}
+		return request;
+	}
+
+private:
+	static double to_double( const std::string& key, const std::string& value )
+	{
+		std::istringstream value_stream( value );
+		double x = 0.0;
+		if( !(value_stream >> x) || !(value_stream >> std::ws).eof() ) { throw std::invalid_argument( "invalid value \""+value+"\" for \""+key+"\"" ); }
+		return x;
+	}
+};
+
+//> A listening UNIX domain socket; the socket file is removed when the server goes away.
+class Unix_socket_server
+{
+public:
+	explicit Unix_socket_server( const std::string& path ) : m_path( path ), m_fd(-1)
+	{
+		sockaddr_un address; std::memset( &address, 0, sizeof(address) );
+		address.sun_family = AF_UNIX;
+		if( path.size() >= sizeof(address.sun_path) ) { throw std::runtime_error( "socket path \""+path+"\" is too long" ); }
+		std::strncpy( address.sun_path, path.c_str(), sizeof(address.sun_path)-1 );
+
+		m_fd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+		if( m_fd < 0 ) { throw std::runtime_error( "could not create socket: "+std::string( std::strerror(errno) ) ); }
+
+		::unlink( path.c_str() ); // remove a stale socket file of an earlier daemon
+		if( ::bind( m_fd, reinterpret_cast<sockaddr*>( &address ), sizeof(address) ) != 0 || ::listen( m_fd, 8 ) != 0 )
+		{
+			const std::string error( std::strerror(errno) );
+			::close( m_fd );
+			throw std::runtime_error( "could not listen on socket \""+path+"\": "+error );
+		}
+		::chmod( path.c_str(), S_IRUSR | S_IWUSR ); // only the owner may submit jobs
+	}
+	~Unix_socket_server() { ::close( m_fd ); ::unlink( m_path.c_str() ); }
+
+	const std::string& path() const { return m_path; }
+
+	//> Wait up to 'timeout_ms' milliseconds for a connection; returns the connected socket, or -1 on timeout.
+	int accept( int timeout_ms )
+	{
+		pollfd p{ m_fd, POLLIN, 0 };
+		if( ::poll( &p, 1, timeout_ms ) <= 0 ) { return -1; }
+		return ::accept( m_fd, nullptr, nullptr );
+	}
+
+private:
+	const std::string m_path;
+	int m_fd;
+};
+
+//> Read a request from 'fd', up to an empty line or the end of the stream
+inline std::string read_request( int fd )
+{
+	std::string text;
+	char buffer[4096];
+	while( text.find("\n\n") == std::string::npos && text.find("\r\n\r\n") == std::string::npos && text.size() < (1<<20) )
+	{
+		const auto n = ::read( fd, buffer, sizeof(buffer) );
+		if( n < 0 && errno == EINTR ) { continue; }
+		if( n <= 0 ) { break; }
+		text.append( buffer, n );
+	}
+	return text;
+}
+
+/** Serve jobs on the UNIX domain socket 'socket_path' until a shutdown request or SIGTERM/SIGINT.
+
+	Parsing, filtering and conversion of the input alignments is done once, before the daemon starts; the alignments
+	(along with their block accounting) and sequence weights stay in memory, such that each job only pays for the
+	parameter learning stage. Jobs are run one at a time, each with all threads of the process.
+
+	@param alignments The preprocessed input alignments, as read from file.
+	@param fourstate_alignments 'alignments' transformed into the state type used by plmDCA.
+	@param default_loci The target loci of jobs that do not specify loci of their own.
+*/
+template< typename RealT, typename AlignmentStorageT, typename DefaultStateT, typename StateT >
+bool serve( const std::string& socket_path,
+	const std::vector< apegrunt::Alignment_ptr<DefaultStateT> >& alignments,
+	const std::vector< apegrunt::Alignment_ptr<StateT> >& fourstate_alignments,
+	apegrunt::Loci_ptr default_loci )
+{
+	std::unique_ptr<Unix_socket_server> server;
+	try
+	{
+		server.reset( new Unix_socket_server( socket_path ) );
+	}
+	catch( std::exception& e )
+	{
+		*SuperDCA_options::get_err_stream() << "SuperDCA error: " << e.what() << "\n";
+		return false;
+	}
+	std::signal( SIGPIPE, SIG_IGN ); // a client that goes away must not take the daemon down with it
+	interrupt::install_handlers();
+
+	if( SuperDCA_options::verbose() )
+	{
+		*SuperDCA_options::get_out_stream() << "SuperDCA: serving jobs on socket \"" << server->path() << "\"\n" << std::endl;
+	}
+
+	// sequence weights of the resident alignments, computed by the first job that needs them
+	std::shared_ptr< std::vector<RealT> > resident_weights;
+	const double default_lambda_J = plmDCA_options::lambda_J();
+	const double default_lambda_h = plmDCA_options::lambda_h();
+	const double default_gradient_threshold = plmDCA_options::gradient_threshold();
+	const bool default_norm_of_mean_scoring = plmDCA_options::norm_of_mean_scoring();
+
+	std::size_t n_jobs = 0;
+	bool shutdown = false;
+	while( !shutdown && !interrupt::requested() )
+	{
+		const int connection = server->accept( 1000 );
+		if( connection < 0 ) { continue; }
+
+		namespace io = boost::iostreams;
+		io::stream<io::file_descriptor_sink> reply( connection, io::never_close_handle );
+		const auto start = std::chrono::steady_clock::now();
+		try
+		{
+			const auto request = Daemon_request::parse( read_request( connection ) );
+			if( request.shutdown )
+			{
+				shutdown = true;
+				reply << "# OK shutting down" << std::endl;
+				::close( connection );
+				continue;
+			}
+			++n_jobs;
+
+			auto job_alignments = fourstate_alignments;
+			auto weights = resident_weights;
+			if( !request.samples_file.empty() )
+			{
+				auto sample_list = apegrunt::parse_Loci_list( request.samples_file, apegrunt::Apegrunt_options::get_input_indexing_base() );
+				if( !sample_list ) { throw std::runtime_error( "could not read sample list \""+request.samples_file+"\"" ); }
+				auto selected = apegrunt::Alignment_factory< AlignmentStorageT >().copy_selected( alignments.front(), sample_list, sample_list->id_string() );
+				job_alignments.front() = apegrunt::transform_alignment<StateT>( selected );
+				weights.reset(); // weights of a sample subset differ from those of the resident alignment
+			}
+			else if( !weights && plmDCA_options::reweight() )
+			{
+				resident_weights = std::make_shared< std::vector<RealT> >( calculate_weights<StateT,RealT>( job_alignments.back() ) );
+				weights = resident_weights;
+			}
+
+			auto loci = default_loci;
+			if( !request.loci_file.empty() )
+			{
+				loci = apegrunt::parse_Loci_list( request.loci_file, apegrunt::Apegrunt_options::get_input_indexing_base() );
+				if( !loci ) { throw std::runtime_error( "could not read loci list \""+request.loci_file+"\"" ); }
+			}
+
+			std::ofstream output_file;
+			if( !request.output_file.empty() )
+			{
+				output_file.open( request.output_file, std::ios_base::binary );
+				if( !output_file.is_open() ) { throw std::runtime_error( "could not open output file \""+request.output_file+"\"" ); }
+			}
+
+			if( SuperDCA_options::verbose() )
+			{
+				*SuperDCA_options::get_out_stream() << "SuperDCA: job " << n_jobs << ": " << loci->size() << " loci" << ( request.samples_file.empty() ? "" : ", samples from \""+request.samples_file+"\"" ) << "\n";
+			}
+
+			plmDCA_options::set_lambda_J( request.lambda_J );
+			plmDCA_options::set_lambda_h( request.lambda_h );
+			plmDCA_options::set_gradient_threshold( request.gradient_threshold );
+			plmDCA_options::set_couplings_stream( request.output_file.empty() ? static_cast<std::ostream*>( &reply ) : &output_file );
+
+			const bool success = run_plmDCA<RealT>( job_alignments, loci, weights );
+
+			plmDCA_options::set_couplings_stream( nullptr );
+			plmDCA_options::set_lambda_J( default_lambda_J );
+			plmDCA_options::set_lambda_h( default_lambda_h );
+			plmDCA_options::set_gradient_threshold( default_gradient_threshold );
+			plmDCA_options::set_norm_of_mean_scoring( default_norm_of_mean_scoring ); // the memory planner may have switched scoring mode for this job
+
+			if( !success ) { throw std::runtime_error( "plmDCA failed" ); }
+			reply << "# OK " << std::chrono::duration<double>( std::chrono::steady_clock::now()-start ).count() << std::endl;
+		}
+		catch( std::exception& e )
+		{
+			plmDCA_options::set_couplings_stream( nullptr );
+			plmDCA_options::set_lambda_J( default_lambda_J );
+			plmDCA_options::set_lambda_h( default_lambda_h );
+			plmDCA_options::set_gradient_threshold( default_gradient_threshold );
+			plmDCA_options::set_norm_of_mean_scoring( default_norm_of_mean_scoring );
+
+			reply << "# ERROR " << e.what() << std::endl;
+			*SuperDCA_options::get_err_stream() << "SuperDCA error: job " << n_jobs << ": " << e.what() << "\n";
+		}
+		reply.flush();
+		::close( connection );
+	}
+
+	if( SuperDCA_options::verbose() )
+	{
+		*SuperDCA_options::get_out_stream() << "SuperDCA: daemon stopped after " << n_jobs << " jobs\n";
+	}
+	return true;
+}
+
+} // namespace superdca
+
+#endif // SUPERDCA_DAEMON_HPP
@@ -58,6 +58,8 @@ public:
 	static bool output_filtered_alignment();
 	static bool output_filterlist_alignment();
 	static bool output_samplelist_alignment();
+	//> Compression of the text output files (alignments, loci lists, weights and couplings)
+	static Output_compression output_compression();
 	//static bool translate_output_alignment();
 	//static bool force_translation();
 	//static bool complementary_read();
@@ -65,6 +67,13 @@ public:
 	bool has_locilist_filename() const;
 	const std::string& get_locilist_filename() const;
 
+	bool has_batch_filename() const;
+	const std::string& get_batch_filename() const;
+	static int batch_jobs();
+
+	bool has_serve_socket() const;
+	const std::string& get_serve_socket() const;
+
 	static void set_out_stream( std::ostream* out );
 	static void set_err_stream( std::ostream* err );
 	//> Set an ostream. An invalid ostream* (as in "out->good() == false", will reset internal ostream ("ostream* == null_ptr").
@@ -97,10 +106,13 @@ private:
 	static int s_threads;
 	static int s_nodes;
 	static bool s_use_cuda;
+	static int s_batch_jobs;
 	static bool	s_output_SNPs;
 	static bool s_output_filtered_alignment;
 	static bool	s_output_filterlist_alignment;
 	static bool	s_output_samplelist_alignment;
+	static std::string s_compress_output;
+	static int s_compression_level;
 	//static bool s_translate_output_alignment;
 	//static bool s_force_translation;
 	//static bool s_complementary_read;
@@ -109,6 +121,8 @@ private:
 	std::string m_filterlist_file_name;
 	std::string m_locilist_file_name;
 	std::string m_samplelist_file_name;
+	std::string m_batch_file_name;
+	std::string m_serve_socket_name;
 
 	static const std::string s_title_string;
 	static const std::string s_usage_string;
@@ -122,10 +136,13 @@ private:
 	static void s_init_threads( const int& nthreads );
 	static void s_init_nodes( const int& nnodes );
 	static void s_init_use_cuda( const bool& use_cuda );
+	static void s_init_batch_jobs( const int& njobs );
 	static void s_init_output_SNPs( const bool& flag );
 	static void s_init_output_filtered_alignment( const bool& flag );
 	static void s_init_output_filterlist_alignment( const bool& flag );
 	static void s_init_output_samplelist_alignment( const bool& flag );
+	static void s_init_compress_output( const std::string& method );
+	static void s_init_compression_level( const int& level );
 	//static void s_init_translate_output_alignment( const bool& flag );
 	//static void s_init_force_translation( const bool& flag );
 	//static void s_init_complementary_read( const bool& flag );
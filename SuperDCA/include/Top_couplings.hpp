@@ -0,0 +1,263 @@
+/** @file Top_couplings.hpp
+	Streaming retention of the best coupling scores of a run.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_TOP_COUPLINGS_HPP
+#define SUPERDCA_TOP_COUPLINGS_HPP
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cmath> // for std::nextafter
+#include <algorithm> // for std::sort, std::nth_element, std::min, std::max
+#include <functional> // for std::hash
+
+namespace superdca {
+
+/** Keeps the K best coupling scores of a run, without ever storing the score matrix.
+
+	Solver threads hand over each finished row with add_row(). Scores of complete pairs go to a bounded min-heap of
+	the K best scores so far; once the heap is full, its smallest score is a lower bound of the final K-th best score,
+	and it becomes the threshold below which new scores are discarded right away. The threshold only ever rises.
+
+	In symmetric mode the score of pair (i,j) is the average of J_ij and J_ji, which come from two different rows.
+	The first score of a pair to arrive waits in a hash map (split into independently locked shards) until the
+	other one arrives. The map holds at most 'max_pending' scores: first scores below an admission level are
+	dropped, and so are waiting scores once the level rises. The level is 'slack' times the threshold, raised
+	further to the median of the waiting scores of a shard whenever the shard runs out of room. A pair can be lost
+	only if one of its scores was dropped, so the result is exact in scan mode, and in symmetric mode every dropped
+	score is accounted for: exact_above() gives the score above which no pair can have been lost. In a typical run
+	the lost pairs are well below the K-th best score, and the result is exact.
+
+	Memory use is O(K) for the heap, O(L) per solver thread for the row being added, and O(max_pending) for the
+	waiting scores.
+*/
+class Top_couplings
+{
+public:
+	struct Coupling
+	{
+		float score;
+		uint32_t i, j; // zero-based loci; in symmetric mode 'i' comes after 'j' in column order
+	};
+
+	/**
+		@param k The number of couplings to keep.
+		@param cols Column loci, in the storage order of the rows given to add_row(); in symmetric mode these are also the row loci.
+		@param max_pending Symmetric mode only: the number of scores that may wait for the other score of their pair (0 = default_max_pending()).
+		@param slack Symmetric mode only: the first score of a pair waits for the other one if it is at least this fraction of the threshold.
+	*/
+	Top_couplings( std::size_t k, const std::vector<std::size_t>& cols, bool symmetric, std::size_t max_pending=0, float slack=0.75f, std::size_t n_shards=256 )
+	: m_k( std::max( k, std::size_t(1) ) ), m_cols( cols ), m_symmetric( symmetric ), m_slack( slack ),
+	  m_threshold( -std::numeric_limits<float>::infinity() ), m_admission( -std::numeric_limits<float>::infinity() ),
+	  m_shards( std::max( n_shards, std::size_t(1) ) ),
+	  m_shard_capacity( std::max( ( max_pending > 0 ? max_pending : default_max_pending( m_k, cols.size() ) )/m_shards.size(), std::size_t(MIN_SHARD_CAPACITY) ) ),
+	  m_row_added( symmetric ? cols.size() : 0 )
+	{
+		std::size_t max_locus = 0;
+		for( const auto n: m_cols ) { max_locus = std::max( max_locus, n+1 ); }
+		m_col_position.assign( max_locus, NOT_A_COLUMN );
+		for( std::size_t pos=0; pos < m_cols.size(); ++pos ) { m_col_position[ m_cols[pos] ] = pos; }
+		for( auto& shard: m_shards ) { shard.prune_at = std::min( shard.prune_at, m_shard_capacity ); }
+	}
+
+	/** Add the scores of row locus 'r', given in column order. May be called concurrently for different rows; each row must be added only once.
+		In symmetric mode the diagonal element is ignored.
+	*/
+	void add_row( std::size_t r, const float* scores )
+	{
+		const float threshold = m_threshold.load( std::memory_order_relaxed );
+		std::vector<Coupling> completed;
+
+		if( !m_symmetric )
+		{
+			for( std::size_t pj=0; pj < m_cols.size(); ++pj )
+			{
+				if( scores[pj] >= threshold ) { completed.push_back( Coupling{ scores[pj], uint32_t(r), uint32_t(m_cols[pj]) } ); }
+			}
+		}
+		else
+		{
+			const float admission = this->admission_level();
+			const uint64_t pr = m_col_position[r];
+			for( std::size_t pj=0; pj < m_cols.size(); ++pj )
+			{
+				if( pj == pr ) { continue; }
+				const uint64_t key = pj < pr ? ( pr << 32 | pj ) : ( uint64_t(pj) << 32 | pr );
+				auto& shard = m_shards[ std::hash<uint64_t>()( key ) % m_shards.size() ];
+				std::lock_guard<std::mutex> lock( shard.mutex );
+				const auto pending = shard.scores.find( key );
+				if( pending != shard.scores.end() )
+				{
+					// the other score of the pair is already here
+					const float score = ( pending->second + scores[pj] )*0.5f;
+					shard.scores.erase( pending );
+					if( score >= threshold ) { completed.push_back( Coupling{ score, uint32_t( m_cols[key >> 32] ), uint32_t( m_cols[key & 0xFFFFFFFF] ) } ); }
+				}
+				else if( m_row_added[pj].load( std::memory_order_acquire ) )
+				{
+					// the other row is done, and its score of the pair was dropped
+					shard.orphan_max = std::max( shard.orphan_max, scores[pj] );
+				}
+				else if( scores[pj] >= admission )
+				{
+					shard.scores.emplace( key, scores[pj] );
+					if( shard.scores.size() > shard.prune_at ) { this->prune( shard ); }
+				}
+				else { shard.dropped_max = std::max( shard.dropped_max, scores[pj] ); }
+			}
+			m_row_added[pr].store( true, std::memory_order_release );
+		}
+
+		if( completed.empty() ) { return; }
+		std::lock_guard<std::mutex> lock( m_best_mutex );
+		for( const auto& coupling: completed )
+		{
+			if( m_best.size() < m_k ) { m_best.push( coupling ); }
+			else if( coupling.score > m_best.top().score ) { m_best.pop(); m_best.push( coupling ); }
+		}
+		if( m_best.size() == m_k ) { m_threshold.store( m_best.top().score, std::memory_order_relaxed ); }
+	}
+
+	//> Scores below the threshold cannot make it to the K best
+	float threshold() const { return m_threshold.load( std::memory_order_relaxed ); }
+
+	//> The number of scores that are waiting for the other score of their pair
+	std::size_t n_pending() const
+	{
+		std::size_t n = 0;
+		for( auto& shard: m_shards ) { std::lock_guard<std::mutex> lock( shard.mutex ); n += shard.scores.size(); }
+		return n;
+	}
+
+	/** No pair that was lost, because one of its scores was dropped, can score more than this; -inf if no score was dropped.
+		The retained couplings are the exact K best if this is below threshold(). Call once all rows have been added.
+	*/
+	float exact_above() const
+	{
+		float dropped = -std::numeric_limits<float>::infinity(), orphan = dropped;
+		for( auto& shard: m_shards )
+		{
+			std::lock_guard<std::mutex> lock( shard.mutex );
+			dropped = std::max( dropped, shard.dropped_max );
+			orphan = std::max( orphan, shard.orphan_max );
+			for( const auto& pending: shard.scores ) { if( this->is_orphan( pending.first ) ) { orphan = std::max( orphan, pending.second ); } }
+		}
+		if( dropped == -std::numeric_limits<float>::infinity() ) { return dropped; }
+		return std::max( dropped, ( orphan+dropped )*0.5f ); // a lost pair has lost one score, or both
+	}
+
+	//> The default capacity for scores that wait for the other score of their pair
+	static std::size_t default_max_pending( std::size_t k, std::size_t n_cols ) { return 4*( k+n_cols ); }
+
+	//> Approximate memory use of one waiting score, hash map node included
+	static constexpr std::size_t pending_bytes() { return sizeof(uint64_t)+sizeof(float)+2*sizeof(void*); }
+
+	//> The retained couplings, best first
+	std::vector<Coupling> best() const
+	{
+		std::lock_guard<std::mutex> lock( m_best_mutex );
+		auto heap = m_best;
+		std::vector<Coupling> couplings; couplings.reserve( heap.size() );
+		while( !heap.empty() ) { couplings.push_back( heap.top() ); heap.pop(); }
+		std::reverse( couplings.begin(), couplings.end() );
+		return couplings;
+	}
+
+private:
+	enum : std::size_t { NOT_A_COLUMN=std::size_t(-1), MIN_PRUNE_SIZE=1024, MIN_SHARD_CAPACITY=64 };
+
+	struct Worse { bool operator()( const Coupling& a, const Coupling& b ) const { return a.score > b.score; } };
+
+	struct Shard
+	{
+		Shard() : prune_at( MIN_PRUNE_SIZE ), dropped_max( -std::numeric_limits<float>::infinity() ), orphan_max( -std::numeric_limits<float>::infinity() ) { }
+		mutable std::mutex mutex;
+		std::unordered_map<uint64_t,float> scores; // first score of a pair, keyed by its column positions (higher << 32 | lower)
+		std::size_t prune_at;
+		float dropped_max; // the largest score that was dropped
+		float orphan_max; // the largest score whose pair lost its other score
+	};
+
+	const std::size_t m_k;
+	const std::vector<std::size_t> m_cols;
+	const bool m_symmetric;
+	const float m_slack;
+	std::vector<std::size_t> m_col_position;
+
+	std::atomic<float> m_threshold;
+	std::atomic<float> m_admission; // raised when a shard runs out of room; only ever rises
+	mutable std::mutex m_best_mutex;
+	std::priority_queue< Coupling, std::vector<Coupling>, Worse > m_best; // smallest retained score on top
+
+	std::vector<Shard> m_shards;
+	const std::size_t m_shard_capacity;
+	std::vector< std::atomic<bool> > m_row_added; // symmetric mode: rows that have been added, by column position
+
+	//> First scores of pairs below this level are dropped; the level only ever rises
+	inline float admission_level() const
+	{
+		return std::max( m_slack*m_threshold.load( std::memory_order_relaxed ), m_admission.load( std::memory_order_relaxed ) );
+	}
+
+	//> Whether both rows of the pair of a waiting score have been added, i.e. the other score was dropped
+	inline bool is_orphan( uint64_t key ) const
+	{
+		return m_row_added[ key >> 32 ].load( std::memory_order_acquire ) && m_row_added[ key & 0xFFFFFFFF ].load( std::memory_order_acquire );
+	}
+
+	//> Drop the waiting scores of the shard that are below the admission level, or whose pair lost its other score; called with the shard locked
+	void prune( Shard& shard )
+	{
+		this->drop_below( shard, this->admission_level() );
+		if( shard.scores.size() > m_shard_capacity )
+		{
+			// out of room: raise the admission level just above the median of the waiting scores
+			std::vector<float> waiting; waiting.reserve( shard.scores.size() );
+			for( const auto& pending: shard.scores ) { waiting.push_back( pending.second ); }
+			const auto median = waiting.begin()+waiting.size()/2;
+			std::nth_element( waiting.begin(), median, waiting.end() );
+			const float level = std::nextafter( *median, std::numeric_limits<float>::infinity() );
+			float admission = m_admission.load( std::memory_order_relaxed );
+			while( admission < level && !m_admission.compare_exchange_weak( admission, level, std::memory_order_relaxed ) ) { }
+			this->drop_below( shard, this->admission_level() );
+		}
+		shard.prune_at = std::min( std::max( 2*shard.scores.size(), std::size_t(MIN_PRUNE_SIZE) ), m_shard_capacity );
+	}
+
+	void drop_below( Shard& shard, float level )
+	{
+		for( auto pending = shard.scores.begin(); pending != shard.scores.end(); )
+		{
+			if( this->is_orphan( pending->first ) ) { shard.orphan_max = std::max( shard.orphan_max, pending->second ); }
+			else if( pending->second < level ) { shard.dropped_max = std::max( shard.dropped_max, pending->second ); }
+			else { ++pending; continue; }
+			pending = shard.scores.erase( pending );
+		}
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_TOP_COUPLINGS_HPP
@@ -24,13 +24,20 @@
 
 #include <numeric> // for std::accumulate
 #include <memory> // for std::shared_ptr and std::make_shared
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <cmath> // for std::pow, std::sqrt
+#include <algorithm> // for std::copy, std::min, std::max
 
 #ifndef SUPERDCA_NO_TBB // Threading with Threading Building Blocks
 #pragma message("Compiling with TBB support")
 //#include "tbb/tbb.h"
 #include "tbb/parallel_reduce.h"
-//#include "tbb/parallel_for.h"
+#include "tbb/parallel_for.h"
 #include "tbb/blocked_range.h" // should be included by parallel_for.h
+#include "tbb/partitioner.h"
+#include "tbb/task_scheduler_init.h"
 //#include "tbb/mutex.h"
 #endif // SUPERDCA_NO_TBB
 
@@ -45,7 +52,24 @@
 
 #include "Stopwatch.hpp"
 #include "Matrix_math.hpp"
+#include "Ising_gauge_kernel.hpp"
 #include "plmDCA_utility.hpp"
+#include "plmDCA_scheduling.hpp"
+#include "plmDCA_numa.hpp"
+#include "Coupling_partial_file.hpp"
+#include "Coupling_pool.hpp"
+#include "Coupling_checkpoint.hpp"
+#include "Coupling_writer.hpp"
+#include "Coupling_binary_file.hpp"
+#include "Coupling_text_file.hpp"
+#include "Coupling_sorter.hpp"
+#include "Coupling_filter.hpp"
+#include "Top_couplings.hpp"
+#include "Parameter_store.hpp"
+#include "plmDCA_progress.hpp"
+#include "plmDCA_memory_plan.hpp"
+#include "Score_precision.hpp"
+#include "plmDCA_mpi.hpp"
 #include "SuperDCA_commons.h"
 
 namespace superdca {
@@ -62,13 +86,56 @@ struct OptimizerHistory
 		// reserve space for optimizer statistics log
 		fval_history.resize(history_size);
 		nfeval_history.resize(history_size);
+		iterations_history.resize(history_size);
+		gnorm_history.resize(history_size);
+		seconds_history.resize(history_size);
 	}
 
 	std::vector<real_t> fval_history;
 	std::vector<std::size_t> nfeval_history;
+	std::vector<std::size_t> iterations_history;
+	std::vector<real_t> gnorm_history;
+	std::vector<double> seconds_history; // wall time per locus
 
+	// Write statistics of the loci in 'loci' in a format that can be read back by read_locus_costs(); the header records the indexing base of the loci
+	void write( std::ostream* out, apegrunt::Loci_ptr loci, std::shared_ptr< std::vector<std::size_t> > index_translation, std::size_t base_index ) const
+	{
+		*out << "# locus fval nfeval base_index=" << base_index << "\n" << std::scientific;
+		out->precision(8);
+		for( const auto r: loci )
+		{
+			*out << (*index_translation)[r]+base_index << " " << fval_history[r] << " " << nfeval_history[r] << "\n";
+		}
+	}
 };
 
+/** Storage of the coupling parameters (norm-of-mean scoring) or coupling scores (mean-of-norms scoring) of
+	a set of row loci against a set of column loci.
+
+	Loci are translated to dense storage positions through lookup tables indexed by locus, and the columns of
+	each row are stored contiguously in the order of the column loci, such that a row can be written (and read)
+	as one span.
+
+	Symmetric mean-of-norms runs (the same loci as rows and columns) only need the average of the scores of (i,j)
+	and (j,i), so only one triangle is stored: each row adds half of its scores to the shared pair elements, and
+	the pair holds the average once both of its rows are stored. Rows cannot be read back in this mode.
+
+	Mean-of-norms scores can be kept in 16 bits (--score-precision fp16 or bf16); they are converted from and to
+	float when they are stored and read.
+
+	Out-of-core storage keeps the mean-of-norms scores in a memory-mapped scratch file (see Coupling_pool) instead.
+	Each row then starts on a page boundary and is written in one sequential pass by the thread that solved it,
+	after which its pages are written back and dropped from memory. Out-of-core storage is never triangular, since
+	pair elements would scatter the writes of every row over the whole file; symmetric scores are read back tile by
+	tile with for_each_symmetric_score() instead.
+
+	Norm-of-mean scoring needs the q-by-q matrices of both (i,j) and (j,i), but only until both rows are solved. The
+	gauge-fixed matrix of the first row of a pair waits in a hash map (split into independently locked shards; see
+	store_matrix_row()), and when the second row arrives, the norm of the mean of both and the norms of each are
+	computed right away and kept as one triangular element, and the waiting matrix is dropped. In scan runs every
+	matrix is reduced to its norm right away. Waiting matrices are kept without the excluded (gap) state, which
+	norms ignore anyway.
+*/
 template< typename RealT, uint States >
 class CouplingStorage
 {
@@ -78,7 +145,6 @@ public:
 
 	using real_t = RealT;
 	using internal_real_t = float;
-	using allocator_t = typename apegrunt::memory::AlignedAllocator<internal_real_t>;
 
 	using raw_matrix_t = std::array< internal_real_t, Q*Q >;
 
@@ -87,106 +153,383 @@ public:
 
 	using matrix_view_array_t = Array_view< matrix_view_t >;
 
-	CouplingStorage() : m_dim1(0), m_dim2(0), m_has_dim1_mapping(false), m_has_dim2_mapping(false) { }
+	//> The norm-of-mean score of a symmetric pair (i,j), i after j: the norm of the mean of the gauge-fixed J_ij and J_ji, and the norms of J_ij and J_ji
+	struct Pair_norms { internal_real_t mean; internal_real_t ij; internal_real_t ji; };
+
+	//> A gauge-fixed coupling matrix without the row and column of the excluded state, row by row
+	using gauged_matrix_t = std::array< internal_real_t, (Q-1)*(Q-1) >;
+	using gauge_kernel_t = Ising_gauge_kernel< internal_real_t, Q >;
 
-	CouplingStorage( apegrunt::Loci_ptr dim1_loci, apegrunt::Loci_ptr dim2_loci )
+	enum : std::size_t { NOT_MAPPED=std::size_t(-1) };
+
+	CouplingStorage() : m_dim1(0), m_dim2(0), m_precision(Score_precision::FP32), m_row_pitch(0), m_pool_size(0), m_triangular(false), m_pair_completion(false), m_pending( 1 ) { }
+
+	/**
+		@param symmetric Set if the scores of (i,j) and (j,i) are only ever used as their average; enables triangular storage
+		in mean-of-norms mode, provided that the row and column loci are the same.
+		@param pool_file If not empty, keep mean-of-norms scores out-of-core, in a scratch file of this name.
+	*/
+	CouplingStorage( apegrunt::Loci_ptr dim1_loci, apegrunt::Loci_ptr dim2_loci, bool symmetric=false, const std::string& pool_file=std::string() )
 	: m_dim1(dim1_loci->size()),
-	  m_has_dim1_mapping(true),
 	  m_dim2(dim2_loci->size()),
-	  m_has_dim2_mapping(true)
+	  m_precision( parse_score_precision( plmDCA_options::score_precision() ) ),
+	  m_row_pitch( m_dim2 ),
+	  m_pool_size(0),
+	  m_triangular(false),
+	  m_pair_completion(false),
+	  m_pending( PENDING_SHARDS )
 	{
-	    const uint64_t pool_size = m_dim1*m_dim2;
-
+	    m_dim1_loci.reserve( m_dim1 );
+	    for( const auto locus: dim1_loci ) { m_dim1_loci.push_back( locus ); }
+	    m_dim2_loci.reserve( m_dim2 );
+	    for( const auto locus: dim2_loci ) { m_dim2_loci.push_back( locus ); }
+	    m_dim1_mapping = make_mapping( m_dim1_loci );
+	    m_dim2_mapping = make_mapping( m_dim2_loci );
+
+	    const bool out_of_core = !pool_file.empty() && !plmDCA_options::norm_of_mean_scoring();
+	    m_triangular = symmetric && !out_of_core && !plmDCA_options::norm_of_mean_scoring() && m_dim1_loci == m_dim2_loci;
+	    m_pair_completion = symmetric && plmDCA_options::norm_of_mean_scoring() && m_dim1_loci == m_dim2_loci;
+	    if( plmDCA_options::norm_of_mean_scoring() ) { m_precision = Score_precision::FP32; } // norms of scan runs are kept as they are
+	    if( out_of_core )
 	    {
-	    	std::size_t i=0;
-	    	for( const auto locus: dim1_loci ) { m_dim1_mapping[locus] = i; ++i; }
-	    }
-	    {
-	    	std::size_t j=0;
-	    	for( const auto locus: dim2_loci ) { m_dim2_mapping[locus] = j; ++j; }
+	    	// pad rows to whole pages, such that every row can be released on its own
+	    	const std::size_t page_scores = Coupling_pool::page_size()/score_bytes(m_precision);
+	    	m_row_pitch = ( m_dim2+page_scores-1 )/page_scores*page_scores;
 	    }
+	    const uint64_t pool_size = m_triangular || m_pair_completion ? triangular_pool_size( m_dim1 ) : m_dim1*m_row_pitch;
 
 		if( plmDCA_options::verbose() )
 		{
-			if( plmDCA_options::norm_of_mean_scoring() )
+			if( m_pair_completion )
 			{
 				*plmDCA_options::out_stream()
-					<< "plmDCA: computation will require approximately " << apegrunt::memory_string(pool_size*sizeof(raw_matrix_t)) << " of memory\n";
+					<< "plmDCA: computation will require approximately " << apegrunt::memory_string(pool_size*sizeof(Pair_norms)) << " of memory, plus up to "
+					<< apegrunt::memory_string( uint64_t(m_dim1/2)*(m_dim1-m_dim1/2)*pending_pair_bytes() ) << " for the matrices of pairs that wait for their second row\n";
+			}
+			else if( out_of_core )
+			{
+				*plmDCA_options::out_stream()
+					<< "plmDCA: keep " << apegrunt::memory_string(pool_size*score_bytes(m_precision)) << " of coupling scores out-of-core, in scratch file \"" << pool_file << "\"\n";
 			}
 			else
 			{
 				*plmDCA_options::out_stream()
-					<< "plmDCA: computation will require approximately " << apegrunt::memory_string(pool_size*sizeof(internal_real_t)) << " of memory\n";
+					<< "plmDCA: computation will require approximately " << apegrunt::memory_string(pool_size*score_bytes(m_precision)) << " of memory\n";
 			}
 		}
 
-		this->allocate( pool_size );
+		this->allocate( pool_size, out_of_core ? pool_file : std::string() );
+	}
+
+	inline std::size_t get_coupling_storage_size() const { return m_pair_completion ? m_pair_norms.size() : m_pool_size; }
+	inline bool is_triangular() const { return m_triangular; }
+	inline bool is_out_of_core() const { return m_pool.is_mapped(); }
+
+	//> The number of pair elements of a triangular store of 'n' loci
+	static uint64_t triangular_pool_size( uint64_t n ) { return n > 1 ? n*(n-1)/2 : 0; }
+
+	//> Approximate memory use of one matrix that waits for the second row of its pair, hash map node included
+	static constexpr uint64_t pending_pair_bytes() { return sizeof(Pending_matrix)+sizeof(uint64_t)+2*sizeof(void*); }
+
+	/** Re-target the rows of a rectangular, in-core store to 'loci', at most as many as the store was made for, e.g. to
+		the next batch of an MPI worker rank. The scores of the previous row loci are no longer accessible.
+	*/
+	void set_row_loci( const std::vector<std::size_t>& loci )
+	{
+		assert( !m_triangular && !m_pair_completion && !this->is_out_of_core() && loci.size() <= m_dim1 );
+		m_dim1_loci = loci;
+		m_dim1_mapping = make_mapping( m_dim1_loci );
+	}
+
+	inline bool has_row( std::size_t i ) const { return i < m_dim1_mapping.size() && m_dim1_mapping[i] != NOT_MAPPED; }
+	inline bool has_col( std::size_t j ) const { return j < m_dim2_mapping.size() && m_dim2_mapping[j] != NOT_MAPPED; }
+
+	//> Column loci in storage order; element j of a row belongs to column locus col_loci()[j]
+	inline const std::vector<std::size_t>& col_loci() const { return m_dim2_loci; }
+	inline const std::vector<std::size_t>& row_loci() const { return m_dim1_loci; }
+
+	//> A view to a row of coupling matrices, e.g. the buffer that a row is assembled in for store_matrix_row()
+	static matrix_view_array_t view( std::vector<raw_matrix_t>& matrices )
+	{
+		return matrix_view_array_t( matrices.empty() ? nullptr : matrices.front().data(), matrices.size() );
+	}
+
+	/** Store the coupling matrices of row locus 'i', given in storage order (norm-of-mean scoring). May be called concurrently for
+		different rows; each row must be stored only once.
+
+		@param exclude The state (gap) that norms leave out.
+	*/
+	void store_matrix_row( std::size_t i, std::vector<raw_matrix_t>& matrices, std::size_t exclude )
+	{
+		assert( exclude < Q && matrices.size() == m_dim2 );
+		// the whole row is gauge-fixed in one batch
+		std::vector<gauged_matrix_t> gauged( m_dim2 );
+		gauge_kernel_t::gauge( matrices.data(), m_dim2, exclude, gauged.data() );
+
+		if( !m_pair_completion )
+		{
+			// scan: every matrix is final
+			std::vector<internal_real_t> norms( m_dim2 );
+			gauge_kernel_t::norms( gauged.data(), m_dim2, norms.data() );
+			this->store_row( i, norms.data() );
+			return;
+		}
+
+		// pairs completed by this row; their norms are computed in one batch once the row has been matched
+		std::vector<gauged_matrix_t> Jij, Jji;
+		std::vector<std::size_t> completed;
+
+		const uint64_t pi = this->row_position(i);
+		for( std::size_t pj=0; pj < m_dim2; ++pj )
+		{
+			if( pj == pi ) { continue; }
+			const bool upper = pj < pi; // this row comes later in storage order, so this is the J_ij of pair (i,j)
+			const uint64_t key = upper ? ( pi << 32 | pj ) : ( uint64_t(pj) << 32 | pi );
+
+			auto& shard = m_pending[ std::hash<uint64_t>()( key ) % m_pending.size() ];
+			std::lock_guard<std::mutex> lock( shard.mutex );
+			const auto pending = shard.matrices.find( key );
+			if( pending == shard.matrices.end() ) { shard.matrices.emplace( key, Pending_matrix{ gauged[pj], upper } ); continue; }
+
+			// the pair is complete
+			Jij.push_back( upper ? gauged[pj] : pending->second.matrix );
+			Jji.push_back( upper ? pending->second.matrix : gauged[pj] );
+			completed.push_back( triangle_index( pi, pj ) );
+			shard.matrices.erase( pending );
+		}
+
+		std::vector<internal_real_t> mean( completed.size() ), ij( completed.size() ), ji( completed.size() );
+		gauge_kernel_t::pair_norms( Jij.data(), Jji.data(), completed.size(), mean.data(), ij.data(), ji.data() );
+		for( std::size_t n=0; n < completed.size(); ++n ) { m_pair_norms[ completed[n] ] = Pair_norms{ mean[n], ij[n], ji[n] }; }
+	}
+
+	//> The norm-of-mean score of symmetric pair (i,j), where 'i' comes after 'j' in storage order; both rows must have been stored.
+	inline const Pair_norms& get_pair_norms( std::size_t i, std::size_t j ) const
+	{
+		assert( m_pair_completion && this->row_position(i) > this->col_position(j) );
+		return m_pair_norms[ triangle_index( this->row_position(i), this->col_position(j) ) ];
+	}
+
+	//> The number of matrices that wait for the second row of their pair
+	std::size_t n_pending_pairs() const
+	{
+		std::size_t n = 0;
+		for( auto& shard: m_pending ) { std::lock_guard<std::mutex> lock( shard.mutex ); n += shard.matrices.size(); }
+		return n;
+	}
+
+	inline Score_precision precision() const { return m_precision; }
+
+	//> The score of (i,j), where 'i' and 'j' are zero-based loci; not available in triangular mode
+	inline internal_real_t get_score( std::size_t i, std::size_t j ) const
+	{
+		assert( !m_triangular );
+		return this->score_at( this->row_position(i)*m_row_pitch+this->col_position(j) );
+	}
+
+	//> Copy the scores of row locus 'i' to 'scores', in storage order; not available in triangular mode
+	void load_row( std::size_t i, internal_real_t* scores ) const
+	{
+		assert( !m_triangular );
+		this->load_span( this->row_position(i)*m_row_pitch, m_dim2, scores );
 	}
 
-	inline std::size_t get_matrix_storage_size() const { return matrix_storage.size(); }
-	inline std::size_t get_coupling_storage_size() const { return coupling_storage.size(); }
+	/** Store the scores of row locus 'i', given in storage order. May be called concurrently for different rows; each row must be stored only once.
 
-	inline matrix_view_array_t get_Ji_matrices( std::size_t i ) // zero-based locus index; returns a view to a row vector
+		In triangular mode, half of each score is added to the element of its pair. Scaling by 0.5 is exact and the two
+		additions (onto zero) commute, so the element ends up as (J_ij+J_ji)/2 no matter which row is stored first.
+		In 16-bit triangular mode, the first row of a pair stores its rounded score and the second one replaces it with
+		the rounded average of both rounded scores, which is likewise independent of the order.
+	*/
+	void store_row( std::size_t i, const internal_real_t* scores )
 	{
-		if( m_has_dim1_mapping )
+		const auto pi = this->row_position(i);
+		if( !m_triangular )
 		{
-			i = m_dim1_mapping[i];
+			const std::size_t begin = pi*m_row_pitch;
+			if( m_precision == Score_precision::FP32 ) { std::copy( scores, scores+m_dim2, this->scores()+begin ); }
+			else { auto half_scores = this->half_scores(); for( std::size_t pj=0; pj < m_dim2; ++pj ) { half_scores[begin+pj] = encode_score( m_precision, scores[pj] ); } }
+			m_pool.release( begin*score_bytes(m_precision), m_row_pitch*score_bytes(m_precision) ); // the row is not needed again before output
+			return;
+		}
+		for( std::size_t pj=0; pj < m_dim2; ++pj )
+		{
+			if( pj == pi ) { continue; }
+			const std::size_t index = triangle_index( pi, pj );
+			if( m_precision == Score_precision::FP32 )
+			{
+				auto& element = this->triangle()[index];
+				const internal_real_t half = internal_real_t(0.5)*scores[pj];
+				internal_real_t expected = element.load( std::memory_order_relaxed );
+				while( !element.compare_exchange_weak( expected, expected+half, std::memory_order_relaxed ) ) { } // the other row of the pair may be stored concurrently
+			}
+			else
+			{
+				auto& element = this->half_triangle()[index];
+				const internal_real_t rounded = decode_score( m_precision, encode_score( m_precision, scores[pj] ) );
+				uint16_t expected = element.load( std::memory_order_relaxed );
+				uint16_t desired;
+				do
+				{
+					desired = expected == EMPTY_HALF ? encode_score( m_precision, rounded ) : encode_score( m_precision, ( decode_score( m_precision, expected )+rounded )*internal_real_t(0.5) );
+				}
+				while( !element.compare_exchange_weak( expected, desired, std::memory_order_relaxed ) );
+			}
 		}
-		assert( i < m_dim1 );
-		return matrix_view_array_t( matrix_storage[i*(m_dim1-1)].data(), (m_dim2-1) );
 	}
 
-	inline matrix_view_t get_Jij_matrix( std::size_t i, std::size_t j ) // zero-based locus index
+	//> The symmetric score (J_ij+J_ji)/2 of loci 'i' and 'j'; both rows must have been stored.
+	inline internal_real_t get_symmetric_score( std::size_t i, std::size_t j ) const
 	{
-		if( m_has_dim1_mapping && m_has_dim2_mapping )
+		const auto pi = this->row_position(i);
+		const auto pj = this->col_position(j);
+		if( m_triangular )
 		{
-			i = m_dim1_mapping[i];
-			j = m_dim2_mapping[j];
+			const std::size_t index = triangle_index( pi, pj );
+			return m_precision == Score_precision::FP32 ? this->triangle()[index].load( std::memory_order_relaxed ) : decode_score( m_precision, this->half_triangle()[index].load( std::memory_order_relaxed ) );
 		}
-		assert(  i < m_dim1 && j < m_dim2 );
-		return this->get_Ji_matrices(i)[j]; //coupling_storage[i*(m_dim1-1)+j]; // we store diagonal elements, too, even though they might never be used.
+		return ( this->score_at( pi*m_row_pitch+pj ) + this->score_at( pj*m_row_pitch+pi ) )*internal_real_t(0.5);
 	}
 
-	inline internal_real_t& get_Jij_score( std::size_t i, std::size_t j ) // zero-based locus index
+	/** Visit the symmetric score of every pair of distinct row loci as visit( i, j, (J_ij+J_ji)/2 ), where 'i' comes after 'j'
+		in storage order. Not available in triangular mode; the row and column loci must be the same.
+
+		The score matrix is read in square tiles of 'tile' rows and columns, together with the transposed tile, such that
+		both scores of every pair are read from a handful of pages at a time rather than from a whole column of the file.
+	*/
+	template< typename VisitorT >
+	void for_each_symmetric_score( VisitorT&& visit, std::size_t tile=2048 ) const
 	{
-		if( m_has_dim1_mapping )
+		assert( !m_triangular && m_dim1_loci == m_dim2_loci );
+		tile = std::max( tile, std::size_t(1) );
+		std::vector<internal_real_t> block( tile*tile ), transposed( tile*tile );
+		for( std::size_t p0=0; p0 < m_dim1; p0 += tile )
 		{
-			i = m_dim1_mapping[i];
-			j = m_dim2_mapping[j];
+			const std::size_t p1 = std::min( p0+tile, m_dim1 );
+			m_pool.prefetch( p0*m_row_pitch*score_bytes(m_precision), (p1-p0)*m_row_pitch*score_bytes(m_precision) );
+			for( std::size_t q0=0; q0 <= p0; q0 += tile )
+			{
+				const std::size_t q1 = std::min( q0+tile, m_dim1 );
+				for( std::size_t p=p0; p < p1; ++p ) { this->load_span( p*m_row_pitch+q0, q1-q0, block.data()+(p-p0)*tile ); }
+				for( std::size_t q=q0; q < q1; ++q ) { this->load_span( q*m_row_pitch+p0, p1-p0, transposed.data()+(q-q0)*tile ); }
+				for( std::size_t p=p0; p < p1; ++p )
+				{
+					for( std::size_t q=q0; q < std::min( q1, p ); ++q )
+					{
+						visit( m_dim1_loci[p], m_dim1_loci[q], ( block[(p-p0)*tile+(q-q0)] + transposed[(q-q0)*tile+(p-p0)] )*internal_real_t(0.5) );
+					}
+				}
+			}
 		}
-		assert( i < m_dim1 && j < m_dim2 );
-		//return coupling_storage[i*(m_dim1-1)+j]; // we store diagonal elements, too, even though they might never be used.
-		return coupling_storage[i*m_dim1+j]; // we store diagonal elements, too, even though they might never be used.
 	}
 
 private:
-    std::vector< raw_matrix_t > matrix_storage;
-    std::vector< internal_real_t, allocator_t > coupling_storage;
     std::size_t m_dim1;
     std::size_t m_dim2;
+    Score_precision m_precision;
+    std::size_t m_row_pitch; // scores from the start of one row to the next; m_dim2, or more in out-of-core mode
 
-    using loci_mapping_t = std::map<std::size_t,std::size_t>;
+    using loci_mapping_t = std::vector<std::size_t>; // storage position of each locus; NOT_MAPPED if the locus is not stored
 
-    bool m_has_dim1_mapping;
+    std::vector<std::size_t> m_dim1_loci;
+    std::vector<std::size_t> m_dim2_loci;
     loci_mapping_t m_dim1_mapping;
-    bool m_has_dim2_mapping;
     loci_mapping_t m_dim2_mapping;
 
-	bool allocate( std::size_t pool_size )
+    Coupling_pool m_pool; // mean-of-norms scores: rows of m_row_pitch scores, or pair elements (i,j), i > j, row by row in triangular mode
+    std::size_t m_pool_size; // in scores
+    bool m_triangular;
+
+    enum : uint16_t { EMPTY_HALF=0xFFFF }; // a nan in both fp16 and bf16; marks pair elements that no row has been stored to yet
+
+    // norm-of-mean scoring of symmetric runs
+    struct Pending_matrix
+    {
+    	gauged_matrix_t matrix;
+    	bool upper; // J_ij of pair (i,j), i after j; else J_ji
+    };
+    struct Pending_shard
+    {
+    	mutable std::mutex mutex;
+    	std::unordered_map<uint64_t,Pending_matrix> matrices; // keyed by the storage positions of the pair (later << 32 | earlier)
+    };
+    enum : std::size_t { PENDING_SHARDS=256 };
+
+    bool m_pair_completion;
+    std::vector<Pair_norms> m_pair_norms; // one element per pair, row by row as in triangular mode
+    std::vector<Pending_shard> m_pending;
+
+    static_assert( sizeof(std::atomic<internal_real_t>) == sizeof(internal_real_t) && sizeof(std::atomic<uint16_t>) == sizeof(uint16_t), "triangular storage needs lock-free atomics without overhead" );
+
+    inline internal_real_t* scores() { return reinterpret_cast<internal_real_t*>( m_pool.data() ); }
+    inline const internal_real_t* scores() const { return reinterpret_cast<const internal_real_t*>( m_pool.data() ); }
+    inline uint16_t* half_scores() { return reinterpret_cast<uint16_t*>( m_pool.data() ); }
+    inline const uint16_t* half_scores() const { return reinterpret_cast<const uint16_t*>( m_pool.data() ); }
+    inline std::atomic<internal_real_t>* triangle() const { return reinterpret_cast<std::atomic<internal_real_t>*>( const_cast<char*>( m_pool.data() ) ); }
+    inline std::atomic<uint16_t>* half_triangle() const { return reinterpret_cast<std::atomic<uint16_t>*>( const_cast<char*>( m_pool.data() ) ); }
+
+    inline internal_real_t score_at( std::size_t index ) const
+    {
+    	return m_precision == Score_precision::FP32 ? this->scores()[index] : decode_score( m_precision, this->half_scores()[index] );
+    }
+
+    inline void load_span( std::size_t begin, std::size_t n, internal_real_t* out ) const
+    {
+    	if( m_precision == Score_precision::FP32 ) { std::copy( this->scores()+begin, this->scores()+begin+n, out ); return; }
+    	const auto half_scores = this->half_scores();
+    	for( std::size_t k=0; k < n; ++k ) { out[k] = decode_score( m_precision, half_scores[begin+k] ); }
+    }
+
+    static inline std::size_t triangle_index( std::size_t pi, std::size_t pj )
+    {
+    	const auto hi = std::max( pi, pj ); const auto lo = std::min( pi, pj );
+    	return hi*(hi-1)/2 + lo;
+    }
+
+    static loci_mapping_t make_mapping( const std::vector<std::size_t>& loci )
+    {
+    	std::size_t max_locus = 0;
+    	for( const auto locus: loci ) { max_locus = std::max( max_locus, locus+1 ); }
+    	loci_mapping_t mapping( max_locus, NOT_MAPPED );
+    	for( std::size_t pos=0; pos < loci.size(); ++pos ) { mapping[ loci[pos] ] = pos; }
+    	return mapping;
+    }
+
+    inline std::size_t row_position( std::size_t i ) const { assert( this->has_row(i) ); return m_dim1_mapping[i]; }
+    inline std::size_t col_position( std::size_t j ) const { assert( this->has_col(j) ); return m_dim2_mapping[j]; }
+
+	void allocate( std::size_t pool_size, const std::string& pool_file )
 	{
 		// Allocate matrix memory pool
 
 		try
 		{
-			if( plmDCA_options::norm_of_mean_scoring() )
+			if( m_pair_completion )
 			{
-				matrix_storage.resize( pool_size );
+				m_pair_norms.resize( pool_size );
+				return;
 			}
-			else
+			if( pool_file.empty() ) { m_pool.allocate( pool_size*score_bytes(m_precision) ); }
+			else { m_pool.map_file( pool_file, pool_size*score_bytes(m_precision) ); }
+			m_pool_size = pool_size;
+
+			if( m_triangular )
 			{
-				coupling_storage.resize( pool_size );
+				if( m_precision == Score_precision::FP32 )
+				{
+					for( std::size_t n=0; n < pool_size; ++n ) { new( this->triangle()+n ) std::atomic<internal_real_t>( 0 ); }
+				}
+				else
+				{
+					for( std::size_t n=0; n < pool_size; ++n ) { new( this->half_triangle()+n ) std::atomic<uint16_t>( EMPTY_HALF ); }
+				}
 			}
 		}
+		catch( std::exception& e )
+		{
+			*plmDCA_options::err_stream() << "plmDCA error: could not allocate the coupling storage pool: " << e.what() << "\n\n";
+			Exit(EXIT_FAILURE);
+		}
 		catch(...)
 		{
 			*plmDCA_options::err_stream() << "plmDCA error: Exception of unknown type!\n\n";
@@ -203,17 +546,23 @@ public:
 	using real_t = RealT;
 	using state_t = StateT;
     using plmDCA_optimizer_parameters_t = plmDCA_optimizer_parameters<real_t,state_t>;
+    using storage_t = CouplingStorage<real_t,apegrunt::number_of_states<state_t>::N>;
 
 	plmDCA_solver( std::vector< apegrunt::Alignment_ptr<state_t> > alignments, std::shared_ptr< std::vector<real_t> > weights, CouplingStorage<real_t,apegrunt::number_of_states<state_t>::N>& storage, OptimizerHistory<real_t>& log, std::size_t loci_slice )
     : m_optimizer_parameters( alignments, weights ),
 	  m_Jij_storage(storage),
 	  m_optimizer_log(log),
 	  m_optimizer_objective( m_optimizer_parameters ), // initialize objective
-	  m_cputimer( plmDCA_options::verbose() ? plmDCA_options::out_stream() : nullptr ),
 	  m_solution( m_optimizer_parameters.get_dimensions(), 0 ),
 	  m_loci_slice( loci_slice ),
 	  m_no_estimate( plmDCA_options::no_estimate() ),
-	  m_no_dca( plmDCA_options::no_dca() )
+	  m_no_dca( plmDCA_options::no_dca() ),
+	  m_checkpoint( nullptr ),
+	  m_coupling_writer( nullptr ),
+	  m_top_couplings( nullptr ),
+	  m_parameter_store( nullptr ),
+	  m_progress( nullptr ),
+	  m_locus_costs( nullptr )
 	{
 		auto control = cppoptlib::Criteria<real_t>();
 		control.iterations = 2000;
@@ -233,12 +582,17 @@ public:
 	  m_Jij_storage( other.m_Jij_storage ),
 	  m_optimizer_log( other.m_optimizer_log ),
 	  m_optimizer_objective( m_optimizer_parameters ), // initialize objective
-	  m_cputimer( other.m_cputimer ),
 	  m_solution( std::move( other.m_solution ) ), // each instance has its own private solution vector
 	  //m_optimizer( other.m_optimizer.criteria() ),
 	  m_loci_slice( std::move( other.m_loci_slice ) ),
 	  m_no_estimate( other.m_no_estimate ),
-	  m_no_dca( other.m_no_dca )
+	  m_no_dca( other.m_no_dca ),
+	  m_checkpoint( other.m_checkpoint ),
+	  m_coupling_writer( other.m_coupling_writer ),
+	  m_top_couplings( other.m_top_couplings ),
+	  m_parameter_store( other.m_parameter_store ),
+	  m_progress( other.m_progress ),
+	  m_locus_costs( other.m_locus_costs )
 	{
 		//m_optimizer.setStopCriteria( other.m_optimizer.criteria() );
 		auto control = cppoptlib::Criteria<real_t>();
@@ -254,12 +608,17 @@ public:
 	  m_Jij_storage( other.m_Jij_storage ),
 	  m_optimizer_log( other.m_optimizer_log ),
 	  m_optimizer_objective( m_optimizer_parameters ), // initialize objective
-	  m_cputimer( other.m_cputimer ),
 	  m_solution( other.m_solution.size(), 0 ), // each instance has its own private solution vector
 	  //m_optimizer( other.m_optimizer.criteria() ),
 	  m_loci_slice( other.m_loci_slice ),
 	  m_no_estimate( other.m_no_estimate ),
-	  m_no_dca( other.m_no_dca )
+	  m_no_dca( other.m_no_dca ),
+	  m_checkpoint( other.m_checkpoint ),
+	  m_coupling_writer( other.m_coupling_writer ),
+	  m_top_couplings( other.m_top_couplings ),
+	  m_parameter_store( other.m_parameter_store ),
+	  m_progress( other.m_progress ),
+	  m_locus_costs( other.m_locus_costs )
 	{
 		//m_optimizer.setStopCriteria( other.m_optimizer.criteria() );
 		auto control = cppoptlib::Criteria<real_t>();
@@ -278,88 +637,72 @@ public:
     inline void operator()( const RangeT& index_range )
     {
 
-		const std::size_t n_loci = m_optimizer_parameters.get_alignment()->n_loci(); // cache the number of loci
-
 		// Map std::vector to an Eigen::Matrix -- required by CppNumericalSolvers
 		Eigen::Matrix<real_t, Eigen::Dynamic, 1> solution = Eigen::Map< Eigen::Matrix<real_t, Eigen::Dynamic, 1> >( m_solution.data(), m_solution.size() );
 
-		stopwatch::stopwatch estimatetimer;
-		stopwatch::stopwatch dcatimer;
+		// progress is tracked with counters private to this worker; no output is written from here
+		const std::size_t progress_slot = m_progress ? m_progress->acquire_slot() : 0;
+		const auto index_translation = m_optimizer_parameters.get_alignment()->get_loci_translation();
 
 		for( const auto r: index_range )
 		{
 			m_optimizer_parameters.set_target_column(r);
 
-			std::ostringstream estimate_elapsed_time;
-			std::ostringstream bf_elapsed_time;
-			std::ostringstream dca_statistics;
-			m_cputimer.start();
+			if( m_progress ) { m_progress->locus_started( progress_slot ); }
+			const auto locus_start = std::chrono::steady_clock::now();
 
 			solution.setZero();
 
 			// /* CppNumericalSolvers
 			if( !m_no_dca )
 			{
-				dcatimer.start();
 				m_optimizer.minimize( m_optimizer_objective, solution );
-				dcatimer.stop();
 				m_optimizer_log.fval_history[r] = m_optimizer_parameters.get_fvalue();
 				m_optimizer_log.nfeval_history[r] = m_optimizer_objective.get_nfeval();
 				m_optimizer_objective.reset_counters();
 				auto& info = m_optimizer.criteria();
-				dca_statistics
-					<< "fval=" << std::scientific << m_optimizer_log.fval_history[r]
-					<< " gnorm=" << info.gradNorm
-					<< " nfeval=" << m_optimizer_log.nfeval_history[r]
-					<< " iter=" << info.iterations
-					<< " dca=" << dcatimer;
-			}
-
-			m_cputimer.stop();
-
-			if( plmDCA_options::verbose() )
-			{
-				*plmDCA_options::out_stream() << "  " << r+1 << " / " << m_loci_slice << " (out of " << n_loci << ") locus=" << (*(m_optimizer_parameters.get_alignment()->get_loci_translation()))[r]+1
-					<< ( m_no_dca ? "" : " " + dca_statistics.str() )
-					<< ( m_no_estimate ? "" : " estimate=" + estimate_elapsed_time.str() )
-					<< " total=" << m_cputimer << "\n";
+				m_optimizer_log.iterations_history[r] = info.iterations;
+				m_optimizer_log.gnorm_history[r] = info.gradNorm;
 			}
 
 			// Store all solutions (parameter matrices)
 
 			auto&& Jr_solution = m_optimizer_parameters.get_Jr_view(solution.data());
 
+			// keep the full parameters of the locus, if requested; they are written on the I/O thread of the store
+			if( m_parameter_store ) { this->store_parameters( r, Jr_solution, m_optimizer_parameters.get_hr_view(solution.data()) ); }
+
 			// Either:
 
-			// a) store full q-by-q Jij matrices
+			// a) hand over full q-by-q Jij matrices; they are kept until the other row of their pair is stored
 			if( plmDCA_options::norm_of_mean_scoring() )
 			{
-				//const auto&& solution = Jr_solution[n];
+				// the row is assembled in storage order, column by column; Jr_solution does not store the self-interaction/diagonal element
+				auto& matrices = m_row_matrices;
+				const auto& cols = m_Jij_storage.col_loci();
+				matrices.resize( cols.size() );
+				auto&& Ji_matrices = storage_t::view( matrices );
 				if( m_optimizer_parameters.number_of_alignments() > 1 )
 				{
-					for( std::size_t n=0; n < Jr_solution.size(); ++n )
+					for( std::size_t j=0; j < cols.size(); ++j )
 					{
-						auto&& coupling_ij_matrix = m_Jij_storage.get_Jij_matrix(r,n); // Jr_solution does not store self-interaction/diagonal element, but we can access the matrix as if it does
-						copy( Jr_solution, n, coupling_ij_matrix, false ); // false = do not transpose
+						auto&& coupling_ij_matrix = Ji_matrices[j];
+						copy( Jr_solution, cols[j], coupling_ij_matrix, false ); // false = do not transpose
 						//copy( gauge_shift( Jr_solution, n ), coupling_ij_matrix );
 					}
 				}
 				else
 				{
-					// lower-triangular element matrices
-					for( std::size_t n=0; n < r; ++n )
+					for( std::size_t j=0; j < cols.size(); ++j )
 					{
-						auto&& coupling_ij_matrix = m_Jij_storage.get_Jij_matrix(r,n);
-						// transpose the upper-triangular element matrices
-						copy( Jr_solution, n, coupling_ij_matrix, true ); // true = transpose
-					}
-					// upper-triangular element matrices
-					for( std::size_t n=r+1; n < Jr_solution.size(); ++n )
-					{
-						auto&& coupling_ij_matrix = m_Jij_storage.get_Jij_matrix(r,n);
-						copy( Jr_solution, n, coupling_ij_matrix, false ); // false = do not transpose
+						const auto n = cols[j];
+						if( n == r ) { continue; }
+						auto&& coupling_ij_matrix = Ji_matrices[j];
+						// transpose the lower-triangular element matrices
+						copy( Jr_solution, n, coupling_ij_matrix, n < r ); // true = transpose
 					}
 				}
+				m_Jij_storage.store_matrix_row( r, matrices, std::size_t(state_t::GAP) );
 			}
 
 			// b) store the norms of Jij matrices, discarding the full q-by-q Jij matrices
@@ -367,52 +710,79 @@ public:
 			{
 				//const auto&& Jr_solution = m_optimizer_parameters.get_initial_Jr();
 
+				// the row is assembled in storage order, with contiguous stores, and handed to the storage in one piece
+				auto& scores = m_row_scores;
+				const auto& cols = m_Jij_storage.col_loci();
+				scores.resize( cols.size() );
 				if( m_optimizer_parameters.number_of_alignments() > 1 )
 				{
-					for( std::size_t n=0; n < Jr_solution.size(); ++n )
+					for( std::size_t j=0; j < cols.size(); ++j )
 					{
-						auto& coupling_ij = m_Jij_storage.get_Jij_score(r,n);
-						coupling_ij = frobenius_norm( ising_gauge( Jr_solution, n ), std::size_t(state_t::GAP) );
+						scores[j] = frobenius_norm( ising_gauge( Jr_solution, cols[j] ), std::size_t(state_t::GAP) );
 					}
 				}
 				else
 				{
-					// lower-triangular element matrices
-					for( std::size_t n=0; n < r; ++n )
+					for( std::size_t j=0; j < cols.size(); ++j )
 					{
-						auto& coupling_ij = m_Jij_storage.get_Jij_score(r,n);
+						const auto n = cols[j];
+						if( n == r ) { scores[j] = 0; continue; }
 						// transpose the lower-triangular element matrices
-						coupling_ij = frobenius_norm( ising_gauge( Jr_solution, n, true ), std::size_t(state_t::GAP) );
-					}
-					// upper-triangular element matrices
-					for( std::size_t n=r+1; n <	Jr_solution.size(); ++n )
-					{
-						auto& coupling_ij = m_Jij_storage.get_Jij_score(r,n);
-						coupling_ij = frobenius_norm( ising_gauge( Jr_solution, n ), std::size_t(state_t::GAP) );
+						scores[j] = frobenius_norm( ising_gauge( Jr_solution, n, n < r ), std::size_t(state_t::GAP) );
 					}
 				}
+
+				// either keep the row, or only the best scores in it
+				if( m_top_couplings ) { m_top_couplings->add_row( r, scores.data() ); }
+				else { m_Jij_storage.store_row( r, scores.data() ); }
+
+				// the row is complete; make it part of the checkpoint right away
+				if( m_checkpoint )
+				{
+					m_checkpoint->store_row( r, m_optimizer_log.fval_history[r], m_optimizer_log.nfeval_history[r], scores.data() );
+				}
+			}
+
+			// hand the finished row over to the output stage
+			if( m_coupling_writer ) { m_coupling_writer->row_finished( r ); }
+
+			m_optimizer_log.seconds_history[r] = std::chrono::duration<double>( std::chrono::steady_clock::now()-locus_start ).count();
+			if( m_progress )
+			{
+				const double seconds = m_optimizer_log.seconds_history[r];
+				const Locus_statistics statistics{ (*index_translation)[r], m_optimizer_log.nfeval_history[r], uint32_t(m_optimizer_log.iterations_history[r]), uint32_t(progress_slot),
+					double(m_optimizer_log.fval_history[r]), double(m_optimizer_log.gnorm_history[r]), m_progress->elapsed()-seconds, seconds };
+				m_progress->locus_finished( progress_slot, statistics, m_locus_costs ? (*m_locus_costs)[r] : 0.0 );
 			}
 		}
 	}
 
+	void set_locus_queue( const Locus_queue* queue ) { m_optimizer_parameters.set_locus_queue( queue ); }
+	void set_alignment_replicas( std::shared_ptr< const numa::Alignment_replicas<state_t,real_t> > replicas ) { m_optimizer_parameters.set_alignment_replicas( replicas ); }
 	void set_no_estimate( bool flag ) { m_no_estimate = flag; }
 	void set_no_dca( bool flag ) { m_no_dca = flag; }
+	void set_checkpoint( Coupling_checkpoint* checkpoint ) { m_checkpoint = checkpoint; }
+	void set_coupling_writer( Coupling_writer* writer ) { m_coupling_writer = writer; }
+	void set_top_couplings( Top_couplings* top_couplings ) { m_top_couplings = top_couplings; }
+	void set_parameter_store( Parameter_store* store ) { m_parameter_store = store; }
+	void set_progress_tracker( Progress_tracker* tracker, const std::vector<double>* locus_costs ) { m_progress = tracker; m_locus_costs = locus_costs; }
 
 private:
 	using problem_t = plmDCA_cpu_objective_for_CppNumericalSolvers<plmDCA_optimizer_parameters_t>;
 
 	plmDCA_optimizer_parameters_t m_optimizer_parameters;
 
-	CouplingStorage<real_t,apegrunt::number_of_states<state_t>::N>& m_Jij_storage;
+	storage_t& m_Jij_storage;
 
 	OptimizerHistory<real_t>& m_optimizer_log;
 
 	problem_t m_optimizer_objective;
 
-	stopwatch::stopwatch m_cputimer; // for timing statistics
-
 	using allocator_t = apegrunt::memory::AlignedAllocator<real_t>;
 	std::vector<real_t,allocator_t> m_solution;
+	std::vector<float> m_row_scores; // scores of the current row, in storage order
+	std::vector<typename storage_t::raw_matrix_t> m_row_matrices; // coupling matrices of the current row (norm-of-mean scoring)
+	std::vector<float> m_parameter_values; // record of the current row for the parameter store
 
 	// the optimizer
 	//cppoptlib::LbfgsSolver<real_t> m_optimizer;
@@ -422,6 +792,30 @@ private:
 
 	bool m_no_estimate;
 	bool m_no_dca;
+
+	Coupling_checkpoint* m_checkpoint;
+	Coupling_writer* m_coupling_writer;
+	Top_couplings* m_top_couplings; // if set, rows are reduced to their best scores instead of being stored
+	Parameter_store* m_parameter_store;
+	Progress_tracker* m_progress;
+	const std::vector<double>* m_locus_costs;
+
+	//> Hand h_r and J_r of row 'r' over to the parameter store, in the record layout of Parameter_file_header
+	template< typename JrViewT, typename HrViewT >
+	void store_parameters( std::size_t r, JrViewT& Jr_solution, HrViewT&& hr_solution )
+	{
+		enum { N=apegrunt::number_of_states<state_t>::N };
+		auto& values = m_parameter_values;
+		values.resize( m_parameter_store->record_values() );
+		auto value = values.begin();
+		for( std::size_t a=0; a < N; ++a ) { *value++ = hr_solution[a]; }
+		for( std::size_t n=0; n < Jr_solution.size(); ++n )
+		{
+			const auto matrix = m_parameter_store->gauged() ? ising_gauge( Jr_solution, n ) : convert( Jr_solution, n );
+			for( const auto& row: matrix ) { for( const auto element: row ) { *value++ = element; } }
+		}
+		m_parameter_store->store( r, values.data() );
+	}
 };
 
 template< typename RealT, typename StateT > //, typename OptimizerT >
@@ -433,8 +827,12 @@ plmDCA_solver<RealT,StateT> get_plmDCA_solver(
 	std::size_t loci_slice
 ) { return plmDCA_solver<RealT,StateT>( alignments, weights, storage, log, loci_slice ); }
 
+/** Run plmDCA on 'alignments' (one alignment, or two for an inter-alignment scan) for the target loci in 'loci_list'.
+
+	@param precomputed_weights Sequence weights of alignments.back(), e.g. kept from an earlier run on the same alignment; computed if null.
+*/
 template< typename RealT, typename StateT >
-bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, apegrunt::Loci_ptr loci_list )
+bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, apegrunt::Loci_ptr loci_list, std::shared_ptr< std::vector<RealT> > precomputed_weights=nullptr )
 {
 	using real_t = RealT;
 	using state_t = StateT;
@@ -477,8 +875,6 @@ bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, ape
 		return true;
 	}
 
-    auto loci_range = boost::make_iterator_range( cbegin(loci_list), cend(loci_list) );
-
 	apegrunt::Loci_ptr loci_list2;
 
 	if( alignments.size() > 1 )
@@ -498,12 +894,160 @@ bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, ape
 		return false;
     }
 
+	// Schedule the most expensive loci first, such that the run is not held up by a few slow loci at the end
+	std::vector<double> locus_costs = estimate_locus_costs( alignments.front() );
+	bool recorded_costs = false;
+	if( plmDCA_options::has_cost_history_file() )
+	{
+		// history files record the (output) indexing base they were written with; older files are assumed to use the current output base
+		auto history_costs = read_locus_costs( plmDCA_options::cost_history_file(), alignments.front(), apegrunt::Apegrunt_options::get_output_indexing_base(), locus_costs );
+		recorded_costs = !history_costs.empty();
+		if( recorded_costs ) { locus_costs.swap( history_costs ); }
+		else
+		{
+			*plmDCA_options::err_stream() << "plmDCA warning: could not read optimizer history from file \"" << plmDCA_options::cost_history_file() << "\", or it holds none of the loci of this alignment; will use cost estimates instead\n";
+		}
+	}
+	auto scheduled_loci = order_loci_by_cost( loci_list, locus_costs );
+	std::string schedule_order = recorded_costs ? "recorded cost" : "estimated cost";
+
+	// Optionally solve the most useful loci first, such that e.g. a time-budgeted run produces the most valuable couplings
+	if( plmDCA_options::has_priority_file() || plmDCA_options::locus_priority() == "maf" )
+	{
+		std::vector<double> priorities;
+		if( plmDCA_options::has_priority_file() )
+		{
+			priorities = read_locus_priorities( plmDCA_options::priority_file(), alignments.front(), apegrunt::Apegrunt_options::get_input_indexing_base() );
+			if( priorities.empty() )
+			{
+				*plmDCA_options::err_stream() << "plmDCA error: could not read locus priorities from file \"" << plmDCA_options::priority_file() << "\"\n";
+				return false;
+			}
+			schedule_order = "user-supplied priority";
+		}
+		else
+		{
+			priorities = minor_allele_frequencies( alignments.front() );
+			schedule_order = "minor allele frequency";
+		}
+		order_loci_by_priority( scheduled_loci, priorities ); // loci of equal priority remain in order of cost
+	}
+
+	if( plmDCA_options::has_time_budget() && plmDCA_options::has_shard() )
+	{
+		*plmDCA_options::err_stream() << "plmDCA error: time budget is not supported in shard mode\n";
+		return false;
+	}
+
+	// In shard mode we only solve (and store) a cost-balanced subset of the target loci
+	apegrunt::Loci_ptr row_loci = loci_list;
+	if( plmDCA_options::has_shard() )
+	{
+		if( plmDCA_options::norm_of_mean_scoring() )
+		{
+			*plmDCA_options::err_stream() << "plmDCA error: norm-of-mean scoring is not supported in shard mode\n";
+			return false;
+		}
+		scheduled_loci = select_shard_loci( scheduled_loci, locus_costs, plmDCA_options::shard(), plmDCA_options::n_shards() );
+
+		std::vector<bool> in_shard( n_loci, false );
+		for( const auto locus: scheduled_loci ) { in_shard[locus] = true; }
+		std::vector<std::size_t> shard_loci; shard_loci.reserve( scheduled_loci.size() );
+		for( const auto locus: loci_list ) { if( in_shard[locus] ) { shard_loci.push_back( locus ); } }
+		row_loci = apegrunt::make_Loci_list( shard_loci );
+
+		if( plmDCA_options::verbose() )
+		{
+			*plmDCA_options::out_stream() << "plmDCA: shard " << plmDCA_options::shard()+1 << " of " << plmDCA_options::n_shards() << " contains " << row_loci->size() << " out of " << loci_list->size() << " target loci\n";
+		}
+	}
+
+	// In an MPI run, rank 0 collects all rows, while worker ranks only store the rows of the batch they are working on
+	if( mpi::enabled() )
+	{
+		if( plmDCA_options::norm_of_mean_scoring() )
+		{
+			*plmDCA_options::err_stream() << "plmDCA error: norm-of-mean scoring is not supported in MPI runs\n";
+			return false;
+		}
+		if( !mpi::is_master() ) { row_loci = apegrunt::make_Loci_list( std::vector<std::size_t>() ); }
+	}
+
+	auto col_loci = alignments.size() > 1 ? loci_list2 : loci_list;
+
+	// With --keep-n-best-couples, rows are reduced to their best scores as they are solved and never stored
+	const bool keep_best = plmDCA_options::keep_n_best_couples() > 0;
+	if( keep_best )
+	{
+		std::string unsupported;
+		if( plmDCA_options::norm_of_mean_scoring() ) { unsupported = "norm-of-mean scoring"; }
+		else if( plmDCA_options::has_shard() ) { unsupported = "shard mode"; }
+		else if( mpi::enabled() ) { unsupported = "MPI runs"; }
+		else if( plmDCA_options::checkpoint() ) { unsupported = "checkpointing"; }
+		if( !unsupported.empty() )
+		{
+			*plmDCA_options::err_stream() << "plmDCA error: keeping only the best couples is not supported with " << unsupported << "\n";
+			return false;
+		}
+	}
+
+	if( plmDCA_options::store_parameter_matrices_to_disk() && mpi::enabled() )
+	{
+		*plmDCA_options::err_stream() << "plmDCA error: storing parameters is not supported in MPI runs\n";
+		return false;
+	}
+
+	if( plmDCA_options::max_distance() > 0 && plmDCA_options::min_distance() > plmDCA_options::max_distance() )
+	{
+		*plmDCA_options::err_stream() << "plmDCA error: the minimum distance of coupled loci (" << plmDCA_options::min_distance() << ") exceeds the maximum distance (" << plmDCA_options::max_distance() << ")\n";
+		return false;
+	}
+
+	// Plan the memory use of the run before anything big is allocated; fewer threads (or mean-of-norms scoring) may make it fit
+#ifndef SUPERDCA_NO_TBB
+	const std::size_t requested_workers = plmDCA_options::threads() > 0 ? plmDCA_options::threads() : tbb::task_scheduler_init::default_num_threads();
+#else
+	const std::size_t requested_workers = 1;
+#endif // #ifndef SUPERDCA_NO_TBB
+	const bool symmetric_storage = alignments.size() == 1 && !plmDCA_options::has_shard();
+	const auto memory_plan = plan_memory<real_t>( alignments, row_loci->size(), col_loci->size(), symmetric_storage, requested_workers, plmDCA_options::adaptive_scoring() && !plmDCA_options::plan_only() );
+	if( ( plmDCA_options::verbose() || plmDCA_options::plan_only() ) && plmDCA_options::out_stream() && mpi::is_master() )
+	{
+		memory_plan.print( *plmDCA_options::out_stream() );
+	}
+	if( plmDCA_options::plan_only() ) { return memory_plan.fits; }
+	if( !memory_plan.fits )
+	{
+		*plmDCA_options::err_stream() << "plmDCA error: the run needs approximately " << apegrunt::memory_string( memory_plan.peak_bytes() ) << " of memory, but only " << apegrunt::memory_string( memory_plan.limit.bytes ) << " is available (" << memory_plan.limit.source << ")\n";
+		return false;
+	}
+	if( memory_plan.norm_of_mean_scoring != plmDCA_options::norm_of_mean_scoring() )
+	{
+		*plmDCA_options::err_stream() << "plmDCA warning: norm-of-mean scoring does not fit in " << apegrunt::memory_string( memory_plan.limit.bytes ) << " of memory (" << memory_plan.limit.source << "); will use mean-of-norms scoring instead\n";
+		plmDCA_options::set_norm_of_mean_scoring( memory_plan.norm_of_mean_scoring );
+	}
+	if( plmDCA_options::out_of_core() && memory_plan.norm_of_mean_scoring )
+	{
+		*plmDCA_options::err_stream() << "plmDCA error: out-of-core storage is only supported in mean-of-norms scoring mode\n";
+		return false;
+	}
+	const std::size_t n_workers = memory_plan.threads;
+
+	// Coupling scores that do not fit in memory are kept in a scratch file; it is unlinked as soon as it is mapped
+	std::string pool_file;
+	if( memory_plan.out_of_core && row_loci->size() > 0 )
+	{
+		pool_file = ( boost::filesystem::path( plmDCA_options::scratch_dir() ) / boost::filesystem::unique_path( alignments.front()->id_string()+".SuperDCA_pool.%%%%-%%%%-%%%%" ) ).string();
+	}
+
 	// reserve space for optimizer statistics log
 	OptimizerHistory<real_t> optimizer_log(n_loci);
 
 	// initialize parameter storage
 	cputimer.start();
-    CouplingStorage<real_t,apegrunt::number_of_states<state_t>::N> Jij_storage( loci_list, ( alignments.size() > 1 ? loci_list2 : loci_list ) );
+    CouplingStorage<real_t,apegrunt::number_of_states<state_t>::N> Jij_storage( keep_best ? apegrunt::make_Loci_list( std::vector<std::size_t>() ) : row_loci, col_loci, symmetric_storage, pool_file );
+    std::unique_ptr<Top_couplings> top_couplings;
+    if( keep_best ) { top_couplings.reset( new Top_couplings( plmDCA_options::keep_n_best_couples(), Jij_storage.col_loci(), alignments.size() == 1 ) ); }
     //CouplingStorage<real_t,number_of_states<plmDCA_runtime_state_t>::N> Jij_storage( alignments.front()->n_loci(), loci_list->size() );
 
     if( plmDCA_options::verbose() )
@@ -511,7 +1055,7 @@ bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, ape
 		if( plmDCA_options::norm_of_mean_scoring() )
 		{
 			// norm-of-mean scoring: the traditional plmDCA way of scoring couplings.
-			*plmDCA_options::out_stream() << "plmDCA: storage pool capacity is " << Jij_storage.get_matrix_storage_size() << " units\n";
+			*plmDCA_options::out_stream() << "plmDCA: storage pool capacity is " << Jij_storage.get_coupling_storage_size() << " units\n";
 		}
 		else
 		{
@@ -524,6 +1068,65 @@ bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, ape
     }
 	cputimer.stop(); cputimer.print_timing_stats();
 
+	// Completed rows are saved to a checkpoint file as soon as they are solved, such that an interrupted run can be resumed
+	std::unique_ptr<Coupling_checkpoint> checkpoint;
+	if( plmDCA_options::checkpoint() && !plmDCA_options::no_dca() )
+	{
+		if( plmDCA_options::norm_of_mean_scoring() )
+		{
+			*plmDCA_options::err_stream() << "plmDCA error: norm-of-mean scoring is not supported with checkpointing\n";
+			return false;
+		}
+
+		if( mpi::is_master() )
+		{
+			std::ostringstream checkpoint_name;
+			checkpoint_name << alignments.front()->id_string() << (alignments.size() > 1 ? "_scan" : "") << ".SuperDCA_checkpoint";
+			if( plmDCA_options::has_shard() ) { checkpoint_name << "." << plmDCA_options::shard()+1 << "-of-" << plmDCA_options::n_shards(); }
+
+			const auto& index_translation_dim1 = *(alignments.front()->get_loci_translation());
+			const auto& index_translation_dim2 = *(alignments.back()->get_loci_translation());
+
+			std::vector<std::size_t> rows; std::vector<uint64_t> row_ids;
+			for( const auto r: row_loci ) { rows.push_back( r ); row_ids.push_back( index_translation_dim1[r] ); }
+			std::vector<std::size_t> cols; std::vector<uint64_t> col_ids;
+			for( const auto n: col_loci ) { cols.push_back( n ); col_ids.push_back( index_translation_dim2[n] ); }
+
+			try
+			{
+				checkpoint.reset( new Coupling_checkpoint( checkpoint_name.str(), alignments.front()->id_string(), rows, cols, row_ids, col_ids, alignments.back()->size(), plmDCA_options::resume() ) );
+			}
+			catch( std::exception& e )
+			{
+				*plmDCA_options::err_stream() << "plmDCA error: " << e.what() << "\n";
+				if( mpi::enabled() ) { mpi::abort( EXIT_FAILURE ); } // the worker ranks would wait for rank 0 forever
+				return false;
+			}
+
+			if( checkpoint->resumed() )
+			{
+				checkpoint->restore( Jij_storage, optimizer_log );
+				scheduled_loci.erase( std::remove_if( scheduled_loci.begin(), scheduled_loci.end(), [&checkpoint]( std::size_t r ) { return checkpoint->is_done( r ); } ), scheduled_loci.end() );
+				if( plmDCA_options::verbose() )
+				{
+					*plmDCA_options::out_stream() << "plmDCA: resume from checkpoint file \"" << checkpoint->filename() << "\"; " << checkpoint->n_done() << " out of " << checkpoint->size() << " loci are already done\n";
+				}
+			}
+			else
+			{
+				if( plmDCA_options::resume() )
+				{
+					*plmDCA_options::err_stream() << "plmDCA warning: checkpoint file \"" << checkpoint->filename() << "\" not found; will start from the beginning\n";
+				}
+				if( plmDCA_options::verbose() )
+				{
+					*plmDCA_options::out_stream() << "plmDCA: save completed loci to checkpoint file \"" << checkpoint->filename() << "\"\n";
+				}
+			}
+		}
+		interrupt::install_handlers(); // stop cleanly on SIGTERM and SIGINT
+	}
+
     // calculate sample weight factors
     if( (!loci_list2 && loci_list->size() > 1) || (loci_list2 && loci_list2->size() != 0) )
     {
@@ -535,8 +1138,27 @@ bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, ape
 				*plmDCA_options::out_stream() << "\nplmDCA: calculate sequence weights\n";
 			}
 			cputimer.start();
-			weights = std::make_shared< std::vector<real_t> >( calculate_weights( alignments.back() ) );
-			cputimer.stop(); cputimer.print_timing_stats(); *plmDCA_options::out_stream() << "\n";
+			if( precomputed_weights && precomputed_weights->size() == alignments.back()->size() )
+			{
+				weights = precomputed_weights;
+				if( checkpoint ) { checkpoint->set_weights( *weights ); }
+			}
+			else if( checkpoint && checkpoint->has_weights() )
+			{
+				weights = std::make_shared< std::vector<real_t> >( checkpoint->get_weights<real_t>() );
+			}
+			else if( mpi::is_master() )
+			{
+				weights = std::make_shared< std::vector<real_t> >( calculate_weights( alignments.back() ) );
+				if( checkpoint ) { checkpoint->set_weights( *weights ); }
+			}
+			else
+			{
+				weights = std::make_shared< std::vector<real_t> >();
+			}
+			if( mpi::enabled() ) { mpi::broadcast( *weights ); } // all ranks use the weights computed by rank 0
+			cputimer.stop(); cputimer.print_timing_stats();
+			if( plmDCA_options::verbose() ) { *plmDCA_options::out_stream() << "\n"; }
     	}
     	else
     	{
@@ -544,10 +1166,10 @@ bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, ape
     	}
 
     	// output weights
-		if( plmDCA_options::output_weights() )
+		if( plmDCA_options::output_weights() && mpi::is_master() )
 		{
 			// output weights
-			auto weights_file = get_unique_ofstream( alignments.front()->id_string()+".weights" );
+			auto weights_file = get_unique_ofstream( alignments.front()->id_string()+".weights", plmDCA_options::output_compression() );
 			auto& weights_stream = *weights_file.stream();
 			weights_stream << std::scientific;
 			weights_stream.precision(8);
@@ -577,124 +1199,579 @@ bool run_plmDCA( std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, ape
 			alignment->get_block_accounting();
 		}
 
-		// The parameter learning stage -- this is where the magic happens
-		auto plmDCA_ftor = get_plmDCA_solver( alignments, weights, Jij_storage, optimizer_log, loci_list->size() );
-	#ifndef SUPERDCA_NO_TBB
-		tbb::parallel_reduce( tbb::blocked_range<decltype(loci_range.begin())>( loci_range.begin(), loci_range.end(), 1 ), plmDCA_ftor );
-	#else
-		plmDCA_ftor( loci_range );
-	#endif // #ifndef SUPERDCA_NO_TBB
-		cputimer.stop(); cputimer.print_timing_stats();
+		// In a time-budgeted run, loci that are not projected to finish within the budget are left for a follow-up run
+		std::unique_ptr<Time_budget> time_budget;
+		if( plmDCA_options::has_time_budget() && mpi::is_master() )
+		{
+			const std::size_t parallelism = mpi::enabled() ? (mpi::size()-1)*n_workers : n_workers;
+			time_budget.reset( new Time_budget( plmDCA_options::time_budget(), plmDCA_options::start_time(), parallelism ) );
+		}
+		std::vector<std::size_t> remaining_loci;
 
-	// /*
-		// output final coupling scores
+		// Coupling scores are written by a dedicated thread, overlapped with the learning stage
 		std::ostringstream extension;
 		extension << apegrunt::Apegrunt_options::get_output_indexing_base() << "-based"; // indicate base index
 
-		if( !plmDCA_options::no_coupling_output() )
+		std::unique_ptr< stream_name_association<std::ofstream> > couplings_file;
+		std::ostream* couplings_stream = plmDCA_options::couplings_stream(); // the caller may provide a stream of its own
+		std::string couplings_destination = "the output stream";
+		std::unique_ptr<Coupling_writer> coupling_writer;
+		std::unique_ptr<Coupling_binary_writer> binary_writer; // couplings go to a binary (.scb) file instead of text, if set
+		std::unique_ptr<Coupling_text_writer> text_writer;
+		std::unique_ptr<Coupling_sorter> sorter; // couplings are sorted before they are handed to the writer, if set
+		std::unique_ptr<Coupling_filter> coupling_filter; // couplings that do not pass are dropped before they are sorted or written, if set
+		const bool binary_output = plmDCA_options::binary_output() && !couplings_stream;
+		const bool tiled_output = Jij_storage.is_out_of_core() && alignments.size() == 1; // symmetric out-of-core scores are read back tile by tile, after the learning stage
+		if( !plmDCA_options::no_coupling_output() && !plmDCA_options::has_shard() && mpi::is_master() )
 		{
+			if( !couplings_stream )
+			{
+				// Ensure that we always get a unique output filename
+				couplings_file.reset( new stream_name_association<std::ofstream>( get_unique_ofstream( alignments.front()->id_string()+(alignments.size() > 1 ? "_scan" : "")+".SuperDCA_couplings."+( binary_output ? std::string("scb") : extension.str()+".all" ), binary_output ? Output_compression() : plmDCA_options::output_compression() ) ) );
+				couplings_stream = couplings_file->stream()->is_open() ? couplings_file->stream() : nullptr;
+				couplings_destination = "file \""+couplings_file->name()+"\"";
+			}
 
-			// Ensure that we always get a unique output filename
-			auto couplings_file = get_unique_ofstream( alignments.front()->id_string()+(alignments.size() > 1 ? "_scan" : "")+".SuperDCA_couplings."+extension.str()+".all" );
-			//auto matrix_file = get_unique_ofstream( alignments.front()->id_string()+(alignments.size() > 1 ? "_scan" : "")+".SuperDCA_coupling_matrices."+extension.str()+".all" );
-
-			if( couplings_file.stream()->is_open() && couplings_file.stream()->good() )
+			if( couplings_stream && couplings_stream->good() )
 			{
-				if( plmDCA_options::verbose() )
+				const auto& index_translation_dim1 = *(alignments.front()->get_loci_translation());
+				const auto& index_translation_dim2 = *(alignments.back()->get_loci_translation());
+				std::vector<uint64_t> loci1, loci2;
+				for( std::size_t n=0; n < alignments.front()->n_loci(); ++n ) { loci1.push_back( index_translation_dim1[n] ); }
+				if( alignments.size() > 1 ) { for( std::size_t n=0; n < alignments.back()->n_loci(); ++n ) { loci2.push_back( index_translation_dim2[n] ); } }
+
+				const std::size_t base_index = apegrunt::Apegrunt_options::get_output_indexing_base();
+
+				if( binary_output )
 				{
-					*plmDCA_options::out_stream() << "\nplmDCA: writing coupling values to file \"" << couplings_file.name() << "\"\n";
+					uint32_t flags = 0;
+					if( alignments.size() == 1 ) { flags |= Coupling_binary_header::SYMMETRIC; }
+					if( alignments.size() == 1 && plmDCA_options::norm_of_mean_scoring() ) { flags |= Coupling_binary_header::NORM_OF_MEAN; }
+					if( top_couplings || plmDCA_options::sort_output() ) { flags |= Coupling_binary_header::BEST_FIRST; }
+					binary_writer.reset( new Coupling_binary_writer( couplings_stream, flags, base_index, alignments.front()->id_string(), loci1, loci2, plmDCA_options::scb_compression() == "zlib" ) );
+				}
+				else
+				{
+					// lines are formatted on n_workers threads, next to the solvers, and written in order
+					text_writer.reset( new Coupling_text_writer( couplings_stream, base_index, loci1, loci2, n_workers ) );
 				}
-				cputimer.start();
-
-				auto index_translation_dim1 = alignments.front()->get_loci_translation();
-				auto index_translation_dim2 = alignments.back()->get_loci_translation();
 
-				const std::size_t base_index = apegrunt::Apegrunt_options::get_output_indexing_base();
+				if( plmDCA_options::filter_couplings() )
+				{
+					coupling_filter.reset( new Coupling_filter( plmDCA_options::min_coupling(), plmDCA_options::min_distance(), plmDCA_options::max_distance(), loci1, loci2 ) );
+				}
 
-				auto& couplings_out = *couplings_file.stream();
-				for( auto r_itr = cbegin(loci_list); r_itr != cend(loci_list); ++r_itr )
+				if( plmDCA_options::sort_output() )
 				{
-					if( plmDCA_options::norm_of_mean_scoring() )
-					{
-						//matrixfile.precision(6); matrixfile << std::scientific;
+					const auto sort_file = ( boost::filesystem::path( plmDCA_options::scratch_dir() ) / boost::filesystem::unique_path( alignments.front()->id_string()+".SuperDCA_sort.%%%%-%%%%-%%%%" ) ).string();
+					sorter.reset( new Coupling_sorter( plmDCA_options::top_n(), plmDCA_options::top_fraction(), plmDCA_options::sort_memory(), sort_file ) );
+				}
+			}
 
-						couplings_out.precision(8); couplings_out << std::fixed;
-						const auto r = *r_itr;
-						const auto r_index = (*index_translation_dim1)[r]+base_index;
+			if( couplings_stream && couplings_stream->good() && ( tiled_output || top_couplings ) )
+			{
+				if( plmDCA_options::verbose() )
+				{
+					*plmDCA_options::out_stream() << "plmDCA: writing " << ( top_couplings ? "the best " : "" ) << "coupling values to " << couplings_destination << ( sorter ? " best first" : "" ) << " after all loci are solved\n";
+				}
+			}
+			else if( couplings_stream && couplings_stream->good() )
+			{
+				if( plmDCA_options::verbose() )
+				{
+					if( sorter ) { *plmDCA_options::out_stream() << "plmDCA: sorting coupling values as loci are solved, and writing them to " << couplings_destination << " best first\n"; }
+					else { *plmDCA_options::out_stream() << "plmDCA: writing coupling values to " << couplings_destination << " as loci are solved\n"; }
+				}
 
-						if( alignments.size() > 1 )
+				// the sorter and both writers take add( score, i, j ), and add( score, i, j, Jij, Jji ) for the pair norms of norm-of-mean scoring
+				// pairs that do not pass the filter are dropped before they reach either
+				const auto make_emit_pair = [&Jij_storage,&alignments,&coupling_filter]( auto* writer ) -> Coupling_writer::emit_pair_t
+				{
+					const auto filter = coupling_filter.get();
+					if( plmDCA_options::norm_of_mean_scoring() && alignments.size() == 1 )
+					{
+						return [&Jij_storage,writer,filter]( std::size_t r, std::size_t n )
 						{
-							for( auto n_itr = cbegin(loci_list2); n_itr != cend(loci_list2); ++n_itr )
-							{
-								const auto n = *n_itr;
-								//{
-								//	const auto&& Jij = Jij_storage.get_Jij_matrix(r,n);
-								//	matrixfile << r_index << " " << (*index_translation_dim2)[n]+base_index << " " << gauge_shift(Jij) << "\n";
-								//}
-
-								const auto Jij_norm = frobenius_norm( ising_gauge( Jij_storage.get_Jij_matrix(r,n) ), std::size_t(state_t::GAP) );
-								couplings_out << Jij_norm << " " << r_index << " " << (*index_translation_dim2)[n]+base_index << "\n";
-							}
-						}
-						else
+							const auto& norms = Jij_storage.get_pair_norms(r,n); // computed as soon as both rows were stored
+							if( filter && !filter->keep( norms.mean, r, n ) ) { return; }
+							writer->add( norms.mean, r, n, norms.ij, norms.ji );
+						};
+					}
+					else if( alignments.size() > 1 )
+					{
+						return [&Jij_storage,writer,filter]( std::size_t r, std::size_t n )
 						{
-							for( auto n_itr = cbegin(loci_list); n_itr != r_itr; ++n_itr )
-							{
-								const auto n = *n_itr;
-
-								//{
-								//	const auto&& Jij = Jij_storage.get_Jij_matrix(r,n);
-								//	const auto&& Jji = Jij_storage.get_Jij_matrix(n,r);
-								//	matrixfile << (gauge_shift(Jij) + gauge_shift(Jji))*.5 << "\n";
-								//}
-
-								const auto Jij_norm = frobenius_norm( ising_gauge( Jij_storage.get_Jij_matrix(r,n) ), std::size_t(state_t::GAP) );
-								const auto Jji_norm = frobenius_norm( ising_gauge( Jij_storage.get_Jij_matrix(n,r) ), std::size_t(state_t::GAP) );
-								const auto J_norm = frobenius_norm( (ising_gauge(Jij_storage.get_Jij_matrix(r,n)) + ising_gauge(Jij_storage.get_Jij_matrix(n,r)))*0.5, std::size_t(state_t::GAP) );
-
-								couplings_out
-									<< J_norm << " " << r_index << " " << (*index_translation_dim2)[n]+base_index
-									<< " " << Jij_norm
-									<< " " << Jji_norm
-									<< " " << (Jij_norm+Jji_norm)*0.5
-									//<< " " << optimizer_log.fval_history[n]
-									//<< " " << optimizer_log.fval_history[r]
-									//<< " " << optimizer_log.nfeval_history[n] + optimizer_log.nfeval_history[r]
-									<< "\n";
-							}
-						}
+							const auto score = Jij_storage.get_score(r,n);
+							if( filter && !filter->keep( score, r, n ) ) { return; }
+							writer->add( score, r, n );
+						};
+					}
+					return [&Jij_storage,writer,filter]( std::size_t r, std::size_t n )
+					{
+						const auto score = Jij_storage.get_symmetric_score(r,n);
+						if( filter && !filter->keep( score, r, n ) ) { return; }
+						writer->add( score, r, n );
+					};
+				};
+				const auto emit_pair = sorter ? make_emit_pair( sorter.get() ) : binary_writer ? make_emit_pair( binary_writer.get() ) : make_emit_pair( text_writer.get() );
+
+				std::vector<std::size_t> rows; rows.reserve( loci_list->size() );
+				for( const auto r: loci_list ) { rows.push_back( r ); }
+				std::vector<std::size_t> cols; cols.reserve( col_loci->size() );
+				for( const auto n: col_loci ) { cols.push_back( n ); }
+
+				coupling_writer.reset( new Coupling_writer( rows, cols, alignments.size() == 1, emit_pair ) );
+
+				// rows restored from a checkpoint can be written right away
+				if( checkpoint )
+				{
+					for( const auto r: row_loci ) { if( checkpoint->is_done( r ) ) { coupling_writer->row_finished( r ); } }
+				}
+			}
+		}
+
+		// Couplings that are written after all loci are solved go through the filter and to the sorter, if any, or else straight to the writer
+		const auto add_coupling = [&coupling_filter,&sorter,&binary_writer,&text_writer]( float score, std::size_t i, std::size_t j )
+		{
+			if( coupling_filter && !coupling_filter->keep( score, i, j ) ) { return; }
+			if( sorter ) { sorter->add( score, i, j ); }
+			else if( binary_writer ) { binary_writer->add( score, i, j ); }
+			else { text_writer->add( score, i, j ); }
+		};
+
+		// Hand the sorted couplings to the writer, if need be, and write out everything; returns the number of couplings written
+		const auto finish_coupling_output = [&]() -> std::size_t
+		{
+			if( coupling_filter && plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: " << coupling_filter->n_kept() << " out of " << coupling_filter->n_tested() << " coupling values passed the filters\n";
+			}
+			if( sorter )
+			{
+				const bool pair_norms = sorter->pair_norms();
+				const bool sorted = sorter->finish( [&]( const Coupling_record& coupling )
+				{
+					if( binary_writer )
+					{
+						if( pair_norms ) { binary_writer->add( coupling.score, coupling.i, coupling.j, coupling.ij, coupling.ji ); }
+						else { binary_writer->add( coupling.score, coupling.i, coupling.j ); }
 					}
 					else
 					{
-						couplings_out.precision(8); couplings_out << std::fixed;
-						const auto r = *r_itr;
-						const auto r_index = (*index_translation_dim1)[r]+base_index;
-						if( alignments.size() > 1 )
-						{
-							for( auto n_itr = cbegin(loci_list2); n_itr != cend(loci_list2); ++n_itr )
-							{
-								const auto n = *n_itr;
-								const auto Jij_norm = Jij_storage.get_Jij_score(r,n);
-
-								couplings_out << Jij_norm << " " << r_index << " " << (*index_translation_dim2)[n]+base_index << "\n";
-							}
-						}
-						else
-						{
-							for( auto n_itr = cbegin(loci_list); n_itr != r_itr; ++n_itr )
-							{
-								const auto n = *n_itr;
-								const auto Jij_norm = Jij_storage.get_Jij_score(r,n);
-								const auto Jji_norm = Jij_storage.get_Jij_score(n,r);
-
-								couplings_out << (Jij_norm+Jji_norm)*0.5 << " " << r_index << " " << (*index_translation_dim2)[n]+base_index << "\n";
-							}
-						}
+						if( pair_norms ) { text_writer->add( coupling.score, coupling.i, coupling.j, coupling.ij, coupling.ji ); }
+						else { text_writer->add( coupling.score, coupling.i, coupling.j ); }
+					}
+				} );
+				if( !sorted )
+				{
+					*plmDCA_options::err_stream() << "plmDCA error: could not use the sort scratch file in \"" << plmDCA_options::scratch_dir() << "\"; " << couplings_destination << " is incomplete\n";
+				}
+				else if( plmDCA_options::verbose() )
+				{
+					*plmDCA_options::out_stream() << "plmDCA: sorted " << sorter->n_added() << " coupling values";
+					if( sorter->n_spilled_runs() > 0 ) { *plmDCA_options::out_stream() << " (" << sorter->n_spilled_runs() << " sorted runs were spilled to the scratch file)"; }
+					*plmDCA_options::out_stream() << "\n";
+				}
+			}
+			if( binary_writer ) { binary_writer->finish(); }
+			if( text_writer ) { text_writer->finish(); }
+			if( couplings_file ) { couplings_file->close(); }
+			return binary_writer ? binary_writer->records_written() : text_writer ? text_writer->lines_written() : 0;
+		};
+
+		// The fitted parameters of each locus are streamed to a parameter file, if requested
+		std::unique_ptr<Parameter_store> parameter_store;
+		if( plmDCA_options::store_parameter_matrices_to_disk() )
+		{
+			std::ostringstream parameter_file_name;
+			parameter_file_name << alignments.front()->id_string() << (alignments.size() > 1 ? "_scan" : "") << ".SuperDCA_parameters";
+			if( plmDCA_options::has_shard() ) { parameter_file_name << "." << plmDCA_options::shard()+1 << "-of-" << plmDCA_options::n_shards(); }
+
+			const auto& index_translation_dim1 = *(alignments.front()->get_loci_translation());
+			const auto& index_translation_dim2 = *(alignments.back()->get_loci_translation());
+
+			std::vector<std::size_t> rows; std::vector<uint64_t> row_ids;
+			for( const auto r: row_loci ) { rows.push_back( r ); row_ids.push_back( index_translation_dim1[r] ); }
+			std::vector<uint64_t> col_ids;
+			for( std::size_t n=0; n < alignments.back()->n_loci(); ++n ) { col_ids.push_back( index_translation_dim2[n] ); }
+
+			try
+			{
+				parameter_store.reset( new Parameter_store( parameter_file_name.str(), alignments.front()->id_string(), rows, row_ids, col_ids,
+					apegrunt::number_of_states<state_t>::N, parse_score_precision( plmDCA_options::parameter_precision() ), plmDCA_options::gauge_parameters(), n_workers ) );
+			}
+			catch( std::exception& e )
+			{
+				*plmDCA_options::err_stream() << "plmDCA error: " << e.what() << "\n";
+				return false;
+			}
+			if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: store the parameters of each locus to file \"" << parameter_store->filename() << "\" (up to " << apegrunt::memory_string( parameter_store->file_size() ) << ")\n";
+			}
+		}
+
+		// Workers only update counters of their own; a reporter thread prints the aggregate progress of the run
+		std::unique_ptr<Locus_log> locus_log;
+		std::unique_ptr<Progress_tracker> progress;
+		if( mpi::is_master() && ( plmDCA_options::has_locus_log() || plmDCA_options::verbose() ) )
+		{
+			if( plmDCA_options::has_locus_log() )
+			{
+				try
+				{
+					locus_log.reset( new Locus_log( plmDCA_options::locus_log(), scheduled_loci.size() ) );
+				}
+				catch( std::exception& e )
+				{
+					*plmDCA_options::err_stream() << "plmDCA error: could not create locus log file \"" << plmDCA_options::locus_log() << "\": " << e.what() << "\n";
+					if( mpi::enabled() ) { mpi::abort( EXIT_FAILURE ); } // the worker ranks would wait for rank 0 forever
+					return false;
+				}
+				if( plmDCA_options::verbose() )
+				{
+					*plmDCA_options::out_stream() << "plmDCA: write per-locus optimizer statistics to file \"" << locus_log->filename() << "\"\n";
+				}
+			}
+			double scheduled_cost = 0.0;
+			for( const auto r: scheduled_loci ) { scheduled_cost += locus_costs[r]; }
+			const std::size_t parallelism = mpi::enabled() ? (mpi::size()-1)*n_workers : n_workers;
+			progress.reset( new Progress_tracker( scheduled_loci.size(), scheduled_cost, parallelism, locus_log.get() ) );
+			if( plmDCA_options::verbose() )
+			{
+				progress->start_reporting( plmDCA_options::out_stream(), plmDCA_options::progress_interval() );
+			}
+		}
+
+		if( mpi::enabled() )
+		{
+			if( mpi::is_master() )
+			{
+				if( plmDCA_options::verbose() )
+				{
+					*plmDCA_options::out_stream() << "plmDCA: distribute " << scheduled_loci.size() << " loci to " << mpi::size()-1 << " MPI worker ranks in order of " << schedule_order
+						<< " (rank 0 only hands out loci and collects scores; start one rank per node plus one for rank 0)\n";
+				}
+				const auto& index_translation = *(alignments.front()->get_loci_translation());
+				const auto n_dispatched = mpi::dispatch_loci( scheduled_loci, col_loci->size(), [&]( const mpi::Row_header& header, const float* scores )
+				{
+					const std::size_t r = header.locus;
+					Jij_storage.store_row( r, scores ); // rows arrive in storage order
+					optimizer_log.fval_history[r] = header.fval;
+					optimizer_log.nfeval_history[r] = header.nfeval;
+					optimizer_log.iterations_history[r] = header.iterations;
+					optimizer_log.gnorm_history[r] = header.gnorm;
+					optimizer_log.seconds_history[r] = header.seconds;
+					if( checkpoint ) { checkpoint->store_row( r, header.fval, header.nfeval, scores ); }
+					if( time_budget ) { time_budget->completed( locus_costs[r] ); }
+					if( coupling_writer ) { coupling_writer->row_finished( r ); }
+					if( progress )
+					{
+						// all rows arrive on this thread, so a single slot of counters will do
+						const Locus_statistics statistics{ index_translation[r], header.nfeval, header.iterations, header.rank, header.fval, header.gnorm, progress->elapsed()-header.seconds, header.seconds };
+						progress->locus_finished( 0, statistics, locus_costs[r] );
+					}
+				},
+				[&]( std::size_t next_locus ) // stop handing out loci on SIGTERM/SIGINT, or when the time budget runs out
+				{
+					return interrupt::requested() || ( time_budget && !time_budget->allows( locus_costs[next_locus] ) );
+				} );
+				remaining_loci.assign( scheduled_loci.begin()+n_dispatched, scheduled_loci.end() );
+			}
+			else
+			{
+				// Solve batches of loci with all local threads and send the rows back to rank 0. The score rows of a batch
+				// and one solver (and thereby one workspace) per thread are set up once and reused by every batch.
+				const std::size_t batch_size = 2*n_workers;
+				std::vector<std::size_t> row_slots( batch_size );
+				std::iota( row_slots.begin(), row_slots.end(), std::size_t(0) );
+				CouplingStorage<real_t,apegrunt::number_of_states<state_t>::N> batch_storage( apegrunt::make_Loci_list( row_slots ), col_loci );
+				std::vector< plmDCA_solver<real_t,state_t> > batch_solvers;
+				batch_solvers.reserve( n_workers );
+				for( std::size_t w=0; w < n_workers; ++w ) { batch_solvers.emplace_back( get_plmDCA_solver( alignments, weights, batch_storage, optimizer_log, batch_size ) ); }
+
+				std::vector<float> scores( col_loci->size() );
+				mpi::process_loci( col_loci->size(), batch_size, [&]( const std::vector<std::size_t>& batch, auto& send_row )
+				{
+					batch_storage.set_row_loci( batch );
+					// which loci make up a batch depends on timing, so loci are not split (see Locus_queue::intra_locus_partitions())
+					Locus_queue batch_queue( batch, n_workers, false );
+					for( auto& solver: batch_solvers ) { solver.set_locus_queue( &batch_queue ); }
+				#ifndef SUPERDCA_NO_TBB
+					// one worker slot per solver, as tbb::parallel_reduce would split a Locus_dispatch_range
+					tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, batch_solvers.size(), 1 ), [&]( const tbb::blocked_range<std::size_t>& slots )
+					{
+						for( auto w=slots.begin(); w != slots.end(); ++w ) { batch_solvers[w]( Locus_dispatch_range( batch_queue, 1 ) ); }
+					}, tbb::simple_partitioner() );
+				#else
+					batch_solvers.front()( Locus_dispatch_range( batch_queue, n_workers ) );
+				#endif // #ifndef SUPERDCA_NO_TBB
+
+					for( const auto r: batch )
+					{
+						batch_storage.load_row( r, scores.data() );
+						const mpi::Row_header header{ r, optimizer_log.nfeval_history[r], uint32_t(optimizer_log.iterations_history[r]), 0, double(optimizer_log.fval_history[r]), double(optimizer_log.gnorm_history[r]), optimizer_log.seconds_history[r] };
+						send_row( header, scores.data() );
+					}
+				} );
+				return true; // rank 0 writes the output
+			}
+		}
+		else
+		{
+			Locus_queue locus_queue( scheduled_loci, n_workers, plmDCA_options::intra_locus_parallelism() );
+			locus_queue.set_max_partitions( memory_plan.max_partitions );
+
+			if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: schedule " << locus_queue.size() << " loci in order of " << schedule_order << "\n";
+			}
+
+			// The parameter learning stage -- this is where the magic happens
+			auto plmDCA_ftor = get_plmDCA_solver( alignments, weights, Jij_storage, optimizer_log, row_loci->size() );
+			plmDCA_ftor.set_locus_queue( &locus_queue );
+			plmDCA_ftor.set_coupling_writer( coupling_writer.get() );
+			plmDCA_ftor.set_top_couplings( top_couplings.get() );
+			plmDCA_ftor.set_parameter_store( parameter_store.get() );
+			plmDCA_ftor.set_progress_tracker( progress.get(), &locus_costs );
+			if( checkpoint )
+			{
+				plmDCA_ftor.set_checkpoint( checkpoint.get() );
+				locus_queue.set_stop_flag( &interrupt::signal_number() ); // workers finish their current locus on SIGTERM/SIGINT
+			}
+			if( time_budget ) { locus_queue.set_time_budget( time_budget.get(), &locus_costs ); }
+		#ifndef SUPERDCA_NO_TBB
+			std::shared_ptr<const numa::Topology> numa_topology;
+			std::unique_ptr<numa::Thread_pinning_observer> thread_pinning;
+			if( plmDCA_options::numa() )
+			{
+				// Threads are pinned as they join the scheduler; each thread then allocates its solver workspace in node-local memory
+				numa_topology = std::make_shared<const numa::Topology>();
+				thread_pinning.reset( new numa::Thread_pinning_observer( numa_topology ) );
+				if( numa_topology->n_nodes() > 1 )
+				{
+					plmDCA_ftor.set_alignment_replicas( std::make_shared< const numa::Alignment_replicas<state_t,real_t> >( alignments.back(), weights, numa_topology ) );
+				}
+				if( plmDCA_options::verbose() )
+				{
+					*plmDCA_options::out_stream() << "plmDCA: NUMA mode: " << numa_topology->n_nodes() << " node" << ( numa_topology->n_nodes() > 1 ? "s" : "" );
+					for( std::size_t node=0; node < numa_topology->n_nodes(); ++node )
+					{
+						*plmDCA_options::out_stream() << ( node == 0 ? " (" : ", " ) << "node " << numa_topology->node_id(node) << ": " << numa_topology->cpus(node).size() << " cpus";
 					}
+					*plmDCA_options::out_stream() << ( numa_topology->n_nodes() > 1 ? "); alignment data replicated on each node\n" : "); no replication needed\n" );
+				}
+			}
+
+			// each worker slot gets a solver workspace of its own, so don't create more slots than there are loci
+			const std::size_t n_slots = std::min( n_workers, std::max( locus_queue.size(), std::size_t(1) ) );
+			tbb::parallel_reduce( Locus_dispatch_range( locus_queue, n_slots ), plmDCA_ftor, tbb::simple_partitioner() );
+
+			if( thread_pinning && plmDCA_options::verbose() )
+			{
+				const auto threads_per_node = thread_pinning->threads_per_node();
+				*plmDCA_options::out_stream() << "plmDCA: NUMA placement:";
+				for( std::size_t node=0; node < threads_per_node.size(); ++node )
+				{
+					*plmDCA_options::out_stream() << ( node == 0 ? " " : ", " ) << "node " << numa_topology->node_id(node) << "=" << threads_per_node[node] << " threads";
+				}
+				*plmDCA_options::out_stream() << "\n";
+			}
+		#else
+			plmDCA_ftor( Locus_dispatch_range( locus_queue, n_workers ) );
+		#endif // #ifndef SUPERDCA_NO_TBB
+			remaining_loci = locus_queue.unprocessed();
+		}
+		if( progress ) { progress->stop_reporting(); }
+		cputimer.stop(); cputimer.print_timing_stats();
+
+		bool parameters_written = true; // the run fails, but only after the couplings are written
+		if( parameter_store )
+		{
+			parameter_store->finish();
+			if( !parameter_store->good() )
+			{
+				*plmDCA_options::err_stream() << "plmDCA error: could not write parameter file \"" << parameter_store->filename() << "\"; it contains the parameters of " << parameter_store->n_stored() << " loci\n";
+				parameters_written = false;
+			}
+			else if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: stored the parameters of " << parameter_store->n_stored() << " loci to file \"" << parameter_store->filename() << "\"\n";
+			}
+		}
+
+		if( coupling_writer )
+		{
+			// write the pairs of the last rows
+			cputimer.start();
+			coupling_writer->finish();
+			const auto n_written = finish_coupling_output();
+			cputimer.stop();
+			if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: wrote " << n_written << " coupling values to " << couplings_destination << "\n";
+				cputimer.print_timing_stats();
+			}
+		}
+
+		if( checkpoint )
+		{
+			checkpoint->flush();
+			if( interrupt::requested() )
+			{
+				*plmDCA_options::err_stream() << "plmDCA: interrupted; " << checkpoint->n_done() << " out of " << checkpoint->size() << " loci are saved in checkpoint file \"" << checkpoint->filename() << "\" (use --resume to continue)\n";
+				if( couplings_file )
+				{
+					// a resumed run writes all couplings again
+					boost::system::error_code ec;
+					boost::filesystem::remove( couplings_file->name(), ec );
 				}
-				cputimer.stop(); cputimer.print_timing_stats();
+				return false;
 			}
 		}
+
+		// Loci that were left unsolved have no optimizer statistics (and were never handed to the coupling writer)
+		std::vector<bool> row_done( n_loci, true );
+		for( const auto r: remaining_loci ) { row_done[r] = false; }
+		auto solved_loci = row_loci;
+		if( !remaining_loci.empty() )
+		{
+			std::vector<std::size_t> solved; solved.reserve( row_loci->size() );
+			for( const auto r: row_loci ) { if( row_done[r] ) { solved.push_back( r ); } }
+			solved_loci = apegrunt::make_Loci_list( solved );
+		}
+
+		if( top_couplings && couplings_stream && couplings_stream->good() )
+		{
+			cputimer.start();
+			const auto best = top_couplings->best();
+			for( const auto& coupling: best ) { add_coupling( coupling.score, coupling.i, coupling.j ); }
+			const auto n_written = finish_coupling_output();
+			cputimer.stop();
+			if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: wrote the " << n_written << " best coupling values (score threshold " << top_couplings->threshold() << ") to " << couplings_destination << "\n";
+				cputimer.print_timing_stats();
+			}
+			const float exact_above = top_couplings->exact_above();
+			if( exact_above > top_couplings->threshold() )
+			{
+				const auto n_uncertain = std::count_if( best.begin(), best.end(), [exact_above]( const Top_couplings::Coupling& coupling ) { return coupling.score <= exact_above; } );
+				*plmDCA_options::err_stream() << "plmDCA warning: the first scores of some pairs had to be dropped before their second scores arrived; the best couplings are exact down to score "
+					<< exact_above << ", but the " << n_uncertain << " written couplings at or below that score may have displaced better pairs\n";
+			}
+		}
+
+		if( tiled_output && couplings_stream && couplings_stream->good() )
+		{
+			cputimer.start();
+			Jij_storage.for_each_symmetric_score( [&]( std::size_t r, std::size_t n, float score )
+			{
+				if( !row_done[r] || !row_done[n] ) { return; }
+				add_coupling( score, r, n );
+			} );
+			const auto n_written = finish_coupling_output();
+			cputimer.stop();
+			if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: wrote " << n_written << " coupling values to " << couplings_destination << "\n";
+				cputimer.print_timing_stats();
+			}
+		}
+
+		if( time_budget )
+		{
+			if( plmDCA_options::verbose() )
+			{
+				double remaining_cost = 0.0;
+				for( const auto r: remaining_loci ) { remaining_cost += locus_costs[r]; }
+				*plmDCA_options::out_stream() << "plmDCA: time budget: solved " << solved_loci->size() << " out of " << row_loci->size() << " loci in " << std::size_t( time_budget->elapsed() ) << " out of " << std::size_t( time_budget->budget() ) << " seconds";
+				if( !remaining_loci.empty() )
+				{
+					*plmDCA_options::out_stream() << "; all loci would have been solved after approximately " << std::size_t( time_budget->projected_completion( remaining_cost ) ) << " seconds";
+				}
+				*plmDCA_options::out_stream() << "\n";
+			}
+			if( !remaining_loci.empty() )
+			{
+				// Write the remaining loci in a format that can be read back with --locilistfile
+				auto remaining_file = get_unique_ofstream( alignments.front()->id_string()+".SuperDCA_remaining_loci" );
+				std::sort( remaining_loci.begin(), remaining_loci.end() );
+				const std::size_t base_index = apegrunt::Apegrunt_options::get_input_indexing_base();
+				for( const auto r: remaining_loci ) { *remaining_file.stream() << r+base_index << "\n"; }
+				remaining_file.close();
+
+				*plmDCA_options::err_stream() << "plmDCA warning: the time budget ran out; " << remaining_loci.size() << " loci were not solved and are listed in file \"" << remaining_file.name() << "\" (use it as --locilistfile in a follow-up run)\n";
+			}
+		}
+
+		if( plmDCA_options::output_optimizer_history() )
+		{
+			auto history_file = get_unique_ofstream( alignments.front()->id_string()+".optimizer_history" );
+			if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "plmDCA: write optimizer history to file \"" << history_file.name() << "\"\n";
+			}
+			optimizer_log.write( history_file.stream(), solved_loci, alignments.front()->get_loci_translation(), apegrunt::Apegrunt_options::get_output_indexing_base() );
+		}
+
+		// in shard mode, store the raw coupling score rows of this shard; SuperDCA-merge will assemble the final output
+		if( !plmDCA_options::no_coupling_output() && plmDCA_options::has_shard() )
+		{
+			std::ostringstream shard_extension;
+			shard_extension << plmDCA_options::shard()+1 << "-of-" << plmDCA_options::n_shards();
+
+			auto partial_file = get_unique_ofstream( alignments.front()->id_string()+(alignments.size() > 1 ? "_scan" : "")+".SuperDCA_partial."+shard_extension.str() );
+			if( plmDCA_options::verbose() )
+			{
+				*plmDCA_options::out_stream() << "\nplmDCA: writing coupling rows of shard " << shard_extension.str() << " to file \"" << partial_file.name() << "\"\n";
+			}
+			cputimer.start();
+
+			const auto& index_translation_dim1 = *(alignments.front()->get_loci_translation());
+			const auto& index_translation_dim2 = *(alignments.back()->get_loci_translation());
+
+			std::vector<uint64_t> rows; rows.reserve( loci_list->size() );
+			for( const auto r: loci_list ) { rows.push_back( index_translation_dim1[r] ); }
+			std::vector<uint64_t> cols; cols.reserve( col_loci->size() );
+			for( const auto n: col_loci ) { cols.push_back( index_translation_dim2[n] ); }
+
+			Coupling_partial_header header;
+			header.shard = plmDCA_options::shard();
+			header.n_shards = plmDCA_options::n_shards();
+			header.flags = alignments.size() > 1 ? 0 : Coupling_partial_header::SYMMETRIC;
+			header.base_index = apegrunt::Apegrunt_options::get_output_indexing_base();
+			header.n_shard_rows = row_loci->size();
+
+			Coupling_partial_writer partial_out( partial_file.stream(), header, alignments.front()->id_string(), rows, cols );
+
+			std::vector<float> scores( col_loci->size() );
+			std::size_t row_position = 0;
+			for( const auto r: loci_list )
+			{
+				if( Jij_storage.has_row( r ) )
+				{
+					Jij_storage.load_row( r, scores.data() );
+					partial_out.write_row( row_position, scores.data() );
+				}
+				++row_position;
+			}
+			partial_file.close();
+			if( !partial_out.good() )
+			{
+				*plmDCA_options::err_stream() << "plmDCA error: could not write coupling rows to file \"" << partial_file.name() << "\"\n";
+				return false;
+			}
+			cputimer.stop(); cputimer.print_timing_stats();
+		}
+
+		// the final output is complete, so the checkpoint is no longer needed
+		if( checkpoint && !plmDCA_options::no_coupling_output() && remaining_loci.empty() )
+		{
+			checkpoint->remove();
+		}
+
+		if( !parameters_written ) { return false; }
     }
     else
     {
@@ -0,0 +1,230 @@
+/** @file plmDCA_memory_plan.hpp
+	Memory planning for the plmDCA routine: choose the number of threads and the scoring mode such that a run fits in memory.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_PLMDCA_MEMORY_PLAN_HPP
+#define SUPERDCA_PLMDCA_MEMORY_PLAN_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <ostream>
+#include <algorithm> // for std::min, std::max
+
+#include <unistd.h> // for sysconf
+
+#include "apegrunt/Alignment.h"
+#include "apegrunt/Apegrunt_utility.hpp" // for apegrunt::memory_string
+
+#include "plmDCA_options.h"
+#include "Score_precision.hpp"
+#include "Top_couplings.hpp"
+
+namespace superdca {
+
+//> An upper limit of the memory available to the process
+struct Memory_limit
+{
+	uint64_t bytes; // 0 = unknown
+	std::string source;
+};
+
+/** Read a cgroup memory limit file. Returns 0 if the file does not exist or sets no limit ("max" in cgroup v2;
+	cgroup v1 reports "no limit" as a huge number, which we treat as no limit when it exceeds physical memory).
+*/
+inline uint64_t read_cgroup_memory_limit( const std::string& filename, uint64_t physical_memory )
+{
+	std::ifstream infile( filename );
+	std::string value;
+	if( !infile.is_open() || !(infile >> value) || value == "max" ) { return 0; }
+	std::istringstream value_stream( value );
+	uint64_t bytes = 0;
+	if( !(value_stream >> bytes) ) { return 0; }
+	return ( physical_memory > 0 && bytes >= physical_memory ) ? 0 : bytes;
+}
+
+/** Detect the memory limit of this process: the memory limit of its cgroup (v2 or v1), if any, or else the
+	amount of physical memory.
+*/
+inline Memory_limit detect_memory_limit()
+{
+	const long pages = sysconf( _SC_PHYS_PAGES );
+	const long page_size = sysconf( _SC_PAGE_SIZE );
+	const uint64_t physical_memory = ( pages > 0 && page_size > 0 ) ? uint64_t(pages)*uint64_t(page_size) : 0;
+
+	// cgroup v2: the "0::<path>" line of /proc/self/cgroup names the cgroup of this process
+	std::vector<std::string> candidates;
+	{
+		std::ifstream cgroups( "/proc/self/cgroup" );
+		std::string line;
+		while( std::getline( cgroups, line ) )
+		{
+			if( line.compare( 0, 3, "0::" ) == 0 && line.size() > 4 ) { candidates.push_back( "/sys/fs/cgroup"+line.substr(3)+"/memory.max" ); }
+		}
+	}
+	candidates.push_back( "/sys/fs/cgroup/memory.max" ); // cgroup v2, as seen from inside a container
+	candidates.push_back( "/sys/fs/cgroup/memory/memory.limit_in_bytes" ); // cgroup v1
+
+	for( const auto& filename: candidates )
+	{
+		const uint64_t bytes = read_cgroup_memory_limit( filename, physical_memory );
+		if( bytes > 0 ) { return Memory_limit{ bytes, "cgroup limit ("+filename+")" }; }
+	}
+	return Memory_limit{ physical_memory, physical_memory > 0 ? "physical memory" : "unknown" };
+}
+
+/** The estimated peak memory use of a run and the settings chosen to keep it within the available memory.
+
+	Estimates cover the large allocations only: the coupling storage pool, the alignment data and sequence weights,
+	and the workspace of each worker thread (solution vector, L-BFGS state, node potentials and beliefs),
+	and the scratch space of intra-locus parallelism. The latter is what remains: a locus is split into at most as many
+	partitions (each with private node potentials) as the memory left over by everything else allows. An out-of-core pool lives in a memory-mapped scratch file,
+	whose pages the kernel can write back and reclaim at will, so it does not count towards the peak.
+*/
+struct Memory_plan
+{
+	std::size_t requested_threads;
+	std::size_t threads;
+	bool requested_norm_of_mean_scoring;
+	bool norm_of_mean_scoring;
+	bool requested_out_of_core;
+	bool out_of_core; // keep the coupling storage pool in a memory-mapped scratch file
+	uint64_t pool_bytes; // coupling storage pool in the chosen scoring mode
+	uint64_t alignment_bytes;
+	uint64_t per_thread_bytes; // at the chosen number of threads
+	std::size_t max_partitions; // of a locus, under intra-locus parallelism (1 = no intra-locus parallelism)
+	uint64_t partition_bytes; // scratch space per partition
+	Memory_limit limit;
+	bool fits;
+
+	uint64_t peak_bytes() const { return ( out_of_core ? 0 : pool_bytes ) + alignment_bytes + threads*per_thread_bytes + ( max_partitions > 1 ? threads*max_partitions*partition_bytes : 0 ); }
+
+	void print( std::ostream& out ) const
+	{
+		std::ostringstream plan;
+		plan << "plmDCA: memory plan: " << ( norm_of_mean_scoring ? "norm-of-mean" : "mean-of-norms" ) << " scoring with " << threads << " thread" << ( threads == 1 ? "" : "s" ) << "\n"
+			<< "plmDCA:   coupling storage   " << apegrunt::memory_string( pool_bytes ) << ( out_of_core ? " (out-of-core, in a scratch file)" : "" ) << "\n"
+			<< "plmDCA:   alignment data     " << apegrunt::memory_string( alignment_bytes ) << "\n"
+			<< "plmDCA:   thread workspaces  " << threads << " x " << apegrunt::memory_string( per_thread_bytes ) << "\n";
+		if( max_partitions > 1 ) { plan << "plmDCA:   intra-locus scratch " << threads << " x " << max_partitions << " x " << apegrunt::memory_string( partition_bytes ) << "\n"; }
+		plan
+			<< "plmDCA:   estimated peak     " << apegrunt::memory_string( this->peak_bytes() ) << "\n"
+			<< "plmDCA:   memory limit       " << ( limit.bytes > 0 ? apegrunt::memory_string( limit.bytes )+" ("+limit.source+")" : std::string("unknown") ) << "\n";
+		if( threads < requested_threads ) { plan << "plmDCA:   reduced from " << requested_threads << " threads to fit the memory limit\n"; }
+		if( norm_of_mean_scoring != requested_norm_of_mean_scoring ) { plan << "plmDCA:   norm-of-mean scoring does not fit the memory limit; use mean-of-norms scoring instead\n"; }
+		if( out_of_core != requested_out_of_core ) { plan << "plmDCA:   the coupling scores do not fit the memory limit; keep them out-of-core\n"; }
+		if( !fits ) { plan << "plmDCA:   the run does not fit the memory limit\n"; }
+		out << plan.str() << std::flush;
+	}
+};
+
+/** Plan the memory use of a run before anything big is allocated.
+
+	Threads are dropped until the run fits the memory limit (--memory-limit, or else the detected limit). If the run does
+	not fit even with a single thread in norm-of-mean scoring mode, and 'allow_scoring_fallback' is set, mean-of-norms
+	scoring is planned instead, which needs several times less coupling storage. If the mean-of-norms scores do not fit
+	alongside the requested number of threads, they are planned out-of-core (see CouplingStorage), which costs far less
+	than dropping threads: each row is written to the scratch file once, and the file is read back once for output.
+	Out-of-core pools store full rows, since the triangular layout would scatter the writes of every row.
+
+	@param n_rows, n_cols The dimensions of the coupling storage pool, in loci.
+	@param symmetric Set if the row and column loci are the same and the coupling storage may use triangular storage.
+*/
+template< typename RealT, typename StateT >
+Memory_plan plan_memory( const std::vector< apegrunt::Alignment_ptr<StateT> >& alignments, std::size_t n_rows, std::size_t n_cols, bool symmetric, std::size_t requested_threads, bool allow_scoring_fallback )
+{
+	enum { N=apegrunt::number_of_states<StateT>::value };
+	enum { LBFGS_HISTORY=10 }; // cppoptlib default
+
+	const uint64_t n_seqs = alignments.back()->size();
+	const uint64_t n_params = uint64_t( alignments.back()->n_loci() )*N*N + N; // plmDCA_optimizer_parameters::get_dimensions()
+
+	const uint64_t bytes_per_score = score_bytes( parse_score_precision( plmDCA_options::score_precision() ) );
+	const int top_k = plmDCA_options::keep_n_best_couples();
+	auto pool_bytes = [n_rows,n_cols,symmetric,bytes_per_score,top_k]( bool norm_of_mean, bool out_of_core ) -> uint64_t
+	{
+		// see CouplingStorage
+		if( norm_of_mean )
+		{
+			if( !( symmetric && n_rows == n_cols ) ) { return uint64_t(n_rows)*n_cols*sizeof(float); } // the norm of every matrix
+			// three norms per pair, plus the gauge-fixed matrices of pairs that wait for their second row; at most (L/2)^2 of them, halfway through the run
+			const uint64_t pending_bytes = (N-1)*(N-1)*sizeof(float) + sizeof(float) + sizeof(uint64_t) + 2*sizeof(void*);
+			return ( n_rows > 1 ? uint64_t(n_rows)*(n_rows-1)/2 : 0 )*3*sizeof(float) + uint64_t(n_rows/2)*(n_rows-n_rows/2)*pending_bytes;
+		}
+		if( top_k > 0 ) // see Top_couplings; retained couplings, and the scores that wait for the other score of their pair
+		{
+			return uint64_t(top_k)*sizeof(Top_couplings::Coupling) + ( symmetric ? uint64_t( Top_couplings::default_max_pending( top_k, n_cols ) )*Top_couplings::pending_bytes() : 0 );
+		}
+		return ( symmetric && !out_of_core && n_rows == n_cols ? ( n_rows > 1 ? uint64_t(n_rows)*(n_rows-1)/2 : 0 ) : uint64_t(n_rows)*n_cols )*bytes_per_score;
+	};
+	auto per_thread_bytes = [n_seqs,n_params]() -> uint64_t
+	{
+		uint64_t bytes = 2*n_params*sizeof(RealT); // private solution vector and its Eigen copy
+		bytes += (2*LBFGS_HISTORY+6)*n_params*sizeof(RealT); // L-BFGS history pairs, gradients and search direction
+		bytes += 3*n_seqs*N*sizeof(RealT) + n_seqs*sizeof(std::size_t); // logPots, nodeBels, log-weight sums and cached states
+		if( plmDCA_options::store_parameter_matrices_to_disk() ) { bytes += 2*n_params*sizeof(float); } // record being assembled, and one queued for the I/O thread (see Parameter_store)
+		return bytes;
+	};
+
+	Memory_plan plan;
+	plan.requested_threads = std::max( requested_threads, std::size_t(1) );
+	plan.threads = plan.requested_threads;
+	plan.requested_norm_of_mean_scoring = plmDCA_options::norm_of_mean_scoring();
+	plan.norm_of_mean_scoring = plan.requested_norm_of_mean_scoring;
+	plan.requested_out_of_core = plmDCA_options::out_of_core() && !plan.norm_of_mean_scoring;
+	plan.out_of_core = plan.requested_out_of_core;
+	plan.limit = plmDCA_options::has_memory_limit() ? Memory_limit{ plmDCA_options::memory_limit(), "--memory-limit" } : detect_memory_limit();
+
+	plan.alignment_bytes = n_seqs*sizeof(RealT); // sequence weights
+	for( const auto& alignment: alignments ) { plan.alignment_bytes += uint64_t( alignment->size() )*alignment->n_loci()*sizeof(StateT); }
+
+	auto fits = [&plan,&pool_bytes,&per_thread_bytes]( std::size_t threads, bool norm_of_mean, bool out_of_core )
+	{
+		const uint64_t resident_pool_bytes = out_of_core ? 0 : pool_bytes( norm_of_mean, false );
+		return plan.limit.bytes == 0 || resident_pool_bytes + plan.alignment_bytes + threads*per_thread_bytes() <= plan.limit.bytes;
+	};
+
+	if( plan.norm_of_mean_scoring && allow_scoring_fallback && !fits( 1, true, false ) ) { plan.norm_of_mean_scoring = false; }
+	if( !plan.norm_of_mean_scoring && !plan.out_of_core && !fits( plan.threads, false, false ) ) { plan.out_of_core = true; }
+	while( plan.threads > 1 && !fits( plan.threads, plan.norm_of_mean_scoring, plan.out_of_core ) ) { --plan.threads; }
+
+	plan.pool_bytes = pool_bytes( plan.norm_of_mean_scoring, plan.out_of_core );
+	plan.per_thread_bytes = per_thread_bytes();
+	plan.fits = fits( plan.threads, plan.norm_of_mean_scoring, plan.out_of_core );
+
+	// each thread may solve a locus split into up to 'threads' partitions, each with private logPots; allow as many as fit
+	plan.partition_bytes = n_seqs*N*sizeof(RealT);
+	plan.max_partitions = 1;
+	const uint64_t peak = plan.peak_bytes();
+	if( plmDCA_options::intra_locus_parallelism() && plan.threads > 1 ) { plan.max_partitions = plan.threads; }
+	if( plan.max_partitions > 1 && plan.limit.bytes > 0 )
+	{
+		const uint64_t headroom = plan.limit.bytes > peak ? plan.limit.bytes - peak : 0;
+		plan.max_partitions = std::size_t( std::min( uint64_t(plan.threads), headroom / std::max( plan.threads*plan.partition_bytes, uint64_t(1) ) ) );
+		if( plan.max_partitions < 2 ) { plan.max_partitions = 1; }
+	}
+	return plan;
+}
+
+} // namespace superdca
+
+#endif // SUPERDCA_PLMDCA_MEMORY_PLAN_HPP
@@ -0,0 +1,208 @@
+/** @file plmDCA_mpi.hpp
+	MPI master-worker distribution of target loci for the plmDCA routine.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_PLMDCA_MPI_HPP
+#define SUPERDCA_PLMDCA_MPI_HPP
+
+#include <cstdint>
+#include <cstdlib> // for std::atexit
+#include <cstring> // for std::memcpy
+#include <vector>
+#include <algorithm>
+
+#ifndef SUPERDCA_NO_MPI
+#include <mpi.h>
+#endif // SUPERDCA_NO_MPI
+
+namespace superdca {
+
+/** Master-worker distribution of target loci over MPI ranks.
+
+	Every rank reads and preprocesses the input alignment(s) on its own, which is deterministic and cheap compared
+	to plmDCA itself. Rank 0 computes the sequence weights and broadcasts them, then hands out batches of loci
+	in order of decreasing cost to worker ranks that ask for more work. Workers solve each batch with all their
+	threads and send the coupling score rows back to rank 0, which assembles the final scores and writes the output.
+	Rank 0 solves no loci itself, so a run should be started with one rank per node plus one for rank 0.
+
+	All MPI calls are made by the main thread of each rank (MPI_THREAD_FUNNELED).
+	When compiled without MPI, the run always consists of a single rank.
+*/
+namespace mpi {
+
+enum tag : int { REQUEST=1, WORK=2, ROW=3 };
+
+//> The header of each coupling row message; followed by the scores of the row, one float for each column locus
+struct Row_header
+{
+	uint64_t locus;
+	uint64_t nfeval;
+	uint32_t iterations;
+	uint32_t rank; // the worker rank that solved the locus
+	double fval;
+	double gnorm;
+	double seconds; // wall time spent on the locus
+};
+
+#ifndef SUPERDCA_NO_MPI
+
+inline void finalize()
+{
+	int finalized = 0; MPI_Finalized( &finalized );
+	if( !finalized ) { MPI_Finalize(); }
+}
+
+//> Initialize MPI; MPI is finalized automatically when the program exits.
+inline void init( int* argc, char*** argv )
+{
+	int provided = 0;
+	MPI_Init_thread( argc, argv, MPI_THREAD_FUNNELED, &provided );
+	std::atexit( finalize );
+}
+
+inline int rank() { int initialized = 0, r = 0; MPI_Initialized( &initialized ); if( initialized ) { MPI_Comm_rank( MPI_COMM_WORLD, &r ); } return r; }
+inline int size() { int initialized = 0, s = 1; MPI_Initialized( &initialized ); if( initialized ) { MPI_Comm_size( MPI_COMM_WORLD, &s ); } return s; }
+
+inline void abort( int code ) { MPI_Abort( MPI_COMM_WORLD, code ); }
+
+//> Broadcast 'values' from rank 0 to all ranks
+template< typename RealT >
+void broadcast( std::vector<RealT>& values )
+{
+	uint64_t n = values.size();
+	MPI_Bcast( &n, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD );
+	values.resize( n );
+	MPI_Bcast( values.data(), n*sizeof(RealT), MPI_BYTE, 0, MPI_COMM_WORLD );
+}
+
+/** Rank 0: hand out 'loci' (in order) to worker ranks until all loci are done.
+
+	@param store_row Called as store_row( const Row_header& header, const float* scores ) for each finished row.
+	@param stop Called as stop( next_locus ) before handing out more loci. Once it returns true, no more loci are
+	handed out; rows of loci that were already handed out are still collected.
+	@return The number of loci that were handed out, i.e. loci[0] ... loci[n-1].
+*/
+template< typename StoreRowF, typename StopF >
+std::size_t dispatch_loci( const std::vector<std::size_t>& loci, std::size_t n_cols, StoreRowF store_row, StopF stop )
+{
+	const std::size_t n_workers = size()-1;
+	std::size_t next = 0;
+	std::size_t active_workers = n_workers;
+	bool stopped_early = false;
+
+	std::vector<char> buffer( sizeof(Row_header) + n_cols*sizeof(float) );
+	std::vector<uint64_t> batch;
+
+	while( active_workers > 0 )
+	{
+		MPI_Status status;
+		MPI_Probe( MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status );
+
+		if( status.MPI_TAG == ROW )
+		{
+			MPI_Recv( buffer.data(), buffer.size(), MPI_BYTE, status.MPI_SOURCE, ROW, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+			Row_header header; std::memcpy( &header, buffer.data(), sizeof(header) );
+			store_row( header, reinterpret_cast<const float*>( buffer.data()+sizeof(header) ) );
+		}
+		else // REQUEST
+		{
+			uint64_t requested = 0;
+			MPI_Recv( &requested, 1, MPI_UINT64_T, status.MPI_SOURCE, REQUEST, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+
+			// Shrink batches towards the end of the run, so that all workers finish at about the same time
+			const std::size_t remaining = loci.size()-next;
+			const std::size_t fair_share = std::max( std::size_t(1), (remaining+n_workers-1)/n_workers );
+			const bool stopped = stopped_early || remaining == 0 || stop( loci[next] );
+			stopped_early = stopped_early || stopped;
+			const std::size_t n = stopped ? 0 : std::min( { std::size_t(requested), fair_share, remaining } );
+
+			batch.assign( loci.begin()+next, loci.begin()+next+n );
+			next += n;
+			MPI_Send( batch.data(), batch.size(), MPI_UINT64_T, status.MPI_SOURCE, WORK, MPI_COMM_WORLD ); // an empty batch means "we're done"
+			if( batch.empty() ) { --active_workers; }
+		}
+	}
+	return next;
+}
+
+/** Worker ranks: ask rank 0 for batches of loci until there are no more.
+
+	@param solve_batch Called as solve_batch( const std::vector<std::size_t>& batch, send_row ) for each batch of loci.
+	The batch must call send_row( Row_header header, const float* scores ) once for each locus, from the main thread;
+	the rank field of the header is filled in by send_row.
+*/
+template< typename SolveBatchF >
+void process_loci( std::size_t n_cols, std::size_t batch_size, SolveBatchF solve_batch )
+{
+	std::vector<char> buffer( sizeof(Row_header) + n_cols*sizeof(float) );
+	const uint32_t this_rank = rank();
+	auto send_row = [&buffer,n_cols,this_rank]( Row_header header, const float* scores )
+	{
+		header.rank = this_rank;
+		std::memcpy( buffer.data(), &header, sizeof(header) );
+		std::memcpy( buffer.data()+sizeof(header), scores, n_cols*sizeof(float) );
+		MPI_Send( buffer.data(), buffer.size(), MPI_BYTE, 0, ROW, MPI_COMM_WORLD );
+	};
+
+	std::vector<uint64_t> work;
+	std::vector<std::size_t> batch;
+	while( true )
+	{
+		uint64_t requested = batch_size;
+		MPI_Send( &requested, 1, MPI_UINT64_T, 0, REQUEST, MPI_COMM_WORLD );
+
+		MPI_Status status;
+		MPI_Probe( 0, WORK, MPI_COMM_WORLD, &status );
+		int count = 0; MPI_Get_count( &status, MPI_UINT64_T, &count );
+		work.resize( count );
+		MPI_Recv( work.data(), count, MPI_UINT64_T, 0, WORK, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+		if( work.empty() ) { break; }
+
+		batch.assign( work.begin(), work.end() );
+		solve_batch( batch, send_row );
+	}
+}
+
+#else // SUPERDCA_NO_MPI
+
+inline void init( int* argc, char*** argv ) { }
+inline int rank() { return 0; }
+inline int size() { return 1; }
+inline void abort( int code ) { std::exit( code ); }
+
+template< typename RealT >
+void broadcast( std::vector<RealT>& values ) { }
+
+template< typename StoreRowF, typename StopF >
+std::size_t dispatch_loci( const std::vector<std::size_t>& loci, std::size_t n_cols, StoreRowF store_row, StopF stop ) { return 0; }
+
+template< typename SolveBatchF >
+void process_loci( std::size_t n_cols, std::size_t batch_size, SolveBatchF solve_batch ) { }
+
+#endif // SUPERDCA_NO_MPI
+
+inline bool enabled() { return size() > 1; }
+inline bool is_master() { return rank() == 0; }
+
+} // namespace mpi
+
+} // namespace superdca
+
+#endif // SUPERDCA_PLMDCA_MPI_HPP
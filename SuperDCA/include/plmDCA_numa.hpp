@@ -0,0 +1,331 @@
+/** @file plmDCA_numa.hpp
+	NUMA-aware thread placement and replication of read-only alignment data.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_PLMDCA_NUMA_HPP
+#define SUPERDCA_PLMDCA_NUMA_HPP
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <memory> // for std::shared_ptr and std::make_shared
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
+#include <utility> // for std::declval
+
+#if defined(__linux__)
+#include <sched.h> // for sched_setaffinity, sched_getaffinity and sched_getcpu
+#endif
+
+#ifndef SUPERDCA_NO_TBB // Threading with Threading Building Blocks
+#include "tbb/task_scheduler_observer.h"
+#endif // SUPERDCA_NO_TBB
+
+#include "boost/filesystem/operations.hpp" // includes boost/filesystem/path.hpp
+
+#include "apegrunt/Alignment.h"
+
+namespace superdca {
+
+namespace numa {
+
+/** Parse a Linux cpulist string, such as "0-3,8-11", into a list of cpu ids. */
+inline std::vector<int> parse_cpulist( const std::string& cpulist )
+{
+	std::vector<int> cpus;
+	std::istringstream fields( cpulist );
+	std::string range;
+	while( std::getline( fields, range, ',' ) )
+	{
+		if( range.empty() || range == "\n" ) { continue; }
+		int first, last; char dash;
+		std::istringstream bounds( range );
+		if( !(bounds >> first) ) { continue; }
+		last = ( bounds >> dash >> last ) ? last : first;
+		for( int cpu = first; cpu <= last; ++cpu ) { cpus.push_back( cpu ); }
+	}
+	return cpus;
+}
+
+/** Pin the calling thread to 'cpus'. Returns false if pinning is not supported or failed. */
+inline bool pin_current_thread( const std::vector<int>& cpus )
+{
+#if defined(__linux__)
+	if( cpus.empty() ) { return false; }
+	cpu_set_t mask; CPU_ZERO( &mask );
+	for( const auto cpu: cpus ) { CPU_SET( cpu, &mask ); }
+	return 0 == sched_setaffinity( 0, sizeof(mask), &mask );
+#else
+	return false;
+#endif
+}
+
+//> The cpus that the calling thread is allowed to run on
+inline std::vector<int> current_thread_cpus()
+{
+	std::vector<int> cpus;
+#if defined(__linux__)
+	cpu_set_t mask; CPU_ZERO( &mask );
+	if( 0 == sched_getaffinity( 0, sizeof(mask), &mask ) )
+	{
+		for( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ) { if( CPU_ISSET( cpu, &mask ) ) { cpus.push_back( cpu ); } }
+	}
+#endif
+	return cpus;
+}
+
+/** The cpus that the process was allowed to run on when this was first called; call it at startup, before any
+	thread is pinned. A thread that has been pinned cannot tell, as its own affinity is a single cpu.
+*/
+inline const std::vector<int>& process_cpus()
+{
+	static const std::vector<int> cpus = current_thread_cpus();
+	return cpus;
+}
+
+/** The NUMA nodes of the machine, restricted to the cpus that this process is allowed to run on.
+
+	Nodes are discovered through /sys/devices/system/node. If that fails (e.g. on a non-Linux system
+	or inside a restricted container), all available cpus are treated as a single node.
+*/
+class Topology
+{
+public:
+	Topology()
+	{
+		const auto& allowed = process_cpus();
+
+		namespace fs = boost::filesystem;
+		const fs::path node_root( "/sys/devices/system/node" );
+		boost::system::error_code ec;
+		if( fs::is_directory( node_root, ec ) )
+		{
+			for( fs::directory_iterator entry( node_root, ec ), end; !ec && entry != end; entry.increment(ec) )
+			{
+				const std::string name = entry->path().filename().string();
+				if( name.size() < 5 || name.compare( 0, 4, "node" ) != 0 || name.find_first_not_of( "0123456789", 4 ) != std::string::npos ) { continue; }
+
+				std::ifstream cpulist_file( (entry->path() / "cpulist").string() );
+				std::string cpulist; std::getline( cpulist_file, cpulist );
+
+				std::vector<int> cpus;
+				for( const auto cpu: parse_cpulist( cpulist ) )
+				{
+					if( allowed.empty() || std::binary_search( allowed.begin(), allowed.end(), cpu ) ) { cpus.push_back( cpu ); }
+				}
+				if( !cpus.empty() ) { m_nodes.emplace_back( std::stoul( name.substr(4) ), std::move(cpus) ); }
+			}
+		}
+		std::sort( m_nodes.begin(), m_nodes.end() );
+
+		if( m_nodes.empty() ) { m_nodes.emplace_back( 0, allowed ); } // treat the machine as a single node
+
+		for( std::size_t node=0; node < m_nodes.size(); ++node )
+		{
+			for( const auto cpu: m_nodes[node].second )
+			{
+				if( std::size_t(cpu) >= m_cpu_to_node.size() ) { m_cpu_to_node.resize( cpu+1, 0 ); }
+				m_cpu_to_node[cpu] = node;
+			}
+		}
+	}
+	~Topology() { }
+
+	inline std::size_t n_nodes() const { return m_nodes.size(); }
+	inline std::size_t node_id( std::size_t node ) const { return m_nodes[node].first; } // the system id of a node
+	inline const std::vector<int>& cpus( std::size_t node ) const { return m_nodes[node].second; }
+
+	inline std::size_t node_of_cpu( int cpu ) const { return ( cpu >= 0 && std::size_t(cpu) < m_cpu_to_node.size() ) ? m_cpu_to_node[cpu] : 0; }
+
+	//> The node that the calling thread is currently running on
+	inline std::size_t current_node() const
+	{
+#if defined(__linux__)
+		return m_nodes.size() > 1 ? this->node_of_cpu( sched_getcpu() ) : 0;
+#else
+		return 0;
+#endif
+	}
+
+	//> All cpus, interleaved over nodes, such that consecutive threads are spread evenly across nodes.
+	std::vector<int> interleaved_cpus() const
+	{
+		std::vector<int> cpus;
+		for( std::size_t i=0, added=1; added != 0; ++i )
+		{
+			added = 0;
+			for( const auto& node: m_nodes )
+			{
+				if( i < node.second.size() ) { cpus.push_back( node.second[i] ); ++added; }
+			}
+		}
+		return cpus;
+	}
+
+private:
+	std::vector< std::pair< std::size_t, std::vector<int> > > m_nodes;
+	std::vector<std::size_t> m_cpu_to_node;
+};
+
+/** Per-node copies of a read-only object.
+
+	Each copy is made by a thread that is pinned to the target node, such that the default first-touch
+	page placement policy puts the copy in node-local memory. On a single-node system no copies are made.
+*/
+template< typename T >
+class Node_replicas
+{
+public:
+	Node_replicas( std::shared_ptr<const T> original, const Topology& topology )
+	: m_replicas( topology.n_nodes(), original )
+	{
+		if( topology.n_nodes() < 2 ) { return; }
+
+		for( std::size_t node=0; node < topology.n_nodes(); ++node )
+		{
+			std::thread replicator( [&,node]() {
+				pin_current_thread( topology.cpus(node) );
+				m_replicas[node] = std::make_shared<const T>( *original );
+			} );
+			replicator.join();
+		}
+	}
+	~Node_replicas() { }
+
+	inline const T& get( std::size_t node ) const { return *m_replicas[ node < m_replicas.size() ? node : 0 ]; }
+
+private:
+	std::vector< std::shared_ptr<const T> > m_replicas;
+};
+
+/** Node-local copies of the read-only alignment data that is accessed by the plmDCA objective function. */
+template< typename StateT, typename RealT >
+class Alignment_replicas
+{
+public:
+	using block_accounting_t = typename std::decay< decltype( *(std::declval< apegrunt::Alignment_ptr<StateT> >()->get_block_accounting()) ) >::type;
+	using block_storage_t = typename std::decay< decltype( *(std::declval< apegrunt::Alignment_ptr<StateT> >()->get_block_storage()) ) >::type;
+	using weights_t = std::vector<RealT>;
+
+	Alignment_replicas( apegrunt::Alignment_ptr<StateT> alignment, std::shared_ptr< std::vector<RealT> > weights, std::shared_ptr<const Topology> topology )
+	: m_topology( topology ),
+	  m_block_accounting( alignment->get_block_accounting(), *topology ),
+	  m_block_storage( alignment->get_block_storage(), *topology ),
+	  m_weights( weights, *topology )
+	{ }
+	~Alignment_replicas() { }
+
+	inline std::size_t current_node() const { return m_topology->current_node(); }
+
+	inline const block_accounting_t& get_block_accounting( std::size_t node ) const { return m_block_accounting.get( node ); }
+	inline const block_storage_t& get_block_storage( std::size_t node ) const { return m_block_storage.get( node ); }
+	inline const weights_t& get_weights( std::size_t node ) const { return m_weights.get( node ); }
+
+private:
+	std::shared_ptr<const Topology> m_topology;
+	Node_replicas<block_accounting_t> m_block_accounting;
+	Node_replicas<block_storage_t> m_block_storage;
+	Node_replicas<weights_t> m_weights;
+};
+
+#ifndef SUPERDCA_NO_TBB
+/** Pins TBB worker threads to cpus as they join the scheduler.
+
+	Threads are assigned to cpus in an order that alternates between nodes, so that any number of
+	threads is spread evenly over the machine. Each worker is assigned a cpu once per observer; the workspace
+	that it allocates afterwards will therefore end up in node-local memory. The threads that an observer
+	has pinned are kept by the observer itself, such that the workers that a later run (batch or daemon
+	mode) reuses are pinned and counted again by the observer of that run.
+
+	Master threads, e.g. the main thread, are never pinned, such that threads that they start later do
+	not inherit a single-cpu affinity. A worker may run on all cpus of the process again (see process_cpus())
+	when it leaves the scheduler, and is pinned to the same cpu again if it comes back.
+*/
+class Thread_pinning_observer : public tbb::task_scheduler_observer
+{
+public:
+	Thread_pinning_observer( std::shared_ptr<const Topology> topology )
+	: m_topology( topology ),
+	  m_cpus( topology->interleaved_cpus() ),
+	  m_next_slot(0),
+	  m_threads_per_node( topology->n_nodes() )
+	{
+		this->observe(true);
+	}
+	~Thread_pinning_observer() { this->observe(false); }
+
+	void on_scheduler_entry( bool is_worker ) override
+	{
+		if( m_cpus.empty() || !is_worker ) { return; }
+		int cpu;
+		bool first_entry = false;
+		{
+			std::lock_guard<std::mutex> lock( m_pinned_mutex );
+			auto pinned = m_pinned.find( std::this_thread::get_id() );
+			if( pinned == m_pinned.end() )
+			{
+				pinned = m_pinned.emplace( std::this_thread::get_id(), m_cpus[ m_next_slot++ % m_cpus.size() ] ).first;
+				first_entry = true;
+			}
+			cpu = pinned->second; // a worker that comes back is pinned to the same cpu again
+		}
+		if( pin_current_thread( std::vector<int>{ cpu } ) && first_entry )
+		{
+			++m_threads_per_node[ m_topology->node_of_cpu( cpu ) ];
+		}
+	}
+
+	void on_scheduler_exit( bool is_worker ) override
+	{
+		if( m_cpus.empty() || !is_worker ) { return; }
+		{
+			std::lock_guard<std::mutex> lock( m_pinned_mutex );
+			if( m_pinned.find( std::this_thread::get_id() ) == m_pinned.end() ) { return; }
+		}
+		pin_current_thread( process_cpus() ); // back to all cpus of the process
+	}
+
+	std::vector<std::size_t> threads_per_node() const
+	{
+		std::vector<std::size_t> counts;
+		for( const auto& count: m_threads_per_node ) { counts.push_back( count.load() ); }
+		return counts;
+	}
+
+private:
+	std::shared_ptr<const Topology> m_topology;
+	const std::vector<int> m_cpus;
+	std::size_t m_next_slot; // guarded by m_pinned_mutex
+	std::vector< std::atomic<std::size_t> > m_threads_per_node;
+	std::mutex m_pinned_mutex;
+	std::unordered_map<std::thread::id,int> m_pinned; // the cpu of each thread that this observer has handled
+};
+#endif // #ifndef SUPERDCA_NO_TBB
+
+} // namespace numa
+
+} // namespace superdca
+
+#endif // SUPERDCA_PLMDCA_NUMA_HPP
@@ -23,8 +23,16 @@
 #define SUPERDCA_PLMDCA_OBJECTIVE_HPP
 
 #include <cmath>
+#include <type_traits>
 //#include <Eigen/Core>
 
+#ifndef SUPERDCA_NO_TBB // Threading with Threading Building Blocks
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#include "tbb/partitioner.h"
+#include "tbb/task_arena.h" // for tbb::this_task_arena::isolate
+#endif // SUPERDCA_NO_TBB
+
 #include "apegrunt/Alignment.h"
 #include "apegrunt/Apegrunt_utility.hpp"
 #include "apegrunt/StateVector_interface.hpp"
@@ -48,13 +56,14 @@ void plmDCA_objective_fval_and_gradient( ParametersT& parameters )
 	auto alignment = parameters.get_alignment();
 	auto&& h_r = parameters.get_hr_view();
 	auto&& J_r = parameters.get_Jr_view();
-	auto& weights = *(parameters.get_weights());
+	const auto numa_node = parameters.get_numa_node(); // read-only alignment data may be replicated per NUMA node
+	const auto& weights = parameters.get_weights( numa_node );
 	const auto r = parameters.get_target_column(); // index of current/target column
 	const auto lambda_h = real_t( parameters.get_lambda_h() );
 	const auto lambda_J = real_t( parameters.get_lambda_J() );
 
-	const auto& block_accounting = *(alignment->get_block_accounting());
-	const auto& blocks = *(alignment->get_block_storage());
+	const auto& block_accounting = parameters.get_block_accounting( numa_node );
+	const auto& blocks = parameters.get_block_storage( numa_node );
 
 	// output parameters
 	auto&& grad_hr = parameters.get_grad_hr_view();
@@ -69,6 +78,7 @@ void plmDCA_objective_fval_and_gradient( ParametersT& parameters )
     // for internal use
     real_t fval{0.0}; // function value
 
+    using logpots_t = typename std::remove_reference<decltype( parameters.get_logPots() )>::type;
     auto& logPots = parameters.get_logPots();
     auto& nodeBels = parameters.get_nodeBels();
 
@@ -77,16 +87,10 @@ void plmDCA_objective_fval_and_gradient( ParametersT& parameters )
     // The following nested loops will traverse through all alignment
     // elements, except the ones in column 'r'.
 
-    // Loop over all sequences
-
-	// Initialize logPot with the parameter estimates for column 'r'.
-	// The values are either initial estimates supplied by the user or
-	// estimates produced by the optimizer.
-
-    for( auto& logPot: logPots ) { vector_view_t( logPot.data() ) = vector_view_t( h_r.data() ); }
-
-    {
-		for( std::size_t n_block=0; n_block < last_block+1; ++n_block )
+	// Accumulate the contributions of blocks [begin_block,end_block) to the logPots of all sequences.
+	auto accumulate_logPots = [&]( std::size_t begin_block, std::size_t end_block, typename logpots_t::value_type* target )
+	{
+		for( std::size_t n_block=begin_block; n_block < end_block; ++n_block )
 		{
 			const auto n_end = ( n_block == last_block ? last_block_size : n_loci_per_block );
 			auto&& Jr_block_acc = J_r.get_accumulator_for_block( n_block, n_end );
@@ -100,7 +104,7 @@ void plmDCA_objective_fval_and_gradient( ParametersT& parameters )
 
 					for( auto i : block_accounting[n_block][block_index] )
 					{
-						vector_view_t( logPots[i].data() ) += logPot;
+						vector_view_t( target[i].data() ) += logPot;
 					}
 				}
 			}
@@ -114,23 +118,21 @@ void plmDCA_objective_fval_and_gradient( ParametersT& parameters )
 
 					for( auto i : block_accounting[n_block][block_index] )
 					{
-						vector_view_t( logPots[i].data() ) += logPot;
+						vector_view_t( target[i].data() ) += logPot;
 					}
 				}
 			}
 		}
-    }
-
-	// update fval and prepare for gradient update
+	};
 
-	// Loop over all sequences
-    {
-        const std::size_t n_seqs = alignment->size(); // number of sequences in the alignment
+	// Update fval and nodeBels of sequences [begin_seq,end_seq) and add their contribution to the h_r gradient.
+	auto update_nodeBels = [&]( std::size_t begin_seq, std::size_t end_seq, real_t* grad_hr_data )
+	{
 		const auto& r_states = parameters.get_rstates();
 
-		const real_t threshold = 10^-10;
+		HPRealT partial_fval{0.0};
 
-		for( std::size_t i = 0; i < n_seqs; ++i )
+		for( std::size_t i = begin_seq; i < end_seq; ++i )
 		{
 			const vector_view_t logPot( logPots[i].data() );
 			const auto state_r = r_states[i];
@@ -140,19 +142,22 @@ void plmDCA_objective_fval_and_gradient( ParametersT& parameters )
 			const auto wlog_z = std::log( sum( exp( logPot() ) ) );
 
 			// Function value:
-			fval += weight * ( wlog_z - logPot[state_r] );
+			partial_fval += weight * ( wlog_z - logPot[state_r] );
 
 			// The gradient:
 			vector_view_t nodeBel( nodeBels[i].data() );
 			nodeBel = vector_t(weight)() * exp( logPot() - vector_t(wlog_z)() );
 			nodeBel[state_r] -= weight;
-			vector_view_t( grad_hr.data() ) += nodeBel;
+			vector_view_t( grad_hr_data ) += nodeBel;
 		}
-    }
+		return partial_fval;
+	};
 
-	// update gradient
+	// Add the contributions of blocks [begin_block,end_block) to the J_r gradient. Each block
+	// owns a separate slice of the gradient vector, so disjoint block ranges can be updated concurrently.
+	auto update_grad_Jr = [&]( std::size_t begin_block, std::size_t end_block )
 	{
-		for( std::size_t n_block=0; n_block < last_block+1; ++n_block )
+		for( std::size_t n_block=begin_block; n_block < end_block; ++n_block )
 		{
 			const auto n_end = ( n_block == last_block ? last_block_size : n_loci_per_block );
 			const auto& sequence_blocks = blocks[n_block];
@@ -187,7 +192,90 @@ void plmDCA_objective_fval_and_gradient( ParametersT& parameters )
 				}
 			}
 		}
-	} // gradient
+	};
+
+    const std::size_t n_blocks = last_block+1;
+    const std::size_t n_seqs = alignment->size(); // number of sequences in the alignment
+    const std::size_t n_partitions = parameters.get_intra_locus_partitions();
+
+#ifndef SUPERDCA_NO_TBB
+    if( n_partitions > 1 )
+    {
+    	// Nested parallelism: blocks and sequences are split into a number of partitions that is
+    	// fixed for the locus (see Locus_queue::intra_locus_partitions()), such that the order of
+    	// floating point operations (and hence the result) does not depend on how the partitions
+    	// are scheduled onto threads.
+    	// The partitions are run in isolation, such that a thread that waits for them cannot pick up
+    	// (and get stuck in) the outer task of another locus.
+    	tbb::this_task_arena::isolate( [&]()
+    	{
+    		auto& partial_logPots = parameters.get_partial_logPots( n_partitions ); // partition p owns [p*n_seqs,(p+1)*n_seqs)
+    		auto& partial_grad_hr = parameters.get_partial_grad_hr( n_partitions );
+    		std::vector<HPRealT> partial_fvals( n_partitions, 0.0 );
+
+    		auto partition_begin = [n_partitions]( std::size_t n, std::size_t p ) { return n*p/n_partitions; };
+
+    		// Each partition accumulates its share of blocks into private logPots
+    		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_partitions, 1 ), [&]( const tbb::blocked_range<std::size_t>& partitions )
+    		{
+    			for( std::size_t p=partitions.begin(); p != partitions.end(); ++p )
+    			{
+    				const auto target = partial_logPots.data()+p*n_seqs;
+    				for( std::size_t i=0; i < n_seqs; ++i ) { target[i].fill( real_t(0.0) ); }
+    				accumulate_logPots( partition_begin(n_blocks,p), partition_begin(n_blocks,p+1), target );
+    			}
+    		}, tbb::simple_partitioner() );
+
+    		// Reduce the private logPots and compute log-sum-exp over sequence partitions
+    		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_partitions, 1 ), [&]( const tbb::blocked_range<std::size_t>& partitions )
+    		{
+    			for( std::size_t p=partitions.begin(); p != partitions.end(); ++p )
+    			{
+    				const auto begin_seq = partition_begin(n_seqs,p);
+    				const auto end_seq = partition_begin(n_seqs,p+1);
+    				for( std::size_t i = begin_seq; i < end_seq; ++i )
+    				{
+    					vector_view_t logPot( logPots[i].data() );
+    					logPot = vector_view_t( h_r.data() );
+    					for( std::size_t q=0; q < n_partitions; ++q ) { logPot += vector_view_t( partial_logPots[q*n_seqs+i].data() ); }
+    				}
+    				partial_grad_hr[p].fill( real_t(0.0) );
+    				partial_fvals[p] = update_nodeBels( begin_seq, end_seq, partial_grad_hr[p].data() );
+    			}
+    		}, tbb::simple_partitioner() );
+
+    		for( std::size_t p=0; p < n_partitions; ++p )
+    		{
+    			fval += partial_fvals[p];
+    			vector_view_t( grad_hr.data() ) += vector_view_t( partial_grad_hr[p].data() );
+    		}
+
+    		// Gradient blocks are disjoint; no reduction needed
+    		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_partitions, 1 ), [&]( const tbb::blocked_range<std::size_t>& partitions )
+    		{
+    			for( std::size_t p=partitions.begin(); p != partitions.end(); ++p )
+    			{
+    				update_grad_Jr( partition_begin(n_blocks,p), partition_begin(n_blocks,p+1) );
+    			}
+    		}, tbb::simple_partitioner() );
+    	} );
+    }
+    else
+#endif // #ifndef SUPERDCA_NO_TBB
+    {
+		// Initialize logPot with the parameter estimates for column 'r'.
+		// The values are either initial estimates supplied by the user or
+		// estimates produced by the optimizer.
+		for( auto& logPot: logPots ) { vector_view_t( logPot.data() ) = vector_view_t( h_r.data() ); }
+
+		accumulate_logPots( 0, n_blocks, logPots.data() );
+
+		// update fval and prepare for gradient update
+		fval += update_nodeBels( 0, n_seqs, grad_hr.data() );
+
+		// update gradient
+		update_grad_Jr( 0, n_blocks );
+    }
 
 	// Add contributions from R_l2
     {
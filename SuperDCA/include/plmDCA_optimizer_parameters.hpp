@@ -33,6 +33,8 @@
 #include "Array_view.hpp"
 #include "Matrix_kernel_access_order.hpp"
 #include "Coupling_matrix_view.hpp"
+#include "plmDCA_scheduling.hpp"
+#include "plmDCA_numa.hpp"
 
 namespace superdca {
 
@@ -123,6 +125,9 @@ public:
 	using array_view_array_t = Array_view< array_view_t >;
 
 	using weights_t = std::shared_ptr< std::vector<real_t> >;
+	using alignment_replicas_t = numa::Alignment_replicas<state_t,real_t>;
+	using block_accounting_t = typename alignment_replicas_t::block_accounting_t;
+	using block_storage_t = typename alignment_replicas_t::block_storage_t;
 	using frequencies_t = std::shared_ptr< std::vector<frequencies_type> >;
 
 	plmDCA_optimizer_parameters() { }
@@ -138,6 +143,8 @@ public:
 	  m_logPots(weights->size(),{0}),
 	  m_nodeBels(weights->size(),{0}),
 	  m_rstates(),
+	  m_locus_queue(nullptr),
+	  m_alignment_replicas(),
 	  m_solution(nullptr),
 	  m_gradient(nullptr),
 	  m_fvalue(0),
@@ -160,6 +167,8 @@ public:
 	  m_logPots(other.m_weights->size(),{0}),
 	  m_nodeBels(other.m_weights->size(),{0}),
 	  m_rstates(),
+	  m_locus_queue(other.m_locus_queue),
+	  m_alignment_replicas(other.m_alignment_replicas),
 	  m_solution(nullptr),
 	  m_gradient(nullptr),
 	  m_fvalue(other.m_fvalue),
@@ -227,6 +236,23 @@ public:
 	weights_t& get_weights() { return m_weights; }
 	weights_t& get_multiplicities() { return m_multiplicities; }
 
+	//> Read-only alignment data for the objective function; node-local copies are used if available.
+	void set_alignment_replicas( std::shared_ptr<const alignment_replicas_t> replicas ) { m_alignment_replicas = replicas; }
+	std::size_t get_numa_node() const { return m_alignment_replicas ? m_alignment_replicas->current_node() : 0; }
+
+	const block_accounting_t& get_block_accounting( std::size_t numa_node )
+	{
+		return m_alignment_replicas ? m_alignment_replicas->get_block_accounting( numa_node ) : *(this->get_alignment()->get_block_accounting());
+	}
+	const block_storage_t& get_block_storage( std::size_t numa_node )
+	{
+		return m_alignment_replicas ? m_alignment_replicas->get_block_storage( numa_node ) : *(this->get_alignment()->get_block_storage());
+	}
+	const std::vector<real_t>& get_weights( std::size_t numa_node ) const
+	{
+		return m_alignment_replicas ? m_alignment_replicas->get_weights( numa_node ) : *m_weights;
+	}
+
 	//void set_lambda_J( real_t lambda ) { m_lambda_J = lambda; }
 	real_t get_lambda_J() const { return m_lambda_J; }
 
@@ -249,6 +275,23 @@ public:
 	logpots_t& get_logPots() { return m_logPots; }
 	nodebels_t& get_nodeBels() { return m_nodeBels; }
 
+	//> Intra-locus parallelism: the number of partitions that the objective function should be split into (1 = serial).
+	void set_locus_queue( const Locus_queue* queue ) { m_locus_queue = queue; }
+	std::size_t get_intra_locus_partitions() const { return m_locus_queue ? m_locus_queue->intra_locus_partitions( m_current_column ) : 1; }
+
+	//> Per-partition scratch space for intra-locus parallelism: one buffer of logPots, of which partition p owns
+	//> elements [p*n_seqs,(p+1)*n_seqs). The buffer grows to the largest number of partitions asked for and is reused.
+	logpots_t& get_partial_logPots( std::size_t n_partitions )
+	{
+		if( m_partial_logPots.size() < n_partitions*m_logPots.size() ) { m_partial_logPots.resize( n_partitions*m_logPots.size() ); }
+		return m_partial_logPots;
+	}
+	logpots_t& get_partial_grad_hr( std::size_t n_partitions )
+	{
+		if( m_partial_grad_hr.size() < n_partitions ) { m_partial_grad_hr.resize( n_partitions ); }
+		return m_partial_grad_hr;
+	}
+
 	const std::vector<std::size_t>& get_rstates() const { return m_rstates; }
 	const frequencies_t get_frequencies() const { return m_frequencies; }
 
@@ -262,32 +305,19 @@ private:
 
 		real_t auto_lambda = ( m_B_eff > 500.0 ) ? 0.1 : 1.0 - ((1.0-0.1) * m_B_eff / 500.0);
 
-		if( plmDCA_options::lambda_J() < 0.0 )
-		{
-			plmDCA_options::set_lambda_J( auto_lambda/2.0 );
-			// Automatic specification of regularization strength based on B_eff. B_eff>500 means the standard regularization 0.1 is used, while B_eff<=500 means a higher regularization is chosen.
-			m_lambda_J = auto_lambda * m_B_eff/2.0; // Divide by 2 to keep the size of the coupling regularization equivalent to symmetric variant of plmDCA.
-		}
-		else
-		{
-			m_lambda_J = plmDCA_options::lambda_J() * m_B_eff;
-		}
+		// The automatic values depend on the alignment, so they are kept here rather than stored back into the global options
+		// Automatic specification of regularization strength based on B_eff. B_eff>500 means the standard regularization 0.1 is used, while B_eff<=500 means a higher regularization is chosen.
+		const real_t lambda_J = plmDCA_options::lambda_J() < 0.0 ? auto_lambda/2.0 : plmDCA_options::lambda_J(); // Divide by 2 to keep the size of the coupling regularization equivalent to symmetric variant of plmDCA.
+		const real_t lambda_h = plmDCA_options::lambda_h() < 0.0 ? auto_lambda : plmDCA_options::lambda_h();
 
-		if( plmDCA_options::lambda_h() < 0.0 )
-		{
-			plmDCA_options::set_lambda_h( auto_lambda );
-			m_lambda_h = auto_lambda * m_B_eff;
-		}
-		else
-		{
-			m_lambda_h = plmDCA_options::lambda_h() * m_B_eff;
-		}
+		m_lambda_J = lambda_J * m_B_eff;
+		m_lambda_h = lambda_h * m_B_eff;
 
 		if( plmDCA_options::verbose() )
 		{
 			*plmDCA_options::out_stream()
 				<< "plmDCA: L=" << this->get_alignment()->n_loci() << " n=" << this->get_alignment()->size() << " n(effective)=" << m_B_eff << "\n"
-				<< "plmDCA: lambda_J=" << plmDCA_options::lambda_J() << " lambda_h=" << plmDCA_options::lambda_h() << "\n";
+				<< "plmDCA: lambda_J=" << lambda_J << " lambda_h=" << lambda_h << "\n";
 		}
 
 		this->cache_frequencies();
@@ -359,6 +389,11 @@ private:
 	nodebels_t m_nodeBels;
 	std::vector<std::size_t> m_rstates;
 
+	const Locus_queue* m_locus_queue;
+	std::shared_ptr<const alignment_replicas_t> m_alignment_replicas;
+	logpots_t m_partial_logPots;
+	logpots_t m_partial_grad_hr;
+
 	//> Optimizer interface
 	//std::vector<real_t> m_solution;
 	real_t *m_solution;
@@ -23,10 +23,15 @@
 #define SUPERDCA_PLMDCA_OPTIONS_H
 
 #include <iosfwd>
+#include <string>
+#include <chrono>
+#include <cstdint>
 
 // Boost includes
 #include <boost/program_options.hpp>
 
+#include "Compressed_output.hpp"
+
 namespace po = boost::program_options;
 
 namespace superdca {
@@ -60,7 +65,14 @@ public:
 
 	// algorithm and scoring
 	static bool norm_of_mean_scoring();
+	static const std::string& score_precision(); // storage format of mean-of-norms scores: "fp32", "fp16" or "bf16"
+	static void set_norm_of_mean_scoring( bool flag );
+	//> May the memory planner switch from norm-of-mean to mean-of-norms scoring when the former does not fit in memory
+	static bool adaptive_scoring();
+	static void set_adaptive_scoring( bool flag );
 	static bool store_parameter_matrices_to_disk();
+	static const std::string& parameter_precision(); // storage format of stored parameters: "fp32", "fp16" or "bf16"
+	static bool gauge_parameters(); // store coupling matrices in the gauge that scores are computed in
 	static void set_keep_n_best_couples( int n );
 	static int keep_n_best_couples();
 
@@ -74,6 +86,51 @@ public:
 	static bool no_estimate();
 	static bool no_dca();
 	static bool no_coupling_output();
+	//> Write coupling values to 'out' instead of a file named after the alignment (nullptr = to file). Not owned.
+	static std::ostream* couplings_stream();
+	static void set_couplings_stream( std::ostream* out );
+	static const std::string& output_format(); // format of the coupling file: "text" or "scb"
+	static bool binary_output(); // write couplings in the binary (.scb) format
+	static const std::string& scb_compression(); // compression of .scb blocks: "none" or "zlib"
+	static bool sort_output(); // write couplings best first; implied by top_n() > 0 and top_fraction() < 1
+	static std::size_t top_n(); // write only the top_n() best couplings (0 = all)
+	static double top_fraction(); // write only this fraction of all couplings (1 = all)
+	static uint64_t sort_memory(); // in bytes
+	static bool filter_couplings(); // whether any of the coupling filters below is set
+	static double min_coupling(); // write only couplings that score at least this much (-infinity = all)
+	static uint64_t min_distance(); // write only couplings of loci at least this many columns apart
+	static uint64_t max_distance(); // write only couplings of loci at most this many columns apart (0 = no limit)
+
+	// scheduling
+	static bool output_optimizer_history();
+	static bool has_cost_history_file();
+	static const std::string& cost_history_file();
+	static bool intra_locus_parallelism();
+	static bool numa();
+	static bool has_shard();
+	static std::size_t shard(); // zero-based
+	static std::size_t n_shards();
+	static bool checkpoint();
+	static bool resume();
+	static bool has_time_budget();
+	static double time_budget(); // in seconds
+	static std::chrono::steady_clock::time_point start_time(); // the time budget is counted from here
+	static const std::string& locus_priority();
+	static bool has_priority_file();
+	static const std::string& priority_file();
+
+	// progress reporting
+	static double progress_interval(); // in seconds; 0 = no progress reports
+	static bool has_locus_log();
+	static const std::string& locus_log();
+
+	// memory planning
+	static bool has_memory_limit();
+	static uint64_t memory_limit(); // in bytes
+	static void set_memory_limit( uint64_t bytes );
+	static bool plan_only();
+	static bool out_of_core(); // force the coupling storage pool into a memory-mapped file
+	static const std::string& scratch_dir(); // directory of the memory-mapped coupling storage pool
 
 	//> Test if textual output is desired. If true, then a call to get_out_stream() is guaranteed to return a valid (as in != null_ptr) ostream*.
 	static bool verbose();
@@ -88,6 +145,10 @@ public:
 	static int threads();
 	static void set_threads( int nthreads );
 
+	//> Compression of the weights and coupling text files
+	static const Output_compression& output_compression();
+	static void set_output_compression( const Output_compression& compression );
+
 private:
 	static uint s_state; // 1 for normal operation, 0 signals a wish to terminate process
 	static bool s_verbose;
@@ -102,8 +163,45 @@ private:
 	static bool s_no_estimate;
 	static bool s_no_dca;
 	static bool s_no_coupling_output;
+	static std::ostream* s_couplings_stream;
+	static Output_compression s_output_compression;
+	static std::string s_output_format;
+	static std::string s_scb_compression;
+	static bool s_sort_output;
+	static std::size_t s_top_n;
+	static double s_top_fraction;
+	static std::string s_sort_memory_spec;
+	static uint64_t s_sort_memory;
+	static double s_min_coupling;
+	static uint64_t s_min_distance;
+	static uint64_t s_max_distance;
+
+	static bool s_output_optimizer_history;
+	static std::string s_cost_history_file_name;
+	static bool s_no_intra_locus_parallelism;
+	static bool s_numa;
+	static std::string s_shard_spec;
+	static std::size_t s_shard;
+	static std::size_t s_n_shards;
+	static bool s_checkpoint;
+	static bool s_resume;
+	static std::string s_time_budget_spec;
+	static double s_time_budget;
+	static std::chrono::steady_clock::time_point s_start_time;
+	static std::string s_locus_priority;
+	static std::string s_priority_file_name;
+	static double s_progress_interval;
+	static std::string s_locus_log_file_name;
+	static std::string s_memory_limit_spec;
+	static uint64_t s_memory_limit;
+	static bool s_plan_only;
+	static bool s_out_of_core;
+	static std::string s_scratch_dir;
+	static bool s_adaptive_scoring;
 
 	static bool s_store_parameter_matrices_to_disk;
+	static std::string s_parameter_precision;
+	static bool s_gauge_parameters;
 
 	static std::ostream *s_out;
 	static std::ostream *s_err;
@@ -113,6 +211,7 @@ private:
 
 	static uint s_fp_precision;
 	static bool s_norm_of_mean_scoring;
+	static std::string s_score_precision;
 	static int s_keep_n_best_couples;
 
 	static double s_gradient_threshold;
@@ -140,14 +239,42 @@ private:
 	static void s_init_no_reweighting( bool flag );
 	static void s_init_output_weights( bool flag );
 	static void s_init_norm_of_mean_scoring( bool flag );
+	static void s_init_score_precision( const std::string& precision );
 	static void s_init_keep_n_best_couples( int n );
 	static void s_init_gradient_threshold( double val );
 	static void s_init_lambda_h( double val );
 	static void s_init_lambda_J( double val );
 	static void s_init_store_parameter_matrices_to_disk( bool flag );
+	static void s_init_parameter_precision( const std::string& precision );
+	static void s_init_gauge_parameters( bool flag );
 	static void s_init_no_estimate( bool flag );
 	static void s_init_no_dca( bool flag );
 	static void s_init_no_coupling_output( bool flag );
+	static void s_init_output_format( const std::string& format );
+	static void s_init_scb_compression( const std::string& compression );
+	static void s_init_sort_output( bool flag );
+	static void s_init_top_n( std::size_t n );
+	static void s_init_top_fraction( double fraction );
+	static void s_init_sort_memory( const std::string& spec );
+	static void s_init_min_coupling( double min_coupling );
+	static void s_init_min_distance( uint64_t distance );
+	static void s_init_max_distance( uint64_t distance );
+	static void s_init_output_optimizer_history( bool flag );
+	static void s_init_cost_history_file( const std::string& filename );
+	static void s_init_no_intra_locus_parallelism( bool flag );
+	static void s_init_numa( bool flag );
+	static void s_init_shard( const std::string& spec );
+	static void s_init_checkpoint( bool flag );
+	static void s_init_resume( bool flag );
+	static void s_init_time_budget( const std::string& spec );
+	static void s_init_locus_priority( const std::string& priority );
+	static void s_init_priority_file( const std::string& filename );
+	static void s_init_progress_interval( double seconds );
+	static void s_init_locus_log( const std::string& filename );
+	static void s_init_memory_limit( const std::string& spec );
+	static void s_init_plan_only( bool flag );
+	static void s_init_out_of_core( bool flag );
+	static void s_init_scratch_dir( const std::string& dir );
 
 	po::options_description
 #ifdef PLMDCA_STANDALONE_BUILD
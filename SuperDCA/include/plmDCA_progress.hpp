@@ -0,0 +1,297 @@
+/** @file plmDCA_progress.hpp
+	Progress tracking and reporting for the parameter learning stage of the plmDCA routine.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_PLMDCA_PROGRESS_HPP
+#define SUPERDCA_PLMDCA_PROGRESS_HPP
+
+#include <cstdint>
+#include <cstddef> // for offsetof
+#include <cstring> // for std::memcpy, std::memcmp, std::memset
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm> // for std::max, std::min
+
+#include "boost/iostreams/device/mapped_file.hpp"
+
+namespace superdca {
+
+//> Optimizer statistics of a single solved locus
+struct Locus_statistics
+{
+	uint64_t locus; // zero-based original index of the locus
+	uint64_t nfeval;
+	uint32_t iterations;
+	uint32_t worker; // worker thread (or MPI rank) that solved the locus
+	double fval;
+	double gnorm;
+	double start; // seconds since the start of the parameter learning stage
+	double seconds; // wall time spent on the locus
+};
+
+/** Layout of a locus log file (all values in host byte order):
+
+	header:  Locus_log_header
+	records: header.capacity x Locus_log_record, in order of completion
+
+	A record is valid once its 'flags' field has the COMPLETE bit set; records of loci that were not
+	(yet) solved are all zeros. The file can therefore be read while the run is still going on.
+*/
+struct Locus_log_header
+{
+	enum : uint32_t { VERSION=1 };
+
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t capacity;
+
+	static const char* s_magic() { return "SDCALOG1"; }
+
+	Locus_log_header() { std::memset( this, 0, sizeof(*this) ); std::memcpy( magic, s_magic(), sizeof(magic) ); version = VERSION; }
+};
+
+struct Locus_log_record
+{
+	enum : uint64_t { COMPLETE=1 };
+
+	Locus_statistics statistics;
+	uint64_t flags;
+};
+
+/** A binary log with one fixed-size record for each solved locus.
+
+	Records are written in place, directly into the mapping, by the thread that solved the locus; the only
+	shared state is the index of the next free record, which is claimed with a single atomic increment.
+*/
+class Locus_log
+{
+public:
+	Locus_log( const std::string& filename, std::size_t capacity )
+	: m_filename( filename ), m_capacity( capacity ), m_next(0)
+	{
+		Locus_log_header header;
+		header.record_size = sizeof(Locus_log_record);
+		header.capacity = capacity;
+
+		boost::iostreams::mapped_file_params params( filename );
+		params.flags = boost::iostreams::mapped_file::readwrite;
+		params.new_file_size = sizeof(Locus_log_header) + std::max( capacity, std::size_t(1) )*sizeof(Locus_log_record); // new space reads as zeros
+		m_file.open( params );
+		std::memcpy( m_file.data(), &header, sizeof(header) );
+	}
+	~Locus_log() { }
+
+	const std::string& filename() const { return m_filename; }
+	std::size_t size() const { return std::min( m_next.load(), m_capacity ); }
+
+	//> Append a record. May be called concurrently from any thread; records beyond the capacity of the log are dropped.
+	void write( const Locus_statistics& statistics )
+	{
+		const std::size_t pos = m_next.fetch_add( 1, std::memory_order_relaxed );
+		if( pos >= m_capacity ) { return; }
+
+		char* record = m_file.data() + sizeof(Locus_log_header) + pos*sizeof(Locus_log_record);
+		std::memcpy( record, &statistics, sizeof(statistics) );
+		std::atomic_thread_fence( std::memory_order_release ); // the record must be complete before it is flagged as such
+		const uint64_t flags = Locus_log_record::COMPLETE;
+		std::memcpy( record+offsetof(Locus_log_record,flags), &flags, sizeof(flags) );
+	}
+
+private:
+	const std::string m_filename;
+	const std::size_t m_capacity;
+	boost::iostreams::mapped_file m_file;
+	std::atomic<std::size_t> m_next;
+};
+
+/** Tracks the progress of the parameter learning stage without serializing the worker threads.
+
+	Each worker thread claims a slot of counters (loci done, function evaluations, iterations,
+	busy time) that only it writes to; slots are padded such that no two threads share a cache line.
+	A reporter thread periodically sums up the slots and prints the aggregate throughput, the estimated
+	time to completion and the utilization of the worker threads. Per-locus statistics go to an optional Locus_log.
+*/
+class Progress_tracker
+{
+public:
+	using clock_t = std::chrono::steady_clock;
+
+	/**
+		@param n_loci The number of loci to solve.
+		@param total_cost The combined estimated cost of the loci; the ETA is projected from the cost solved so far.
+		@param n_workers The number of loci that are solved concurrently; utilization is relative to this.
+	*/
+	Progress_tracker( std::size_t n_loci, double total_cost, std::size_t n_workers, Locus_log* log=nullptr )
+	: m_n_loci( n_loci ), m_total_cost( total_cost ), m_n_workers( std::max(n_workers,std::size_t(1)) ),
+	  m_slots( new Slot[ std::max(n_workers,std::size_t(1)) ] ), m_next_slot(0), m_log( log ),
+	  m_start( clock_t::now() ), m_out( nullptr ), m_interval(0), m_stop( false )
+	{ }
+	~Progress_tracker() { this->stop_reporting(); }
+
+	//> Claim a slot of counters for the calling worker. Workers beyond the number of slots share slots.
+	inline std::size_t acquire_slot() { return m_next_slot.fetch_add( 1, std::memory_order_relaxed ) % m_n_workers; }
+
+	//> The number of seconds since the tracker was created
+	inline double elapsed() const { return std::chrono::duration<double>( clock_t::now()-m_start ).count(); }
+
+	//> Mark the worker of 'slot' as busy, starting now.
+	inline void locus_started( std::size_t slot )
+	{
+		m_slots[slot].busy_since.store( std::chrono::duration_cast<std::chrono::nanoseconds>( clock_t::now()-m_start ).count()+1, std::memory_order_relaxed );
+	}
+
+	//> Record a solved locus of estimated cost 'cost'. Only the owner of 'slot' may call this.
+	inline void locus_finished( std::size_t slot, const Locus_statistics& statistics, double cost )
+	{
+		auto& s = m_slots[slot];
+		s.loci.store( s.loci.load( std::memory_order_relaxed )+1, std::memory_order_relaxed );
+		s.nfeval.store( s.nfeval.load( std::memory_order_relaxed )+statistics.nfeval, std::memory_order_relaxed );
+		s.iterations.store( s.iterations.load( std::memory_order_relaxed )+statistics.iterations, std::memory_order_relaxed );
+		s.busy_ns.store( s.busy_ns.load( std::memory_order_relaxed )+int64_t( statistics.seconds*1e9 ), std::memory_order_relaxed );
+		s.cost.store( s.cost.load( std::memory_order_relaxed )+cost, std::memory_order_relaxed );
+		s.busy_since.store( 0, std::memory_order_relaxed );
+		if( m_log ) { m_log->write( statistics ); }
+	}
+
+	//> Print a progress report to 'out' every 'interval' seconds (never, if 'interval' is 0), until stop_reporting() is called.
+	void start_reporting( std::ostream* out, double interval )
+	{
+		if( !out || m_out ) { return; }
+		m_out = out; m_interval = interval; m_stop = false;
+		if( m_interval > 0.0 ) { m_reporter = std::thread( [this]() { this->run(); } ); }
+	}
+
+	//> Stop the reporter thread and report the final state.
+	void stop_reporting()
+	{
+		if( !m_out ) { return; }
+		if( m_reporter.joinable() )
+		{
+			{
+				std::lock_guard<std::mutex> lock( m_mutex );
+				m_stop = true;
+			}
+			m_wakeup.notify_one();
+			m_reporter.join();
+		}
+		this->report( *m_out );
+		m_out = nullptr;
+	}
+
+	//> Print a one-line summary of the progress so far
+	void report( std::ostream& out ) const
+	{
+		const auto t = this->totals();
+		const double elapsed = this->elapsed();
+		std::ostringstream line; // assemble the line first, so that it is written in one go
+		line << std::fixed << std::setprecision(1)
+			<< "plmDCA: progress: " << t.loci << " / " << m_n_loci << " loci (" << ( m_n_loci > 0 ? 100.0*t.loci/m_n_loci : 100.0 ) << "%)"
+			<< " in " << time_string( elapsed )
+			<< "; " << ( elapsed > 0.0 ? t.loci/elapsed : 0.0 ) << " loci/s"
+			<< ", " << std::setprecision(0) << ( elapsed > 0.0 ? t.nfeval/elapsed : 0.0 ) << " nfeval/s"
+			<< ", " << ( elapsed > 0.0 ? t.iterations/elapsed : 0.0 ) << " iter/s";
+		if( t.loci < m_n_loci && t.cost > 0.0 )
+		{
+			line << "; ETA " << time_string( elapsed*std::max( m_total_cost-t.cost, 0.0 )/t.cost );
+		}
+		line << "; utilization " << ( elapsed > 0.0 ? std::min( 100.0, 100.0*t.busy/(elapsed*m_n_workers) ) : 0.0 ) << "% of " << m_n_workers << " workers\n";
+		out << line.str() << std::flush;
+	}
+
+private:
+	// Counters of one worker; written by their owner only, read by the reporter
+	struct Slot
+	{
+		std::atomic<uint64_t> loci{0};
+		std::atomic<uint64_t> nfeval{0};
+		std::atomic<uint64_t> iterations{0};
+		std::atomic<int64_t> busy_ns{0};
+		std::atomic<int64_t> busy_since{0}; // start of the current locus in nanoseconds since m_start (+1); 0 if idle
+		std::atomic<double> cost{0.0};
+		char padding[64]; // keep slots of different workers on different cache lines
+	};
+
+	struct Totals { std::size_t loci=0; std::size_t nfeval=0; std::size_t iterations=0; double busy=0.0; double cost=0.0; };
+
+	const std::size_t m_n_loci;
+	const double m_total_cost;
+	const std::size_t m_n_workers;
+	std::unique_ptr<Slot[]> m_slots;
+	std::atomic<std::size_t> m_next_slot;
+	Locus_log* m_log;
+	const clock_t::time_point m_start;
+
+	std::ostream* m_out;
+	double m_interval;
+	bool m_stop;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	std::thread m_reporter;
+
+	Totals totals() const
+	{
+		const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>( clock_t::now()-m_start ).count();
+		Totals t;
+		for( std::size_t i=0; i < m_n_workers; ++i )
+		{
+			const auto& s = m_slots[i];
+			t.loci += s.loci.load( std::memory_order_relaxed );
+			t.nfeval += s.nfeval.load( std::memory_order_relaxed );
+			t.iterations += s.iterations.load( std::memory_order_relaxed );
+			t.cost += s.cost.load( std::memory_order_relaxed );
+			int64_t busy_ns = s.busy_ns.load( std::memory_order_relaxed );
+			const int64_t since = s.busy_since.load( std::memory_order_relaxed );
+			if( since > 0 ) { busy_ns += std::max( now-(since-1), int64_t(0) ); } // include the locus in progress
+			t.busy += busy_ns*1e-9;
+		}
+		return t;
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock( m_mutex );
+		while( !m_wakeup.wait_for( lock, std::chrono::duration<double>( m_interval ), [this]() { return m_stop; } ) )
+		{
+			this->report( *m_out );
+		}
+	}
+
+	static std::string time_string( double seconds )
+	{
+		const auto s = uint64_t( seconds+0.5 );
+		std::ostringstream str;
+		str << s/3600 << ":" << std::setfill('0') << std::setw(2) << (s/60)%60 << ":" << std::setw(2) << s%60;
+		return str.str();
+	}
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_PLMDCA_PROGRESS_HPP
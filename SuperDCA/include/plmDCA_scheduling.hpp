@@ -0,0 +1,520 @@
+/** @file plmDCA_scheduling.hpp
+	Cost-aware scheduling of target loci for the plmDCA routine.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+#ifndef SUPERDCA_PLMDCA_SCHEDULING_HPP
+#define SUPERDCA_PLMDCA_SCHEDULING_HPP
+
+#include <vector>
+#include <array>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm> // for std::stable_sort, std::max_element
+#include <numeric> // for std::iota, std::accumulate
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <iterator>
+
+#include "apegrunt/Alignment.h"
+#include "apegrunt/Loci.h"
+
+namespace superdca {
+
+/** Visit the state counts of each column of 'alignment'.
+
+	Sequences are counted with their multiplicity, using the block accounting of the alignment,
+	such that each unique state block is visited only once.
+
+	@param visit Called as visit( locus, const std::array<double,N>& counts, std::size_t n_unique_blocks ) for each locus.
+*/
+template< typename StateT, typename VisitorT >
+void for_each_column_counts( apegrunt::Alignment_ptr<StateT> alignment, VisitorT visit )
+{
+	enum { N=apegrunt::number_of_states<StateT>::N };
+
+	const std::size_t n_loci = alignment->n_loci();
+	const std::size_t n_loci_per_block = apegrunt::StateBlock_size;
+
+	std::vector<double> multiplicities; multiplicities.reserve( alignment->size() );
+	for( const auto& seq: alignment ) { multiplicities.push_back( seq->multiplicity() ); }
+
+	const auto& block_accounting = *(alignment->get_block_accounting());
+	const auto& blocks = *(alignment->get_block_storage());
+
+	for( std::size_t n_block=0; n_block < block_accounting.size(); ++n_block )
+	{
+		const auto& sequence_blocks = blocks[n_block];
+		const std::size_t n_unique = block_accounting[n_block].size();
+
+		// the combined multiplicity of sequences that share each unique block
+		std::vector<double> block_weights; block_weights.reserve( n_unique );
+		for( const auto& block_members: block_accounting[n_block] )
+		{
+			double w = 0.0;
+			for( auto i: block_members ) { w += multiplicities[i]; }
+			block_weights.push_back( w );
+		}
+
+		const std::size_t begin_locus = n_block*n_loci_per_block;
+		const std::size_t end_locus = std::min( begin_locus+n_loci_per_block, n_loci );
+
+		for( std::size_t r=begin_locus; r < end_locus; ++r )
+		{
+			const auto r_local = r - begin_locus;
+
+			std::array<double,N> counts{{0}};
+			for( std::size_t block_index=0; block_index < n_unique; ++block_index )
+			{
+				counts[ std::size_t( sequence_blocks[block_index][r_local] ) ] += block_weights[block_index];
+			}
+			visit( r, counts, n_unique );
+		}
+	}
+}
+
+/** Estimate the relative cost of solving the pseudo-likelihood problem for each target locus.
+
+	The number of function evaluations the optimizer needs for a locus grows with
+	the information content of the target column, so we use the column entropy
+	as the primary predictor. The number of unique state blocks that cover the
+	target locus measures local haplotype diversity and is used as a secondary factor,
+	and the minor allele frequency (of non-gap states) as a third: at equal entropy, a
+	column with a common minor allele is a harder classification problem than one whose
+	entropy is spread over gaps and rare states.
+	The estimate is a cheap heuristic; it only needs to get the order approximately right.
+
+	@return A vector of cost estimates, indexed by locus (column) index.
+*/
+template< typename StateT >
+std::vector<double> estimate_locus_costs( apegrunt::Alignment_ptr<StateT> alignment )
+{
+	std::vector<double> costs( alignment->n_loci(), 0.0 );
+
+	for_each_column_counts( alignment, [&costs]( std::size_t r, const auto& counts, std::size_t n_unique )
+	{
+		const double total = std::accumulate( counts.begin(), counts.end(), 0.0 );
+
+		double entropy = 0.0;
+		for( const auto count: counts )
+		{
+			if( count > 0.0 ) { const double p = count / total; entropy -= p*std::log(p); }
+		}
+
+		double non_gap = 0.0, major = 0.0, minor = 0.0;
+		for( std::size_t state=0; state < counts.size(); ++state )
+		{
+			if( state == std::size_t(StateT::GAP) ) { continue; }
+			const double count = counts[state];
+			non_gap += count;
+			if( count > major ) { minor = major; major = count; }
+			else if( count > minor ) { minor = count; }
+		}
+		const double maf = non_gap > 0.0 ? minor / non_gap : 0.0;
+
+		costs[r] = entropy * std::log2( 2.0 + double(n_unique) ) * ( 1.0 + maf );
+	} );
+
+	return costs;
+}
+
+/** Calculate the minor allele frequency of each locus.
+
+	The minor allele is the second most common non-gap state; frequencies are relative to the number of non-gap states in the column.
+
+	@return A vector of minor allele frequencies, indexed by locus (column) index.
+*/
+template< typename StateT >
+std::vector<double> minor_allele_frequencies( apegrunt::Alignment_ptr<StateT> alignment )
+{
+	std::vector<double> frequencies( alignment->n_loci(), 0.0 );
+
+	for_each_column_counts( alignment, [&frequencies]( std::size_t r, const auto& counts, std::size_t n_unique )
+	{
+		double total = 0.0, major = 0.0, minor = 0.0;
+		for( std::size_t state=0; state < counts.size(); ++state )
+		{
+			if( state == std::size_t(StateT::GAP) ) { continue; }
+			const double count = counts[state];
+			total += count;
+			if( count > major ) { minor = major; major = count; }
+			else if( count > minor ) { minor = count; }
+		}
+		frequencies[r] = total > 0.0 ? minor / total : 0.0;
+	} );
+
+	return frequencies;
+}
+
+/** Read per-locus costs from an optimizer history file written by a previous run.
+
+	Each non-comment line of the file contains a locus index, the final function value and the
+	number of function evaluations. Loci are identified by their index in the original input
+	alignment and translated to column indices in 'alignment'. The indexing base of the loci is
+	read from the "base_index=" field of the header line, as OptimizerHistory::write() records it;
+	'base_index' is used for files that do not record it. Loci that are not found in the
+	history get their entry of 'estimated_costs' (see estimate_locus_costs()), scaled by the average
+	ratio of recorded to estimated cost of the loci that were found.
+
+	@return A vector of cost estimates, indexed by locus (column) index, or an empty vector if the file could not be read
+	or if it holds none of the loci of 'alignment' (e.g. the history of another alignment, or written with another base).
+*/
+template< typename StateT >
+std::vector<double> read_locus_costs( const std::string& filename, apegrunt::Alignment_ptr<StateT> alignment, std::size_t base_index, const std::vector<double>& estimated_costs )
+{
+	std::ifstream infile( filename );
+	if( !infile.is_open() ) { return std::vector<double>(); }
+
+	const auto& translation = *(alignment->get_loci_translation());
+	std::unordered_map<std::size_t,std::size_t> original_to_column;
+	for( std::size_t r=0; r < translation.size(); ++r ) { original_to_column[ translation[r] ] = r; }
+
+	std::vector<double> costs( alignment->n_loci(), -1.0 );
+
+	std::string line;
+	while( std::getline( infile, line ) )
+	{
+		if( line.empty() ) { continue; }
+		if( line[0] == '#' )
+		{
+			const auto field = line.find( "base_index=" );
+			if( field != std::string::npos ) { std::istringstream( line.substr( field+11 ) ) >> base_index; }
+			continue;
+		}
+		std::istringstream fields( line );
+		std::size_t locus; double fval; std::size_t nfeval;
+		if( !(fields >> locus >> fval >> nfeval) || locus < base_index ) { continue; }
+
+		const auto column = original_to_column.find( locus-base_index );
+		if( column != original_to_column.end() ) { costs[column->second] = double(nfeval); }
+	}
+
+	double recorded = 0.0, estimated = 0.0;
+	std::size_t n_recorded = 0;
+	for( std::size_t r=0; r < costs.size(); ++r )
+	{
+		if( costs[r] < 0.0 ) { continue; }
+		recorded += costs[r]; estimated += estimated_costs[r];
+		++n_recorded;
+	}
+	if( n_recorded == 0 ) { return std::vector<double>(); }
+
+	const double scale = estimated > 0.0 ? recorded/estimated : 1.0;
+	for( std::size_t r=0; r < costs.size(); ++r ) { if( costs[r] < 0.0 ) { costs[r] = scale*estimated_costs[r]; } }
+
+	return costs;
+}
+
+/** Read user-supplied locus priorities from file.
+
+	Each non-comment line of the file contains a locus index and a priority value; higher priority loci are solved first.
+	Loci are identified by their index in the original input alignment, as in read_locus_costs().
+	Loci that are not listed get the lowest possible priority.
+
+	@return A vector of priorities, indexed by locus (column) index, or an empty vector if the file could not be read.
+*/
+template< typename StateT >
+std::vector<double> read_locus_priorities( const std::string& filename, apegrunt::Alignment_ptr<StateT> alignment, std::size_t base_index )
+{
+	std::ifstream infile( filename );
+	if( !infile.is_open() ) { return std::vector<double>(); }
+
+	const auto& translation = *(alignment->get_loci_translation());
+	std::unordered_map<std::size_t,std::size_t> original_to_column;
+	for( std::size_t r=0; r < translation.size(); ++r ) { original_to_column[ translation[r] ] = r; }
+
+	std::vector<double> priorities( alignment->n_loci(), std::numeric_limits<double>::lowest() );
+
+	std::string line;
+	while( std::getline( infile, line ) )
+	{
+		if( line.empty() || line[0] == '#' ) { continue; }
+		std::istringstream fields( line );
+		std::size_t locus; double priority;
+		if( !(fields >> locus >> priority) || locus < base_index ) { continue; }
+
+		const auto column = original_to_column.find( locus-base_index );
+		if( column != original_to_column.end() ) { priorities[column->second] = priority; }
+	}
+
+	return priorities;
+}
+
+/** Order 'loci' by decreasing cost. Ties are resolved by locus index, so that the order is deterministic. */
+inline std::vector<std::size_t> order_loci_by_cost( apegrunt::Loci_ptr loci, const std::vector<double>& costs )
+{
+	std::vector<std::size_t> ordered; ordered.reserve( loci->size() );
+	for( const auto locus: loci ) { ordered.push_back( locus ); }
+
+	std::stable_sort( ordered.begin(), ordered.end(), [&costs]( std::size_t a, std::size_t b ) { return costs[a] > costs[b]; } );
+
+	return ordered;
+}
+
+/** Reorder loci by decreasing priority. Loci of equal priority keep their relative order in 'ordered_loci'. */
+inline void order_loci_by_priority( std::vector<std::size_t>& ordered_loci, const std::vector<double>& priorities )
+{
+	std::stable_sort( ordered_loci.begin(), ordered_loci.end(), [&priorities]( std::size_t a, std::size_t b ) { return priorities[a] > priorities[b]; } );
+}
+
+/** A wall-clock time budget for the parameter learning stage.
+
+	The budget is counted from 'start', usually the start of the program. The time that a locus will take
+	is projected from the estimated cost of the locus and the throughput observed so far, where 'parallelism'
+	is the number of loci that are solved concurrently. A fraction of the budget is reserved for writing the output.
+*/
+class Time_budget
+{
+public:
+	using clock_t = std::chrono::steady_clock;
+
+	Time_budget( double seconds, clock_t::time_point start, std::size_t parallelism, double reserve=0.05 )
+	: m_budget( seconds ), m_reserve( reserve ), m_start( start ), m_compute_start( clock_t::now() ),
+	  m_parallelism( std::max(parallelism,std::size_t(1)) ), m_completed_cost(0), m_completed(0), m_exhausted(false)
+	{ }
+	~Time_budget() { }
+
+	inline double budget() const { return m_budget; }
+	inline double elapsed() const { return std::chrono::duration<double>( clock_t::now()-m_start ).count(); }
+
+	//> Record a completed locus of cost 'cost'
+	inline void completed( double cost )
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_completed_cost += cost + 1e-9; // a small constant keeps zero-cost loci from going unnoticed
+		++m_completed;
+	}
+
+	inline std::size_t n_completed() const { std::lock_guard<std::mutex> lock( m_mutex ); return m_completed; }
+
+	//> The projected wall time of a single locus of cost 'cost'; zero until the first locus has been completed.
+	inline double expected_seconds( double cost ) const
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		if( m_completed == 0 ) { return 0.0; }
+		const double compute_time = std::chrono::duration<double>( clock_t::now()-m_compute_start ).count();
+		return (cost + 1e-9) * compute_time * m_parallelism / m_completed_cost;
+	}
+
+	//> The projected elapsed time at which loci of combined cost 'remaining_cost' will have been solved.
+	inline double projected_completion( double remaining_cost ) const { return this->elapsed() + this->expected_seconds( remaining_cost ) / m_parallelism; }
+
+	//> True if a locus of cost 'cost' can be started and still be solved within the budget. Once false, always false.
+	inline bool allows( double cost )
+	{
+		if( m_exhausted.load() ) { return false; }
+		if( this->elapsed() + this->expected_seconds( cost ) > m_budget*(1.0-m_reserve) ) { m_exhausted = true; }
+		return !m_exhausted.load();
+	}
+
+	inline bool exhausted() const { return m_exhausted.load(); }
+
+private:
+	const double m_budget;
+	const double m_reserve;
+	const clock_t::time_point m_start;
+	const clock_t::time_point m_compute_start;
+	const std::size_t m_parallelism;
+	double m_completed_cost;
+	std::size_t m_completed;
+	std::atomic<bool> m_exhausted;
+	mutable std::mutex m_mutex;
+};
+
+/** Select the loci of one shard out of 'n_shards' from loci that have been ordered by decreasing cost.
+
+	Loci are assigned greedily to the shard with the smallest total cost so far (ties go to the
+	lowest shard index), which balances the expected work across shards. The assignment only
+	depends on the input, so every shard of a run computes the same partitioning independently.
+
+	@return The loci of shard 'shard' (zero-based), in the order of 'ordered_loci'.
+*/
+inline std::vector<std::size_t> select_shard_loci( const std::vector<std::size_t>& ordered_loci, const std::vector<double>& costs, std::size_t shard, std::size_t n_shards )
+{
+	std::vector<double> shard_costs( n_shards, 0.0 );
+	std::vector<std::size_t> selected;
+
+	for( const auto locus: ordered_loci )
+	{
+		const auto target = std::size_t( std::min_element( shard_costs.begin(), shard_costs.end() ) - shard_costs.begin() );
+		// a small constant keeps zero-cost loci from piling up in the first shard
+		shard_costs[target] += costs[locus] + 1e-9;
+		if( target == shard ) { selected.push_back( locus ); }
+	}
+
+	return selected;
+}
+
+/** A shared queue of target loci. Worker threads pop loci in queue order, which gives
+	us dynamic dispatch of the most expensive loci first (longest-processing-time-first).
+
+	The last loci of the queue are split into partitions, such that otherwise idle workers can
+	help finish the run: a locus that is followed by u-1 others, u < workers, gets ceil(workers/u)
+	partitions, at most 'max_partitions' (see set_max_partitions()), such that there are about as
+	many partitions in flight as there are workers once fewer loci than workers remain. The number
+	of partitions depends only on the position of the locus in the queue, not on how fast the loci
+	before it are solved, so every run of the same schedule sums the objective in the same order.
+*/
+class Locus_queue
+{
+public:
+	Locus_queue( std::vector<std::size_t> ordered_loci, std::size_t n_workers=1, bool intra_locus_parallelism=false )
+	: m_loci( std::move(ordered_loci) ), m_next(0), m_finished(0),
+	  m_workers( std::max(n_workers,std::size_t(1)) ),
+	  m_intra_locus_parallelism( intra_locus_parallelism ),
+	  m_max_partitions( m_workers ),
+	  m_stop_flag( nullptr ),
+	  m_time_budget( nullptr ),
+	  m_costs( nullptr )
+	{
+		std::size_t max_locus = 0;
+		for( const auto locus: m_loci ) { max_locus = std::max( max_locus, locus+1 ); }
+		m_position.assign( max_locus, m_loci.size() );
+		for( std::size_t pos=0; pos < m_loci.size(); ++pos ) { m_position[ m_loci[pos] ] = pos; }
+	}
+	~Locus_queue() { }
+
+	inline bool pop( std::size_t& locus )
+	{
+		if( m_stop_flag && m_stop_flag->load( std::memory_order_relaxed ) ) { return false; }
+		if( m_time_budget )
+		{
+			const std::size_t next = m_next.load();
+			if( next < m_loci.size() && !m_time_budget->allows( (*m_costs)[ m_loci[next] ] ) ) { return false; }
+		}
+		const std::size_t pos = m_next.fetch_add(1);
+		if( pos < m_loci.size() ) { locus = m_loci[pos]; return true; }
+		return false;
+	}
+
+	inline void finished( std::size_t locus )
+	{
+		++m_finished;
+		if( m_time_budget ) { m_time_budget->completed( (*m_costs)[locus] ); }
+	}
+
+	//> Stop handing out loci once '*flag' becomes non-zero; loci that have already been popped are finished normally.
+	inline void set_stop_flag( const std::atomic<int>* flag ) { m_stop_flag = flag; }
+
+	//> Stop handing out loci once the next locus, of cost (*costs)[locus], is not projected to finish within 'budget'.
+	inline void set_time_budget( Time_budget* budget, const std::vector<double>* costs ) { m_time_budget = budget; m_costs = costs; }
+
+	//> Split a locus into at most 'n' partitions, e.g. such that the per-partition scratch space fits in memory (see plan_memory()).
+	inline void set_max_partitions( std::size_t n ) { m_max_partitions = std::max( n, std::size_t(1) ); }
+
+	//> The loci that were never handed out, in queue order
+	inline std::vector<std::size_t> unprocessed() const { return std::vector<std::size_t>( m_loci.begin()+std::min( m_next.load(), m_loci.size() ), m_loci.end() ); }
+
+	inline std::size_t size() const { return m_loci.size(); }
+	inline std::size_t remaining() const { const std::size_t pos = m_next.load(); return pos < m_loci.size() ? m_loci.size()-pos : 0; }
+	inline std::size_t unfinished() const { return m_loci.size() - std::min( m_finished.load(), m_loci.size() ); }
+	inline std::size_t workers() const { return m_workers; }
+
+	//> The number of partitions that the objective function of 'locus' should be split into (1 = no intra-locus parallelism).
+	inline std::size_t intra_locus_partitions( std::size_t locus ) const
+	{
+		const std::size_t pos = locus < m_position.size() ? m_position[locus] : m_loci.size();
+		const std::size_t trailing = m_loci.size()-std::min( pos, m_loci.size() ); // the locus and the ones after it
+		if( !m_intra_locus_parallelism || trailing == 0 || trailing >= m_workers ) { return 1; }
+		return std::min( ( m_workers+trailing-1 ) / trailing, m_max_partitions );
+	}
+
+private:
+	const std::vector<std::size_t> m_loci;
+	std::atomic<std::size_t> m_next;
+	std::atomic<std::size_t> m_finished;
+	const std::size_t m_workers;
+	const bool m_intra_locus_parallelism;
+	std::size_t m_max_partitions;
+	std::vector<std::size_t> m_position; // queue position of each locus
+	const std::atomic<int>* m_stop_flag;
+	Time_budget* m_time_budget;
+	const std::vector<double>* m_costs;
+};
+
+/** A range of worker slots that draw their loci from a shared Locus_queue.
+
+	Locus_dispatch_range models the TBB Range concept: it splits down to one slot per
+	worker, and iterating over a slot pops loci from the queue until it is drained.
+	It can therefore be handed to any body that loops over a range of locus indices.
+*/
+class Locus_dispatch_range
+{
+public:
+	class iterator
+	{
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = std::size_t;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const std::size_t*;
+		using reference = const std::size_t&;
+
+		iterator() : m_queue(nullptr), m_locus(0), m_has_locus(false) { } // end-of-range sentinel
+		iterator( Locus_queue* queue ) : m_queue(queue), m_locus(0), m_has_locus(false) { this->advance(); }
+
+		inline reference operator*() const { return m_locus; }
+		inline iterator& operator++() { this->advance(); return *this; }
+
+		inline bool operator==( const iterator& rhs ) const { return m_queue == rhs.m_queue; }
+		inline bool operator!=( const iterator& rhs ) const { return m_queue != rhs.m_queue; }
+
+	private:
+		Locus_queue* m_queue;
+		std::size_t m_locus;
+		bool m_has_locus;
+
+		// Moving on means that the body is done with the current locus
+		inline void advance()
+		{
+			if( !m_queue ) { return; }
+			if( m_has_locus ) { m_queue->finished( m_locus ); }
+			m_has_locus = m_queue->pop( m_locus );
+			if( !m_has_locus ) { m_queue = nullptr; }
+		}
+	};
+
+	Locus_dispatch_range( Locus_queue& queue, std::size_t n_workers ) : m_queue(&queue), m_workers( std::max(n_workers,std::size_t(1)) ) { }
+	~Locus_dispatch_range() { }
+
+	// TBB interface (Requirements for Range)
+	template< typename TBBSplitT >
+	Locus_dispatch_range( Locus_dispatch_range& other, TBBSplitT s ) : m_queue(other.m_queue), m_workers(other.m_workers/2) { other.m_workers -= m_workers; }
+
+	inline bool empty() const { return m_workers == 0; }
+	inline bool is_divisible() const { return m_workers > 1; }
+
+	inline iterator begin() const { return iterator( m_queue ); }
+	inline iterator end() const { return iterator(); }
+
+	inline Locus_queue& queue() const { return *m_queue; }
+
+private:
+	Locus_queue* m_queue;
+	std::size_t m_workers;
+};
+
+} // namespace superdca
+
+#endif // SUPERDCA_PLMDCA_SCHEDULING_HPP
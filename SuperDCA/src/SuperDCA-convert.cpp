@@ -0,0 +1,186 @@
+/** @file SuperDCA-convert.cpp
+	Utility program for converting binary (.scb) coupling files of SuperDCA into the text format.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+
+#include "boost/program_options.hpp"
+
+#include "Coupling_binary_file.hpp"
+#include "Coupling_text_file.hpp"
+#include "SuperDCA_commons.h"
+
+namespace superdca {
+
+// Write one coupling in the same format as SuperDCA writes text coupling files
+inline void write_coupling( Coupling_text_writer& out, const Coupling_record& coupling, bool norm_of_mean )
+{
+	if( norm_of_mean ) { out.add( coupling.score, coupling.i, coupling.j, coupling.ij, coupling.ji ); }
+	else { out.add( coupling.score, coupling.i, coupling.j ); }
+}
+
+} // namespace superdca
+
+/*
+ * The main program
+ */
+int main(int argc, char **argv)
+{
+	namespace po = boost::program_options;
+	using namespace superdca;
+
+	bool verbose = false;
+	std::size_t top = 0;
+	std::string input_filename;
+	std::string output_filename;
+	std::string compress_output = "none";
+
+	po::options_description options( "SuperDCA-convert usage: SuperDCA-convert [options] <binary coupling file>" );
+	options.add_options()
+		("help,h", "Print this help message.")
+		("verbose,v", po::bool_switch( &verbose )->default_value(verbose), "Be verbose.")
+		("top", po::value< std::size_t >( &top )->default_value(top), "Write only the N best couplings, best first (0=write all, in the order of the binary file).")
+		("output,o", po::value< std::string >( &output_filename ), "Name of the text file (default: named after the alignment, as SuperDCA would name it).")
+		("compress-output", po::value< std::string >( &compress_output )->default_value(compress_output)->notifier( []( const std::string& method ) { Output_compression::parse_method( method ); } ), "Compress the text file: 'none', 'gzip' or 'zstd'.")
+		("input", po::value< std::string >( &input_filename ), "Binary (.scb) coupling file.")
+	;
+	po::positional_options_description popt;
+	popt.add("input", 1);
+
+	try
+	{
+		po::variables_map options_map;
+		po::store( po::command_line_parser(argc, argv).options(options).positional(popt).run(), options_map );
+		po::notify(options_map);
+		if( options_map.count("help") || input_filename.empty() )
+		{
+			std::cout << options << std::endl;
+			Exit( input_filename.empty() && !options_map.count("help") ? EXIT_FAILURE : EXIT_SUCCESS );
+		}
+	}
+	catch( std::exception& e )
+	{
+		std::cerr << "SuperDCA-convert error: " << e.what() << "\n\n" << options << std::endl;
+		Exit(EXIT_FAILURE);
+	}
+
+	std::unique_ptr<Coupling_binary_reader> scb;
+	try
+	{
+		scb.reset( new Coupling_binary_reader( input_filename ) );
+	}
+	catch( std::exception& e )
+	{
+		std::cerr << "SuperDCA-convert error: " << e.what() << "\n";
+		Exit(EXIT_FAILURE);
+	}
+	const auto& header = scb->header();
+
+	if( verbose )
+	{
+		std::cout << "SuperDCA-convert: file \"" << input_filename << "\" contains " << ( header.norm_of_mean() ? "norm-of-mean " : "" ) << "couplings of "
+			<< ( header.symmetric() ? "alignment" : "the scan of alignment" ) << " \"" << scb->id() << "\"\n";
+	}
+
+	std::ostringstream extension;
+	extension << header.base_index << "-based"; // indicate base index
+	if( top > 0 ) { extension << ".top" << top; } else { extension << ".all"; }
+
+	const Output_compression compression( Output_compression::parse_method( compress_output ) );
+	auto couplings_file = output_filename.empty()
+		? get_unique_ofstream( scb->id()+(header.symmetric() ? "" : "_scan")+".SuperDCA_couplings."+extension.str(), compression )
+		: stream_name_association<std::ofstream>( std::ofstream( output_filename, std::ios_base::out | std::ios_base::binary ), output_filename, compression );
+	if( !couplings_file.stream()->is_open() || !couplings_file.stream()->good() )
+	{
+		std::cerr << "SuperDCA-convert error: could not open file \"" << couplings_file.name() << "\" for writing\n";
+		Exit(EXIT_FAILURE);
+	}
+	if( verbose )
+	{
+		std::cout << "SuperDCA-convert: writing coupling values to file \"" << couplings_file.name() << "\"\n";
+	}
+
+	auto& couplings_out = *couplings_file.stream();
+	Coupling_text_writer text_writer( &couplings_out, header.base_index, scb->loci1(), scb->loci2(), std::max( std::thread::hardware_concurrency(), 1u ) );
+
+	std::size_t n_written = 0;
+	try
+	{
+		if( top == 0 || header.best_first() )
+		{
+			// the file is either converted as is, or is already sorted best first
+			scb->for_each( [&]( const Coupling_record& coupling )
+			{
+				if( top > 0 && n_written == top ) { return; }
+				write_coupling( text_writer, coupling, header.norm_of_mean() );
+				++n_written;
+			} );
+		}
+		else
+		{
+			// keep the 'top' best in a min-heap; of equal scores, the one that comes first in the file ranks higher
+			using ranked_t = std::pair< Coupling_record, std::size_t >;
+			const auto better = []( const ranked_t& a, const ranked_t& b ) { return a.first.score > b.first.score || ( a.first.score == b.first.score && a.second < b.second ); };
+			std::vector< ranked_t > best; best.reserve( top );
+			std::size_t order = 0;
+			scb->for_each( [&]( const Coupling_record& coupling )
+			{
+				const ranked_t candidate( coupling, order++ );
+				if( best.size() < top ) { best.push_back( candidate ); std::push_heap( best.begin(), best.end(), better ); }
+				else if( better( candidate, best.front() ) )
+				{
+					std::pop_heap( best.begin(), best.end(), better );
+					best.back() = candidate;
+					std::push_heap( best.begin(), best.end(), better );
+				}
+			} );
+			std::sort( best.begin(), best.end(), better );
+			for( const auto& coupling: best ) { write_coupling( text_writer, coupling.first, header.norm_of_mean() ); }
+			n_written = best.size();
+		}
+	}
+	catch( std::exception& e )
+	{
+		std::cerr << "SuperDCA-convert error: " << e.what() << "\n";
+		Exit(EXIT_FAILURE);
+	}
+	text_writer.finish();
+	couplings_file.close();
+
+	if( !couplings_out.good() )
+	{
+		std::cerr << "SuperDCA-convert error: could not write coupling values to file \"" << couplings_file.name() << "\"\n";
+		Exit(EXIT_FAILURE);
+	}
+	if( verbose )
+	{
+		std::cout << "SuperDCA-convert: wrote " << n_written << " coupling values\n";
+	}
+
+	Exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,219 @@
+/** @file SuperDCA-merge.cpp
+	Utility program for combining the partial coupling files of a sharded SuperDCA run.
+
+	Copyright (c) 2016-2018 Santeri Puranen.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+	@author Santeri Puranen
+	$Id: $
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+
+#include "boost/program_options.hpp"
+
+#include "Coupling_partial_file.hpp"
+#include "Coupling_text_file.hpp"
+#include "SuperDCA_commons.h"
+
+namespace superdca {
+
+// Check that 'partial' belongs to the same run as 'first'
+bool is_compatible( const Coupling_partial_reader& first, const Coupling_partial_reader& partial )
+{
+	const auto& a = first.header();
+	const auto& b = partial.header();
+	return a.n_shards == b.n_shards && a.flags == b.flags && a.base_index == b.base_index
+		&& first.id() == partial.id() && first.rows() == partial.rows() && first.cols() == partial.cols();
+}
+
+} // namespace superdca
+
+/*
+ * The main program
+ */
+int main(int argc, char **argv)
+{
+	namespace po = boost::program_options;
+	using namespace superdca;
+
+	bool verbose = false;
+	std::string compress_output = "none";
+	std::vector<std::string> partial_filenames;
+
+	po::options_description options( "SuperDCA-merge usage: SuperDCA-merge [options] <partial files>" );
+	options.add_options()
+		("help,h", "Print this help message.")
+		("verbose,v", po::bool_switch( &verbose )->default_value(verbose), "Be verbose.")
+		("compress-output", po::value< std::string >( &compress_output )->default_value(compress_output)->notifier( []( const std::string& method ) { Output_compression::parse_method( method ); } ), "Compress the coupling file: 'none', 'gzip' or 'zstd'.")
+		("partial", po::value< std::vector<std::string> >( &partial_filenames ), "Partial coupling files, one for each shard of the run.")
+	;
+	po::positional_options_description popt;
+	popt.add("partial", -1);
+
+	try
+	{
+		po::variables_map options_map;
+		po::store( po::command_line_parser(argc, argv).options(options).positional(popt).run(), options_map );
+		po::notify(options_map);
+		if( options_map.count("help") || partial_filenames.empty() )
+		{
+			std::cout << options << std::endl;
+			Exit( partial_filenames.empty() && !options_map.count("help") ? EXIT_FAILURE : EXIT_SUCCESS );
+		}
+	}
+	catch( std::exception& e )
+	{
+		std::cerr << "SuperDCA-merge error: " << e.what() << "\n\n" << options << std::endl;
+		Exit(EXIT_FAILURE);
+	}
+
+	// Map the partial files and check that they form one complete run
+	std::vector< std::unique_ptr<Coupling_partial_reader> > partials;
+	try
+	{
+		for( const auto& filename: partial_filenames )
+		{
+			partials.emplace_back( new Coupling_partial_reader( filename ) );
+			if( verbose )
+			{
+				const auto& header = partials.back()->header();
+				std::cout << "SuperDCA-merge: file \"" << filename << "\" contains " << header.n_shard_rows << " rows of shard " << header.shard+1 << " of " << header.n_shards << "\n";
+			}
+		}
+	}
+	catch( std::exception& e )
+	{
+		std::cerr << "SuperDCA-merge error: " << e.what() << "\n";
+		Exit(EXIT_FAILURE);
+	}
+
+	const auto& first = *partials.front();
+	const auto& header = first.header();
+	const std::size_t n_rows = header.n_rows;
+	const std::size_t n_cols = header.n_cols;
+
+	std::vector<bool> have_shard( header.n_shards, false );
+	std::vector<const float*> row_scores( n_rows, nullptr );
+
+	for( std::size_t i = 0; i < partials.size(); ++i )
+	{
+		const auto& partial = *partials[i];
+		if( !is_compatible( first, partial ) )
+		{
+			std::cerr << "SuperDCA-merge error: file \"" << partial_filenames[i] << "\" does not belong to the same run as file \"" << partial_filenames.front() << "\"\n";
+			Exit(EXIT_FAILURE);
+		}
+		if( have_shard[partial.header().shard] )
+		{
+			std::cerr << "SuperDCA-merge error: shard " << partial.header().shard+1 << " is given more than once\n";
+			Exit(EXIT_FAILURE);
+		}
+		have_shard[partial.header().shard] = true;
+
+		for( std::size_t record = 0; record < partial.size(); ++record )
+		{
+			const auto position = partial.row_position( record );
+			if( position >= n_rows || row_scores[position] )
+			{
+				std::cerr << "SuperDCA-merge error: file \"" << partial_filenames[i] << "\" contains an invalid or duplicate row\n";
+				Exit(EXIT_FAILURE);
+			}
+			row_scores[position] = partial.scores( record );
+		}
+	}
+
+	for( std::size_t shard = 0; shard < have_shard.size(); ++shard )
+	{
+		if( !have_shard[shard] )
+		{
+			std::cerr << "SuperDCA-merge error: shard " << shard+1 << " of " << header.n_shards << " is missing\n";
+			Exit(EXIT_FAILURE);
+		}
+	}
+	for( std::size_t r = 0; r < n_rows; ++r )
+	{
+		if( !row_scores[r] )
+		{
+			std::cerr << "SuperDCA-merge error: no shard contains row " << first.rows()[r]+header.base_index << "\n";
+			Exit(EXIT_FAILURE);
+		}
+	}
+	if( header.symmetric() && n_rows != n_cols )
+	{
+		std::cerr << "SuperDCA-merge error: a symmetric run must have equal numbers of rows and columns\n";
+		Exit(EXIT_FAILURE);
+	}
+
+	// Write the final couplings, in the same order and format as an unsharded run would
+	std::ostringstream extension;
+	extension << header.base_index << "-based"; // indicate base index
+
+	auto couplings_file = get_unique_ofstream( first.id()+(header.symmetric() ? "" : "_scan")+".SuperDCA_couplings."+extension.str()+".all", Output_compression( Output_compression::parse_method( compress_output ) ) );
+	if( !couplings_file.stream()->is_open() || !couplings_file.stream()->good() )
+	{
+		std::cerr << "SuperDCA-merge error: could not open file \"" << couplings_file.name() << "\" for writing\n";
+		Exit(EXIT_FAILURE);
+	}
+	if( verbose )
+	{
+		std::cout << "SuperDCA-merge: writing coupling values to file \"" << couplings_file.name() << "\"\n";
+	}
+
+	auto& couplings_out = *couplings_file.stream();
+	Coupling_text_writer text_writer( &couplings_out, header.base_index, first.rows(), first.cols(), std::max( std::thread::hardware_concurrency(), 1u ) );
+
+	for( std::size_t r = 0; r < n_rows; ++r )
+	{
+		if( header.symmetric() )
+		{
+			for( std::size_t n = 0; n < r; ++n )
+			{
+				const float Jij_norm = row_scores[r][n];
+				const float Jji_norm = row_scores[n][r];
+
+				text_writer.add( (Jij_norm+Jji_norm)*0.5, r, n );
+			}
+		}
+		else
+		{
+			for( std::size_t n = 0; n < n_cols; ++n )
+			{
+				text_writer.add( row_scores[r][n], r, n );
+			}
+		}
+	}
+	text_writer.finish();
+	couplings_file.close();
+
+	if( !couplings_out.good() )
+	{
+		std::cerr << "SuperDCA-merge error: could not write coupling values to file \"" << couplings_file.name() << "\"\n";
+		Exit(EXIT_FAILURE);
+	}
+	if( verbose )
+	{
+		std::cout << "SuperDCA-merge: merged " << partials.size() << " shards\n";
+	}
+
+	Exit(EXIT_SUCCESS);
+}
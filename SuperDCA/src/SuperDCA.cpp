@@ -31,6 +31,8 @@
 
 #include "SuperDCA.h"
 #include "plmDCA.hpp"
+#include "SuperDCA_batch.hpp"
+#include "SuperDCA_daemon.hpp"
 #include "Stopwatch.hpp"
 #include "SuperDCA_commons.h"
 
@@ -48,6 +50,10 @@ int main(int argc, char **argv)
 
 	using namespace superdca;
 
+	mpi::init( &argc, &argv ); // does nothing if compiled without MPI support
+	numa::process_cpus(); // record the cpus of the process before --numa runs pin any threads
+	if( !mpi::is_master() ) { std::cout.setstate( std::ios_base::failbit ); } // only rank 0 talks to the user
+
 	std::cout << SuperDCA_options::s_get_version_string() << "\n"
 			  << apegrunt::Apegrunt_options::s_get_version_string() << "\n\n"
 			  << SuperDCA_options::s_get_copyright_notice_string() << "\n"
@@ -107,6 +113,8 @@ int main(int argc, char **argv)
 		}
 		plmdca_options.set_cuda( SuperDCA_options::cuda() );
 		plmdca_options.set_threads( SuperDCA_options::threads() );
+		plmdca_options.set_nodes( mpi::size() );
+		plmdca_options.set_output_compression( SuperDCA_options::output_compression() );
 
 		#ifndef SUPERDCA_NO_TBB // Threading with Threading Building Blocks
 		SuperDCA_options::threads() > 0 ? tbb_task_scheduler.initialize( SuperDCA_options::threads() ) : tbb_task_scheduler.initialize(); // Threading task scheduler
@@ -127,6 +135,16 @@ int main(int argc, char **argv)
 			*SuperDCA_options::get_out_stream() << "\n" << std::endl;
 		}
 		#endif // #ifndef SUPERDCA_NO_TBB
+		#ifndef SUPERDCA_NO_MPI
+		if( SuperDCA_options::verbose() && mpi::enabled() )
+		{
+			*SuperDCA_options::get_out_stream() << "SuperDCA: MPI run with " << mpi::size() << " ranks (rank 0 distributes work to " << mpi::size()-1 << " worker ranks)\n" << std::endl;
+		}
+		if( mpi::is_master() && SuperDCA_options::nodes() > 0 && SuperDCA_options::nodes() != mpi::size() )
+		{
+			*SuperDCA_options::get_err_stream() << "SuperDCA warning: user requested " << SuperDCA_options::nodes() << " nodes, but the MPI run has " << mpi::size() << " ranks; the number of ranks is set by the MPI launcher\n";
+		}
+		#endif // #ifndef SUPERDCA_NO_MPI
 	}
 
 	catch( std::exception& e )
@@ -146,6 +164,80 @@ int main(int argc, char **argv)
 	stopwatch::stopwatch globaltimer( SuperDCA_options::verbose() ? SuperDCA_options::get_out_stream() : nullptr ); // for timing statistics
 	globaltimer.start();
 
+	// Batch mode: the jobs of the manifest share this process and its threads
+	if( superdca_options.has_batch_filename() )
+	{
+		if( superdca_options.has_alignment_filenames() || superdca_options.has_filterlist_filename() || superdca_options.has_samplelist_filename() || superdca_options.has_locilist_filename() || SuperDCA_options::output_filtered_alignment() || superdca_options.has_serve_socket() )
+		{
+			*SuperDCA_options::get_err_stream() << "SuperDCA error: alignment, filter list, sample list and loci list files, and --serve, cannot be combined with --batch; list the alignments in the batch manifest instead\n\n";
+			Exit(EXIT_FAILURE);
+		}
+		if( plmDCA_options::has_shard() || plmDCA_options::has_time_budget() || plmDCA_options::has_priority_file() || plmDCA_options::has_locus_log() || mpi::enabled() )
+		{
+			*SuperDCA_options::get_err_stream() << "SuperDCA error: --shard, --time-budget, --priority-file, --locus-log and MPI runs are not supported in batch mode\n\n";
+			Exit(EXIT_FAILURE);
+		}
+
+		std::vector<Batch_job> jobs;
+		try
+		{
+			jobs = read_batch_manifest( superdca_options.get_batch_filename() );
+		}
+		catch( std::exception& e )
+		{
+			*SuperDCA_options::get_err_stream() << "SuperDCA error: " << e.what() << "\n\n";
+			Exit(EXIT_FAILURE);
+		}
+
+		#ifndef SUPERDCA_NO_TBB
+		const std::size_t n_threads = SuperDCA_options::threads() > 0 ? SuperDCA_options::threads() : tbb::task_scheduler_init::default_num_threads();
+		#else
+		const std::size_t n_threads = 1;
+		#endif // #ifndef SUPERDCA_NO_TBB
+		const std::size_t n_concurrent = SuperDCA_options::batch_jobs() > 0 ? SuperDCA_options::batch_jobs() : n_threads;
+
+		if( SuperDCA_options::verbose() )
+		{
+			*SuperDCA_options::get_out_stream() << "SuperDCA: batch of " << jobs.size() << " jobs from manifest \"" << superdca_options.get_batch_filename() << "\"; process up to " << n_concurrent << " jobs at a time\n";
+		}
+
+		// jobs run concurrently, so their detailed output would be interleaved; the batch reports on each job instead
+		apegrunt_options.set_verbose( false );
+		plmdca_options.set_verbose( false );
+		plmdca_options.set_adaptive_scoring( false ); // jobs share the scoring mode, so it must not change under a running job
+
+		// every job plans its memory use on its own (see plan_memory()), so each one gets an equal share of the memory limit
+		const std::size_t n_running = std::max( std::min( n_concurrent, jobs.size() ), std::size_t(1) );
+		const uint64_t memory_limit = plmDCA_options::has_memory_limit() ? plmDCA_options::memory_limit() : detect_memory_limit().bytes;
+		if( memory_limit > 0 )
+		{
+			plmdca_options.set_memory_limit( std::max( memory_limit / n_running, uint64_t(1) ) );
+			if( SuperDCA_options::verbose() )
+			{
+				*SuperDCA_options::get_out_stream() << "SuperDCA: each job may use up to " << apegrunt::memory_string( plmDCA_options::memory_limit() ) << " of memory\n";
+			}
+		}
+
+		const auto n_failed = run_batch<double,alignment_default_storage_t>( jobs, n_concurrent, apegrunt_options.get_begin_locus(), apegrunt_options.get_end_locus() );
+
+		if( SuperDCA_options::verbose() )
+		{
+			*SuperDCA_options::get_out_stream() << "SuperDCA: batch completed; " << jobs.size()-n_failed << " out of " << jobs.size() << " jobs succeeded\n";
+		}
+		globaltimer.stop(); globaltimer.print_timing_stats();
+		if( interrupt::requested() )
+		{
+			*SuperDCA_options::get_err_stream() << "SuperDCA: batch interrupted by signal " << interrupt::signal_number().load() << "\n\n";
+			Exit(EXIT_FAILURE);
+		}
+		if( n_failed > 0 )
+		{
+			*SuperDCA_options::get_err_stream() << "SuperDCA error: " << n_failed << " out of " << jobs.size() << " batch jobs failed\n\n";
+			Exit(EXIT_FAILURE);
+		}
+		Exit(EXIT_SUCCESS);
+	}
+
 	std::vector< apegrunt::Alignment_ptr<default_state_t> > alignments;
 	stopwatch::stopwatch cputimer( SuperDCA_options::verbose() ? SuperDCA_options::get_out_stream() : nullptr ); // for timing statistics
 
@@ -216,8 +308,9 @@ int main(int argc, char **argv)
 				*SuperDCA_options::get_out_stream() << "SuperDCA: alignment has " << alignment->size() << " sequences and " << alignment->n_loci() << " SNPs\n";
 				alignment->statistics( SuperDCA_options::get_out_stream() );
 			}
+			if( mpi::is_master() ) // in an MPI run only rank 0 writes files
 			{
-				auto alignment_file = get_unique_ofstream( alignment->id_string()+".fasta" );
+				auto alignment_file = get_unique_ofstream( alignment->id_string()+".fasta", SuperDCA_options::output_compression() );
 				if( SuperDCA_options::verbose() )
 				{
 					*SuperDCA_options::get_out_stream() << "SuperDCA: write alignment to file " << alignment_file.name() << "\n";
@@ -253,12 +346,12 @@ int main(int argc, char **argv)
 		cputimer.stop();
 		if( SuperDCA_options::verbose() ) { cputimer.print_timing_stats(); *SuperDCA_options::get_out_stream() << "\n"; }
 
-		if( SuperDCA_options::output_filterlist_alignment() )
+		if( SuperDCA_options::output_filterlist_alignment() && mpi::is_master() )
 		{
 			// output alignment
 			cputimer.start();
 			{
-				auto alignment_file = get_unique_ofstream( alignments.front()->id_string()+".fasta" );
+				auto alignment_file = get_unique_ofstream( alignments.front()->id_string()+".fasta", SuperDCA_options::output_compression() );
 				if( SuperDCA_options::verbose() )
 				{
 					*SuperDCA_options::get_out_stream() << "SuperDCA: write filterlist-selected alignment to file " << alignment_file.name() << "\n";
@@ -276,13 +369,13 @@ int main(int argc, char **argv)
 		{
 			alignment = alignment_filter.operator()<alignment_default_storage_t>( alignment );
 
-			if( SuperDCA_options::output_filtered_alignment() )
+			if( SuperDCA_options::output_filtered_alignment() && mpi::is_master() )
 			{
 				cputimer.start();
 
 				// output alignment
 				{
-					auto alignment_file = get_unique_ofstream( alignment->id_string()+".fasta" );
+					auto alignment_file = get_unique_ofstream( alignment->id_string()+".fasta", SuperDCA_options::output_compression() );
 					if( SuperDCA_options::verbose() )
 					{
 						*SuperDCA_options::get_out_stream() << "SuperDCA: write filtered alignment to file " << alignment_file.name() << "\n";
@@ -292,7 +385,7 @@ int main(int argc, char **argv)
 
 				// output loci list
 				{
-					auto locilist_file = get_unique_ofstream( alignment->id_string()+".loci"  );
+					auto locilist_file = get_unique_ofstream( alignment->id_string()+".loci", SuperDCA_options::output_compression() );
 					if( SuperDCA_options::verbose() )
 					{
 						*SuperDCA_options::get_out_stream() << "SuperDCA: write original loci indices for filtered alignment to file " << locilist_file.name() << "\n";
@@ -330,11 +423,11 @@ int main(int argc, char **argv)
 		cputimer.stop();
 		if( plmDCA_options::verbose() ) { cputimer.print_timing_stats(); }
 
-		if( SuperDCA_options::output_samplelist_alignment() )
+		if( SuperDCA_options::output_samplelist_alignment() && mpi::is_master() )
 		{
 			cputimer.start();
 			{
-				auto alignment_file = get_unique_ofstream( alignments.front()->id_string()+".fasta" );
+				auto alignment_file = get_unique_ofstream( alignments.front()->id_string()+".fasta", SuperDCA_options::output_compression() );
 				if( SuperDCA_options::verbose() )
 				{
 					*SuperDCA_options::get_out_stream() << "SuperDCA: write samplelist-selected alignment to file " << alignment_file.name() << "\n";
@@ -359,7 +452,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if( apegrunt_options.output_allele_frequencies() )
+	if( apegrunt_options.output_allele_frequencies() && mpi::is_master() )
 	{
 		for( auto& alignment: fourstate_alignments )
 		{
@@ -404,6 +497,19 @@ int main(int argc, char **argv)
 
     *SuperDCA_options::get_out_stream() << "\n";
 
+	// daemon mode: keep the preprocessed alignments resident and serve jobs until asked to stop
+	if( superdca_options.has_serve_socket() )
+	{
+		if( mpi::enabled() )
+		{
+			*SuperDCA_options::get_err_stream() << "SuperDCA error: --serve is not supported in MPI runs\n\n";
+			Exit(EXIT_FAILURE);
+		}
+		const bool served = serve<double,alignment_default_storage_t>( superdca_options.get_serve_socket(), alignments, fourstate_alignments, loci_list );
+		globaltimer.stop(); globaltimer.print_timing_stats();
+		Exit( served ? EXIT_SUCCESS : EXIT_FAILURE );
+	}
+
 	// run the inference
 	bool plmDCA_success = run_plmDCA<double>( fourstate_alignments, loci_list );
 
@@ -412,6 +518,11 @@ int main(int argc, char **argv)
 		*SuperDCA_options::get_out_stream() << "SuperDCA: analysis completed\n";
 	}
 	globaltimer.stop(); globaltimer.print_timing_stats();
+	if(	!plmDCA_success && interrupt::requested() )
+	{
+		*SuperDCA_options::get_err_stream() << "SuperDCA: run interrupted by signal " << interrupt::signal_number().load() << "\n\n";
+		Exit(EXIT_FAILURE);
+	}
 	if(	!plmDCA_success )
 	{
 		*SuperDCA_options::get_err_stream() << "SuperDCA error: plmDCA failed\n\n";
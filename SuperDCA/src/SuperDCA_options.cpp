@@ -19,6 +19,8 @@
 	$Id: $
 */
 
+#include <stdexcept>
+
 #include "SuperDCA_options.h"
 #include "SuperDCA_version.h"
 
@@ -32,6 +34,8 @@ bool SuperDCA_options::s_output_SNPs = false;
 bool SuperDCA_options::s_output_filtered_alignment = false;
 bool SuperDCA_options::s_output_filterlist_alignment = false;
 bool SuperDCA_options::s_output_samplelist_alignment = false;
+std::string SuperDCA_options::s_compress_output = "none";
+int SuperDCA_options::s_compression_level = -1;
 //bool SuperDCA_options::s_translate_output_alignment = false;
 //bool SuperDCA_options::s_force_translation = false;
 //bool SuperDCA_options::s_complementary_read = false;
@@ -50,6 +54,7 @@ int SuperDCA_options::s_nodes = -1;
 int SuperDCA_options::s_nodes = 1;
 #endif // SUPERDCA_NO_MPI
 bool SuperDCA_options::s_use_cuda = false;
+int SuperDCA_options::s_batch_jobs = 0;
 
 std::string SuperDCA_options::s_options_string;
 
@@ -135,6 +140,13 @@ bool SuperDCA_options::output_samplelist_alignment() { return s_output_samplelis
 bool SuperDCA_options::has_locilist_filename() const { return !m_locilist_file_name.empty(); }
 const std::string& SuperDCA_options::get_locilist_filename() const { return m_locilist_file_name; }
 
+bool SuperDCA_options::has_batch_filename() const { return !m_batch_file_name.empty(); }
+const std::string& SuperDCA_options::get_batch_filename() const { return m_batch_file_name; }
+int SuperDCA_options::batch_jobs() { return s_batch_jobs; }
+
+bool SuperDCA_options::has_serve_socket() const { return !m_serve_socket_name.empty(); }
+const std::string& SuperDCA_options::get_serve_socket() const { return m_serve_socket_name; }
+
 void SuperDCA_options::set_out_stream( std::ostream *out ) { s_out = out->good() ? out : nullptr; }
 void SuperDCA_options::set_err_stream( std::ostream *err ) { s_err = err->good() ? err : nullptr; }
 
@@ -152,6 +164,11 @@ int SuperDCA_options::nodes() { return s_nodes; }
 
 int SuperDCA_options::threads() { return s_threads; }
 
+Output_compression SuperDCA_options::output_compression()
+{
+	return Output_compression( Output_compression::parse_method( s_compress_output ), s_compression_level, s_threads > 0 ? s_threads : 0 );
+}
+
 void SuperDCA_options::m_init()
 {
 	namespace po = boost::program_options;
@@ -166,10 +183,15 @@ void SuperDCA_options::m_init()
 		("output-filterlist-alignment", po::bool_switch( &SuperDCA_options::s_output_filterlist_alignment )->default_value(SuperDCA_options::s_output_filterlist_alignment)->notifier(SuperDCA_options::s_init_output_filterlist_alignment), "Output alignment after filterlist selection.")
 		("samplelistfile", po::value< std::string >( &m_samplelist_file_name ), "The sample filter list input filename.")
 		("output-samplelist-alignment", po::bool_switch( &SuperDCA_options::s_output_samplelist_alignment )->default_value(SuperDCA_options::s_output_samplelist_alignment)->notifier(SuperDCA_options::s_init_output_samplelist_alignment), "Output alignment after samplelist selection.")
+		("compress-output", po::value< std::string >( &SuperDCA_options::s_compress_output )->default_value(SuperDCA_options::s_compress_output)->notifier(SuperDCA_options::s_init_compress_output), "Compress the output alignments, loci lists, weights and coupling text files: 'none', 'gzip' or 'zstd'. Blocks of the output are compressed in parallel, and the files remain readable with standard tools (zcat, zstd -d, ...).")
+		("compression-level", po::value< int >( &SuperDCA_options::s_compression_level )->default_value(SuperDCA_options::s_compression_level)->notifier(SuperDCA_options::s_init_compression_level), "Compression level of --compress-output (-1=the default of the method; gzip: 1-9, zstd: 1-22).")
 //		("translate-output-alignment", po::bool_switch( &SuperDCA_options::s_translate_output_alignment )->default_value(SuperDCA_options::s_translate_output_alignment)->notifier(SuperDCA_options::s_init_translate_output_alignment), "Output alignments are translated into amino acid sequences.")
 //		("force-translation", po::bool_switch( &SuperDCA_options::s_force_translation )->default_value(SuperDCA_options::s_force_translation)->notifier(SuperDCA_options::s_init_force_translation), "Ignore start and stop codons when performing translation.")
 //		("complementary-read", po::bool_switch( &SuperDCA_options::s_complementary_read )->default_value(SuperDCA_options::s_complementary_read)->notifier(SuperDCA_options::s_init_complementary_read), "Read sequence from the complementary strand.")
 		("locilistfile", po::value< std::string >( &m_locilist_file_name ), "Analysable loci list filename.")
+		("batch", po::value< std::string >( &m_batch_file_name ), "Batch mode: run one analysis for each line of the given manifest file (one alignment filename per line, or two for an inter-alignment scan), sharing the threads of a single process.")
+		("batch-jobs", po::value< int >( &SuperDCA_options::s_batch_jobs )->default_value(SuperDCA_options::s_batch_jobs)->notifier(SuperDCA_options::s_init_batch_jobs), "Maximum number of batch jobs that are processed at the same time (0=one per thread).")
+		("serve", po::value< std::string >( &m_serve_socket_name ), "Daemon mode: preprocess the input alignment(s) once, then serve plmDCA jobs (loci lists, sample lists, lambdas) on the given UNIX domain socket, sending the coupling values back to the client.")
 		//("outfile", po::value< std::string >( &SuperDCA_options::s_out_file_name )->default_value(SuperDCA_options::s_out_file_name), "The output filename.")
 		//("logfile", po::value< std::string >( &SuperDCA_options::s_log_file_name )->default_value(SuperDCA_options::s_log_file_name), "Log filename.")
 		//("errfile", po::value< std::string >( &SuperDCA_options::s_err_file_name )->default_value(SuperDCA_options::s_err_file_name), "Error log filename.")
@@ -212,7 +234,7 @@ bool SuperDCA_options::CheckOptions( boost::program_options::variables_map *varm
 			*s_out << "SuperDCA: Being verbose." << std::endl;
 		}
 */
-		if( !varmap->count("alignmentfile") && s_err )
+		if( !varmap->count("alignmentfile") && !varmap->count("batch") && s_err )
 		{
 			*s_err << "SuperDCA ERROR: No alignment file specified!" << std::endl;
 			if( s_out )
@@ -253,6 +275,14 @@ void SuperDCA_options::s_init_verbose( const bool& verbose )
 	}
 }
 
+void SuperDCA_options::s_init_batch_jobs( const int& njobs )
+{
+	if( njobs < 0 )
+	{
+		throw std::invalid_argument( "invalid number of batch jobs (must be >= 0)" );
+	}
+}
+
 #ifndef SUPERDCA_NO_TBB // Threading with Threading Building Blocks
 void SuperDCA_options::s_init_threads( const int& nthreads )
 {
@@ -297,6 +327,23 @@ void SuperDCA_options::s_init_output_filtered_alignment( const bool& flag )
 	}
 }
 
+void SuperDCA_options::s_init_compress_output( const std::string& method )
+{
+	Output_compression::parse_method( method ); // throws if invalid
+	if( s_verbose && s_out && method != "none" )
+	{
+		*s_out << "SuperDCA: compress output files with " << method << ".\n";
+	}
+}
+
+void SuperDCA_options::s_init_compression_level( const int& level )
+{
+	if( level != -1 && ( level < 1 || level > 22 ) )
+	{
+		throw std::invalid_argument( "invalid compression level (expected -1, or 1-9 for gzip and 1-22 for zstd)" );
+	}
+}
+
 void SuperDCA_options::s_init_output_filterlist_alignment( const bool& flag )
 {
 	if( s_verbose && s_out && flag )
@@ -19,10 +19,34 @@
 	$Id: $
 */
 
+#include <sstream>
+#include <limits>
+#include <cmath> // for std::isfinite
+#include <stdexcept>
+#include <boost/filesystem.hpp> // for boost::filesystem::is_directory
+
 #include "plmDCA_options.h"
+#include "Score_precision.hpp"
 
 namespace superdca {
 
+// Plain bytes, or a number with a binary K, M, G or T suffix; 'what' names the quantity in error messages
+static uint64_t parse_byte_size( const std::string& spec, const std::string& what )
+{
+	std::istringstream fields( spec );
+	double value = 0.0;
+	std::string suffix;
+	if( !(fields >> value) || value <= 0.0 ) { throw std::invalid_argument( "invalid " + what + " \"" + spec + "\" (expected bytes, or a number with a K, M, G or T suffix)" ); }
+	fields >> suffix;
+	double multiplier = 1.0;
+	if( suffix == "K" || suffix == "k" ) { multiplier = 1024.0; }
+	else if( suffix == "M" || suffix == "m" ) { multiplier = 1024.0*1024.0; }
+	else if( suffix == "G" || suffix == "g" ) { multiplier = 1024.0*1024.0*1024.0; }
+	else if( suffix == "T" || suffix == "t" ) { multiplier = 1024.0*1024.0*1024.0*1024.0; }
+	else if( !suffix.empty() || !(fields >> std::ws).eof() ) { throw std::invalid_argument( "invalid " + what + " \"" + spec + "\" (expected bytes, or a number with a K, M, G or T suffix)" ); }
+	return uint64_t( value*multiplier );
+}
+
 std::ostream* plmDCA_options::s_out = nullptr;
 std::ostream* plmDCA_options::s_err = nullptr;
 uint plmDCA_options::s_state = 1;
@@ -52,11 +76,49 @@ bool plmDCA_options::s_no_reweighting = false;
 bool plmDCA_options::s_no_estimate = true; //false;
 bool plmDCA_options::s_no_dca = false;
 bool plmDCA_options::s_no_coupling_output = false;
+std::ostream* plmDCA_options::s_couplings_stream = nullptr;
+Output_compression plmDCA_options::s_output_compression;
+std::string plmDCA_options::s_output_format = "text";
+std::string plmDCA_options::s_scb_compression = "none";
+bool plmDCA_options::s_sort_output = false;
+std::size_t plmDCA_options::s_top_n = 0;
+double plmDCA_options::s_top_fraction = 1.0;
+std::string plmDCA_options::s_sort_memory_spec = "1G";
+uint64_t plmDCA_options::s_sort_memory = uint64_t(1)<<30;
+double plmDCA_options::s_min_coupling = -std::numeric_limits<double>::infinity();
+uint64_t plmDCA_options::s_min_distance = 0;
+uint64_t plmDCA_options::s_max_distance = 0;
+
+bool plmDCA_options::s_output_optimizer_history = false;
+std::string plmDCA_options::s_cost_history_file_name;
+bool plmDCA_options::s_no_intra_locus_parallelism = false;
+bool plmDCA_options::s_numa = false;
+std::string plmDCA_options::s_shard_spec;
+std::size_t plmDCA_options::s_shard = 0;
+std::size_t plmDCA_options::s_n_shards = 1;
+bool plmDCA_options::s_checkpoint = false;
+bool plmDCA_options::s_resume = false;
+std::string plmDCA_options::s_time_budget_spec;
+double plmDCA_options::s_time_budget = 0.0;
+std::chrono::steady_clock::time_point plmDCA_options::s_start_time = std::chrono::steady_clock::now(); // initialized at program start
+std::string plmDCA_options::s_locus_priority = "cost";
+std::string plmDCA_options::s_priority_file_name;
+double plmDCA_options::s_progress_interval = 10.0;
+std::string plmDCA_options::s_locus_log_file_name;
+std::string plmDCA_options::s_memory_limit_spec;
+uint64_t plmDCA_options::s_memory_limit = 0;
+bool plmDCA_options::s_plan_only = false;
+bool plmDCA_options::s_out_of_core = false;
+std::string plmDCA_options::s_scratch_dir = ".";
+bool plmDCA_options::s_adaptive_scoring = true;
 
 uint plmDCA_options::s_fp_precision = 32;
 bool plmDCA_options::s_norm_of_mean_scoring = false;
-int plmDCA_options::s_keep_n_best_couples = 1e7;
+std::string plmDCA_options::s_score_precision = "fp32";
+int plmDCA_options::s_keep_n_best_couples = -1;
 bool plmDCA_options::s_store_parameter_matrices_to_disk = false;
+std::string plmDCA_options::s_parameter_precision = "fp32";
+bool plmDCA_options::s_gauge_parameters = false;
 
 double plmDCA_options::s_gradient_threshold = 1e-3;
 double plmDCA_options::s_lambda_h = -1.0;
@@ -104,6 +166,9 @@ void plmDCA_options::set_threads( int nthreads ) { s_threads = nthreads; }
 void plmDCA_options::set_threads( int nthreads ) { } // do nothing
 #endif // SUPERDCA_NO_TBB
 
+const Output_compression& plmDCA_options::output_compression() { return s_output_compression; }
+void plmDCA_options::set_output_compression( const Output_compression& compression ) { s_output_compression = compression; }
+
 // alignment preprocessing
 double plmDCA_options::reweighting_threshold() { return s_reweighting_threshold; }
 bool plmDCA_options::reweight() { return !s_no_reweighting; }
@@ -112,7 +177,13 @@ bool plmDCA_options::output_weights() { return s_output_weights; }
 // algorithm and scoring
 uint plmDCA_options::fp_precision() { return s_fp_precision; }
 bool plmDCA_options::norm_of_mean_scoring() { return s_norm_of_mean_scoring; }
+void plmDCA_options::set_norm_of_mean_scoring( bool flag ) { s_norm_of_mean_scoring = flag; }
+const std::string& plmDCA_options::score_precision() { return s_score_precision; }
+bool plmDCA_options::adaptive_scoring() { return s_adaptive_scoring; }
+void plmDCA_options::set_adaptive_scoring( bool flag ) { s_adaptive_scoring = flag; }
 bool plmDCA_options::store_parameter_matrices_to_disk() { return s_store_parameter_matrices_to_disk; }
+const std::string& plmDCA_options::parameter_precision() { return s_parameter_precision; }
+bool plmDCA_options::gauge_parameters() { return s_gauge_parameters; }
 
 int plmDCA_options::keep_n_best_couples() { return s_keep_n_best_couples; }
 void plmDCA_options::set_keep_n_best_couples( int n ) { s_keep_n_best_couples=n; }
@@ -127,6 +198,48 @@ void plmDCA_options::set_lambda_J( double val ) { s_lambda_J = val; }
 bool plmDCA_options::no_estimate() { return s_no_estimate; }
 bool plmDCA_options::no_dca() { return s_no_dca; }
 bool plmDCA_options::no_coupling_output() { return s_no_coupling_output; }
+std::ostream* plmDCA_options::couplings_stream() { return s_couplings_stream; }
+void plmDCA_options::set_couplings_stream( std::ostream* out ) { s_couplings_stream = out; }
+const std::string& plmDCA_options::output_format() { return s_output_format; }
+bool plmDCA_options::binary_output() { return s_output_format == "scb"; }
+const std::string& plmDCA_options::scb_compression() { return s_scb_compression; }
+bool plmDCA_options::sort_output() { return s_sort_output || s_top_n > 0 || s_top_fraction < 1.0; }
+std::size_t plmDCA_options::top_n() { return s_top_n; }
+double plmDCA_options::top_fraction() { return s_top_fraction; }
+uint64_t plmDCA_options::sort_memory() { return s_sort_memory; }
+bool plmDCA_options::filter_couplings() { return std::isfinite( s_min_coupling ) || s_min_distance > 0 || s_max_distance > 0; }
+double plmDCA_options::min_coupling() { return s_min_coupling; }
+uint64_t plmDCA_options::min_distance() { return s_min_distance; }
+uint64_t plmDCA_options::max_distance() { return s_max_distance; }
+
+// scheduling
+bool plmDCA_options::output_optimizer_history() { return s_output_optimizer_history; }
+bool plmDCA_options::has_cost_history_file() { return !s_cost_history_file_name.empty(); }
+const std::string& plmDCA_options::cost_history_file() { return s_cost_history_file_name; }
+bool plmDCA_options::intra_locus_parallelism() { return !s_no_intra_locus_parallelism; }
+bool plmDCA_options::numa() { return s_numa; }
+bool plmDCA_options::has_shard() { return s_n_shards > 1; }
+std::size_t plmDCA_options::shard() { return s_shard; }
+std::size_t plmDCA_options::n_shards() { return s_n_shards; }
+bool plmDCA_options::checkpoint() { return s_checkpoint || s_resume; }
+bool plmDCA_options::resume() { return s_resume; }
+bool plmDCA_options::has_time_budget() { return s_time_budget > 0.0; }
+double plmDCA_options::time_budget() { return s_time_budget; }
+std::chrono::steady_clock::time_point plmDCA_options::start_time() { return s_start_time; }
+const std::string& plmDCA_options::locus_priority() { return s_locus_priority; }
+bool plmDCA_options::has_priority_file() { return !s_priority_file_name.empty(); }
+const std::string& plmDCA_options::priority_file() { return s_priority_file_name; }
+double plmDCA_options::progress_interval() { return s_progress_interval; }
+bool plmDCA_options::has_locus_log() { return !s_locus_log_file_name.empty(); }
+const std::string& plmDCA_options::locus_log() { return s_locus_log_file_name; }
+
+// memory planning
+bool plmDCA_options::has_memory_limit() { return s_memory_limit > 0; }
+uint64_t plmDCA_options::memory_limit() { return s_memory_limit; }
+void plmDCA_options::set_memory_limit( uint64_t bytes ) { s_memory_limit = bytes; }
+bool plmDCA_options::plan_only() { return s_plan_only; }
+bool plmDCA_options::out_of_core() { return s_out_of_core; }
+const std::string& plmDCA_options::scratch_dir() { return s_scratch_dir; }
 
 void plmDCA_options::m_init()
 {
@@ -139,8 +252,11 @@ void plmDCA_options::m_init()
 	;
 	m_algorithm_options.add_options()
 		("norm-of-mean-scoring", po::bool_switch( &plmDCA_options::s_norm_of_mean_scoring )->default_value(plmDCA_options::s_norm_of_mean_scoring)->notifier(plmDCA_options::s_init_norm_of_mean_scoring), "Calculate coupling score as the mean of J(ij) and J(ji) matrices (may require tons of memory).")
-//      ("store_parameter_matrices_to_disk", po::bool_switch( &plmDCA_options::s_store_parameter_matrices_to_disk )->default_value(plmDCA_options::s_store_parameter_matrices_to_disk)->notifier(plmDCA_options::s_init_store_parameter_matrices_to_disk), "Store parameter matrices to disk (may require tons of disk space).")
-//		("keep-n-best-couples", po::value< int >( &plmDCA_options::s_keep_n_best_couples )->default_value(plmDCA_options::s_keep_n_best_couples)->notifier(plmDCA_options::s_init_keep_n_best_couples), "The number of best solutions that are stored (-1=keep all). Has huge effect on the amount of memory used.")
+		("score-precision", po::value< std::string >( &plmDCA_options::s_score_precision )->default_value(plmDCA_options::s_score_precision)->notifier(plmDCA_options::s_init_score_precision), "Storage format of coupling scores in mean-of-norms scoring: 'fp32', or 'fp16' or 'bf16' for half the memory. Scores are only used for ranking; fp16 keeps 11 significant bits, bf16 keeps 8 bits but the full range of fp32.")
+		("store-parameters", po::bool_switch( &plmDCA_options::s_store_parameter_matrices_to_disk )->default_value(plmDCA_options::s_store_parameter_matrices_to_disk)->notifier(plmDCA_options::s_init_store_parameter_matrices_to_disk), "Store the fitted parameters (h_r and J_r) of every locus in a binary parameter file, e.g. for re-scoring without re-optimizing (may require tons of disk space: L*L*q*q values).")
+		("parameter-precision", po::value< std::string >( &plmDCA_options::s_parameter_precision )->default_value(plmDCA_options::s_parameter_precision)->notifier(plmDCA_options::s_init_parameter_precision), "Storage format of the parameter file: 'fp32', or 'fp16' or 'bf16' for half the disk space.")
+		("gauge-parameters", po::bool_switch( &plmDCA_options::s_gauge_parameters )->default_value(plmDCA_options::s_gauge_parameters)->notifier(plmDCA_options::s_init_gauge_parameters), "Store the coupling matrices of the parameter file in the gauge that coupling scores are computed in, rather than as solved.")
+		("keep-n-best-couples", po::value< int >( &plmDCA_options::s_keep_n_best_couples )->default_value(plmDCA_options::s_keep_n_best_couples)->notifier(plmDCA_options::s_init_keep_n_best_couples), "The number of best scoring couples that are kept and written, best first (-1=keep all). Only the best couples are retained as loci are solved, instead of the full L-by-L score matrix; mean-of-norms scoring only. In single-alignment runs, the first score of a pair waits in a bounded amount of memory for the second one; a warning is printed if dropping waiting scores may have cost pairs their place among the best.")
 
 		("gradient-threshold", po::value< double >( &plmDCA_options::s_gradient_threshold )->default_value(plmDCA_options::s_gradient_threshold)->notifier(plmDCA_options::s_init_gradient_threshold), "L-BFGS gradient threshold stopping criterion.")
 		("lambda-h", po::value< double >( &plmDCA_options::s_lambda_h )->default_value(plmDCA_options::s_lambda_h)->notifier(plmDCA_options::s_init_lambda_h), "h vector regularization factor (if lambda_h < 0.0, then value is automatically determined).")
@@ -149,6 +265,31 @@ void plmDCA_options::m_init()
 //		("no-estimate", po::bool_switch( &plmDCA_options::s_no_estimate )->default_value(plmDCA_options::s_no_estimate)->notifier(plmDCA_options::s_init_no_estimate), "Don't initialize DCA with estimate.")
 		("no-dca", po::bool_switch( &plmDCA_options::s_no_dca )->default_value(plmDCA_options::s_no_dca)->notifier(plmDCA_options::s_init_no_dca), "Don't run DCA (if one, for example, only wants to compute and output weights).")
 		("no-coupling-output", po::bool_switch( &plmDCA_options::s_no_coupling_output )->default_value(plmDCA_options::s_no_coupling_output)->notifier(plmDCA_options::s_init_no_coupling_output), "Don't write coupling scores to file. This option is provided for benchmarking purposes.")
+		("output-format", po::value< std::string >( &plmDCA_options::s_output_format )->default_value(plmDCA_options::s_output_format)->notifier(plmDCA_options::s_init_output_format), "Format of the coupling file: 'text', or 'scb' for a compact binary file (12 bytes per coupling) that SuperDCA-convert turns into text.")
+		("scb-compression", po::value< std::string >( &plmDCA_options::s_scb_compression )->default_value(plmDCA_options::s_scb_compression)->notifier(plmDCA_options::s_init_scb_compression), "Compression of binary coupling files: 'none' or 'zlib'.")
+		("sort-output", po::bool_switch( &plmDCA_options::s_sort_output )->default_value(plmDCA_options::s_sort_output)->notifier(plmDCA_options::s_init_sort_output), "Write couplings sorted by decreasing score (ties by position), instead of in the order in which loci are solved.")
+		("top-n", po::value< std::size_t >( &plmDCA_options::s_top_n )->default_value(plmDCA_options::s_top_n)->notifier(plmDCA_options::s_init_top_n), "Write only the N best couplings, best first (0=write all; implies --sort-output).")
+		("top-fraction", po::value< double >( &plmDCA_options::s_top_fraction )->default_value(plmDCA_options::s_top_fraction)->notifier(plmDCA_options::s_init_top_fraction), "Write only this fraction (0 < f <= 1) of all couplings, best first (implies --sort-output).")
+		("sort-memory", po::value< std::string >( &plmDCA_options::s_sort_memory_spec )->default_value(plmDCA_options::s_sort_memory_spec)->notifier(plmDCA_options::s_init_sort_memory), "Memory used for sorting couplings, in bytes or with a K, M, G or T suffix; sorted runs that do not fit are spilled to a scratch file in --scratch-dir.")
+		("min-coupling", po::value< double >( &plmDCA_options::s_min_coupling )->notifier(plmDCA_options::s_init_min_coupling), "Write only couplings that score at least this much.")
+		("min-distance", po::value< uint64_t >( &plmDCA_options::s_min_distance )->default_value(plmDCA_options::s_min_distance)->notifier(plmDCA_options::s_init_min_distance), "Write only couplings of loci that lie at least this many columns apart in the input alignment (e.g. to discard short-range linkage).")
+		("max-distance", po::value< uint64_t >( &plmDCA_options::s_max_distance )->default_value(plmDCA_options::s_max_distance)->notifier(plmDCA_options::s_init_max_distance), "Write only couplings of loci that lie at most this many columns apart in the input alignment (0=no limit).")
+		("output-optimizer-history", po::bool_switch( &plmDCA_options::s_output_optimizer_history )->default_value(plmDCA_options::s_output_optimizer_history)->notifier(plmDCA_options::s_init_output_optimizer_history), "Write per-locus optimizer statistics to file. The file can be used as '--cost-history' input in subsequent runs.")
+		("cost-history", po::value< std::string >( &plmDCA_options::s_cost_history_file_name )->notifier(plmDCA_options::s_init_cost_history_file), "Schedule loci based on per-locus cost recorded in an optimizer history file of a previous run, instead of a heuristic estimate.")
+		("no-intra-locus-parallelism", po::bool_switch( &plmDCA_options::s_no_intra_locus_parallelism )->default_value(plmDCA_options::s_no_intra_locus_parallelism)->notifier(plmDCA_options::s_init_no_intra_locus_parallelism), "Do not split the objective function of individual loci across threads once fewer loci than threads remain.")
+		("numa", po::bool_switch( &plmDCA_options::s_numa )->default_value(plmDCA_options::s_numa)->notifier(plmDCA_options::s_init_numa), "NUMA mode: pin compute threads to cores and keep a copy of the alignment data on each NUMA node.")
+		("shard", po::value< std::string >( &plmDCA_options::s_shard_spec )->notifier(plmDCA_options::s_init_shard), "Compute shard i of N (--shard i/N, 1 <= i <= N): a cost-balanced subset of the target loci. Each shard writes a partial coupling file; use SuperDCA-merge to combine the shards.")
+		("checkpoint", po::bool_switch( &plmDCA_options::s_checkpoint )->default_value(plmDCA_options::s_checkpoint)->notifier(plmDCA_options::s_init_checkpoint), "Save each completed locus to a checkpoint file, such that an interrupted run can be resumed. The run stops cleanly on SIGTERM or SIGINT. An existing checkpoint file is not overwritten; a run that finds one refuses to start unless --resume is given.")
+		("resume", po::bool_switch( &plmDCA_options::s_resume )->default_value(plmDCA_options::s_resume)->notifier(plmDCA_options::s_init_resume), "Resume an interrupted run from its checkpoint file, skipping completed loci (implies --checkpoint).")
+		("time-budget", po::value< std::string >( &plmDCA_options::s_time_budget_spec )->notifier(plmDCA_options::s_init_time_budget), "Wall time budget of the run, in seconds or as [[HH:]MM:]SS. Stop solving new loci when the budget is about to run out, write the couplings of completed loci and a list of the remaining loci that can be used as '--locilistfile' for a follow-up run.")
+		("locus-priority", po::value< std::string >( &plmDCA_options::s_locus_priority )->default_value(plmDCA_options::s_locus_priority)->notifier(plmDCA_options::s_init_locus_priority), "Order in which loci are solved: 'cost' (most expensive first; best load balance) or 'maf' (highest minor allele frequency first).")
+		("priority-file", po::value< std::string >( &plmDCA_options::s_priority_file_name )->notifier(plmDCA_options::s_init_priority_file), "Solve loci in order of user-supplied priority. Each line of the file contains a locus index and its priority; the highest priority loci are solved first.")
+		("progress-interval", po::value< double >( &plmDCA_options::s_progress_interval )->default_value(plmDCA_options::s_progress_interval)->notifier(plmDCA_options::s_init_progress_interval), "In verbose mode, report throughput, estimated time to completion and thread utilization every this many seconds (0 = only at the end of the run).")
+		("locus-log", po::value< std::string >( &plmDCA_options::s_locus_log_file_name )->notifier(plmDCA_options::s_init_locus_log), "Write per-locus optimizer statistics (fval, gnorm, nfeval, iterations, wall time) to a binary log file.")
+		("memory-limit", po::value< std::string >( &plmDCA_options::s_memory_limit_spec )->notifier(plmDCA_options::s_init_memory_limit), "Memory available to the run, in bytes or with a K, M, G or T suffix (default: the cgroup memory limit, or else physical memory). The number of threads, and if need be the scoring mode, are chosen such that the estimated peak memory use stays within the limit. In batch mode, the limit is shared equally by the jobs that run at the same time.")
+		("plan-only", po::bool_switch( &plmDCA_options::s_plan_only )->default_value(plmDCA_options::s_plan_only)->notifier(plmDCA_options::s_init_plan_only), "Print the memory plan of the run and exit without running plmDCA.")
+		("out-of-core", po::bool_switch( &plmDCA_options::s_out_of_core )->default_value(plmDCA_options::s_out_of_core)->notifier(plmDCA_options::s_init_out_of_core), "Keep the mean-of-norms coupling scores in a memory-mapped scratch file rather than in memory. This is chosen automatically when the scores do not fit the memory limit.")
+		("scratch-dir", po::value< std::string >( &plmDCA_options::s_scratch_dir )->default_value(plmDCA_options::s_scratch_dir)->notifier(plmDCA_options::s_init_scratch_dir), "Directory of the scratch file of out-of-core runs.")
 	;
 }
 
@@ -269,13 +410,22 @@ void plmDCA_options::s_init_norm_of_mean_scoring( bool flag )
 	}
 }
 
+void plmDCA_options::s_init_score_precision( const std::string& precision )
+{
+	parse_score_precision( precision ); // throws if invalid
+	if( s_verbose && s_out && precision != "fp32" )
+	{
+		*s_out << "plmDCA: store coupling scores in " << precision << " format.\n";
+	}
+}
+
 void plmDCA_options::s_init_keep_n_best_couples( int n )
 {
 	if( s_verbose && s_out )
 	{
 		if( n > 0 )
 		{
-			*s_out << "plmDCA: keep " << n << " best scoring couples.\n";
+			*s_out << "plmDCA: keep " << n << " best scoring couples; low-scoring couples are discarded as loci are solved.\n";
 		}
 		if( n < 0 )
 		{
@@ -320,6 +470,23 @@ void plmDCA_options::s_init_store_parameter_matrices_to_disk( bool flag )
 	}
 }
 
+void plmDCA_options::s_init_parameter_precision( const std::string& precision )
+{
+	parse_score_precision( precision ); // throws if invalid
+	if( s_verbose && s_out && precision != "fp32" )
+	{
+		*s_out << "plmDCA: store parameters in " << precision << " format.\n";
+	}
+}
+
+void plmDCA_options::s_init_gauge_parameters( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: store gauge-fixed coupling matrices.\n";
+	}
+}
+
 void plmDCA_options::s_init_no_estimate( bool flag )
 {
 	if( s_verbose && s_out && flag )
@@ -344,5 +511,246 @@ void plmDCA_options::s_init_no_coupling_output( bool flag )
 	}
 }
 
-} // namespace superdca
+void plmDCA_options::s_init_output_format( const std::string& format )
+{
+	if( format != "text" && format != "scb" )
+	{
+		throw std::invalid_argument( "invalid output format \"" + format + "\" (expected text or scb)" );
+	}
+	if( s_verbose && s_out && format != "text" )
+	{
+		*s_out << "plmDCA: write coupling scores in " << format << " format.\n";
+	}
+}
+
+void plmDCA_options::s_init_scb_compression( const std::string& compression )
+{
+	if( compression != "none" && compression != "zlib" )
+	{
+		throw std::invalid_argument( "invalid compression \"" + compression + "\" (expected none or zlib)" );
+	}
+}
+
+void plmDCA_options::s_init_sort_output( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: write coupling scores sorted by decreasing score.\n";
+	}
+}
 
+void plmDCA_options::s_init_top_n( std::size_t n )
+{
+	if( s_verbose && s_out && n > 0 )
+	{
+		*s_out << "plmDCA: write the " << n << " best coupling scores.\n";
+	}
+}
+
+void plmDCA_options::s_init_top_fraction( double fraction )
+{
+	if( !( fraction > 0.0 && fraction <= 1.0 ) )
+	{
+		throw std::invalid_argument( "invalid top fraction " + std::to_string(fraction) + " (expected 0 < fraction <= 1)" );
+	}
+	if( s_verbose && s_out && fraction < 1.0 )
+	{
+		*s_out << "plmDCA: write the best " << fraction*100.0 << "% of coupling scores.\n";
+	}
+}
+
+void plmDCA_options::s_init_sort_memory( const std::string& spec )
+{
+	s_sort_memory = parse_byte_size( spec, "sort memory" );
+}
+
+void plmDCA_options::s_init_min_coupling( double min_coupling )
+{
+	if( !std::isfinite( min_coupling ) )
+	{
+		throw std::invalid_argument( "invalid minimum coupling " + std::to_string(min_coupling) + " (expected a finite number)" );
+	}
+	if( s_verbose && s_out )
+	{
+		*s_out << "plmDCA: write only coupling scores of at least " << min_coupling << ".\n";
+	}
+}
+
+void plmDCA_options::s_init_min_distance( uint64_t distance )
+{
+	if( s_verbose && s_out && distance > 0 )
+	{
+		*s_out << "plmDCA: write only coupling scores of loci at least " << distance << " columns apart.\n";
+	}
+}
+
+void plmDCA_options::s_init_max_distance( uint64_t distance )
+{
+	if( s_verbose && s_out && distance > 0 )
+	{
+		*s_out << "plmDCA: write only coupling scores of loci at most " << distance << " columns apart.\n";
+	}
+}
+
+void plmDCA_options::s_init_output_optimizer_history( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: output per-locus optimizer statistics to file.\n";
+	}
+}
+
+void plmDCA_options::s_init_cost_history_file( const std::string& filename )
+{
+	if( s_verbose && s_out )
+	{
+		*s_out << "plmDCA: schedule loci based on optimizer history in file \"" << filename << "\".\n";
+	}
+}
+
+void plmDCA_options::s_init_no_intra_locus_parallelism( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: intra-locus parallelism disabled.\n";
+	}
+}
+
+void plmDCA_options::s_init_numa( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: NUMA mode enabled.\n";
+	}
+}
+
+void plmDCA_options::s_init_shard( const std::string& spec )
+{
+	std::istringstream fields( spec );
+	std::size_t shard = 0, n_shards = 0; char slash = 0;
+	if( !(fields >> shard >> slash >> n_shards) || slash != '/' || !(fields >> std::ws).eof() || shard < 1 || shard > n_shards )
+	{
+		throw std::invalid_argument( "invalid shard \"" + spec + "\" (expected i/N, where 1 <= i <= N)" );
+	}
+	s_shard = shard-1;
+	s_n_shards = n_shards;
+
+	if( s_verbose && s_out )
+	{
+		*s_out << "plmDCA: compute shard " << shard << " of " << n_shards << ".\n";
+	}
+}
+
+void plmDCA_options::s_init_checkpoint( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: checkpointing enabled.\n";
+	}
+}
+
+void plmDCA_options::s_init_resume( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: resume from checkpoint, if available.\n";
+	}
+}
+
+void plmDCA_options::s_init_time_budget( const std::string& spec )
+{
+	// accept plain seconds or [[HH:]MM:]SS, as used by batch schedulers
+	std::istringstream fields( spec );
+	double seconds = 0.0;
+	std::size_t n_fields = 0;
+	std::string field;
+	while( std::getline( fields, field, ':' ) )
+	{
+		std::istringstream value_stream( field );
+		double value = 0.0;
+		if( field.empty() || !(value_stream >> value) || !(value_stream >> std::ws).eof() || value < 0.0 || ++n_fields > 3 )
+		{
+			throw std::invalid_argument( "invalid time budget \"" + spec + "\" (expected seconds or [[HH:]MM:]SS)" );
+		}
+		seconds = seconds*60.0 + value;
+	}
+	if( n_fields == 0 || seconds <= 0.0 )
+	{
+		throw std::invalid_argument( "invalid time budget \"" + spec + "\" (expected seconds or [[HH:]MM:]SS)" );
+	}
+	s_time_budget = seconds;
+
+	if( s_verbose && s_out )
+	{
+		*s_out << "plmDCA: time budget is " << seconds << " seconds.\n";
+	}
+}
+
+void plmDCA_options::s_init_locus_priority( const std::string& priority )
+{
+	if( priority != "cost" && priority != "maf" )
+	{
+		throw std::invalid_argument( "invalid locus priority \"" + priority + "\" (expected 'cost' or 'maf')" );
+	}
+	if( s_verbose && s_out && priority != "cost" )
+	{
+		*s_out << "plmDCA: solve loci in order of decreasing minor allele frequency.\n";
+	}
+}
+
+void plmDCA_options::s_init_priority_file( const std::string& filename )
+{
+	if( s_verbose && s_out )
+	{
+		*s_out << "plmDCA: solve loci in order of priority given in file \"" << filename << "\".\n";
+	}
+}
+
+void plmDCA_options::s_init_progress_interval( double seconds )
+{
+	if( seconds < 0.0 )
+	{
+		throw std::invalid_argument( "invalid progress interval (must be >= 0)" );
+	}
+}
+
+void plmDCA_options::s_init_locus_log( const std::string& filename )
+{
+	if( s_verbose && s_out )
+	{
+		*s_out << "plmDCA: write per-locus statistics to binary log file \"" << filename << "\".\n";
+	}
+}
+
+void plmDCA_options::s_init_memory_limit( const std::string& spec )
+{
+	s_memory_limit = parse_byte_size( spec, "memory limit" );
+
+	if( s_verbose && s_out )
+	{
+		*s_out << "plmDCA: memory limit is " << s_memory_limit << " bytes.\n";
+	}
+}
+
+void plmDCA_options::s_init_plan_only( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: print the memory plan and exit.\n";
+	}
+}
+
+void plmDCA_options::s_init_out_of_core( bool flag )
+{
+	if( s_verbose && s_out && flag )
+	{
+		*s_out << "plmDCA: keep coupling scores in a memory-mapped scratch file.\n";
+	}
+}
+
+void plmDCA_options::s_init_scratch_dir( const std::string& dir )
+{
+	if( !boost::filesystem::is_directory( dir ) ) { throw std::invalid_argument( "scratch directory \"" + dir + "\" does not exist" ); }
+}
+
+} // namespace superdca